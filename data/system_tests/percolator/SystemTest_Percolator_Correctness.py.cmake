@@ -40,14 +40,15 @@ def canPercRunThisXml(testName,flags,testFile):
 def canPercRunThisTab(testName,flags,testFile):
   return canPercRunThis(testName,flags,testFile,"",False)
 
-def canPercRunThis(testName,flags,testFile,testFileFlag="",checkValidXml=True):
+def canPercRunThis(testName,flags,testFile,testFileFlag="",checkValidXml=True,writeXml=True):
   success = True
   outputPath = os.path.join(pathToOutputData,"PERCOLATOR_"+testName)
   xmlOutput = doubleQuote(outputPath + ".pout.xml")
   txtOutput = doubleQuote(outputPath + ".txt")
   readPath = doubleQuote(os.path.join(pathToData, testFile))
   percExe = doubleQuote(os.path.join(pathToBinaries, "percolator"))
-  cmd = ' '.join([percExe, testFileFlag, readPath, '-S 2 -X', xmlOutput, flags, '>', txtOutput,'2>&1'])
+  xmlFlag = ' '.join(['-X', xmlOutput]) if writeXml else ''
+  cmd = ' '.join([percExe, testFileFlag, readPath, '-S 2', xmlFlag, flags, '>', txtOutput,'2>&1'])
   processFile = os.popen(cmd)
   exitStatus = processFile.close()
   if exitStatus is not None:
@@ -63,6 +64,25 @@ def canPercRunThis(testName,flags,testFile,testFileFlag="",checkValidXml=True):
 def doubleQuote(path):
   return ''.join(['"',path,'"'])
 
+# flags writing the target and decoy psm results of a test to separate files
+def resultFlags(testName):
+  outputPath = os.path.join(pathToOutputData,"PERCOLATOR_"+testName)
+  return ' '.join(['-r', doubleQuote(outputPath + ".target.psms.txt"), 
+                   '-B', doubleQuote(outputPath + ".decoy.psms.txt")])
+
+# checks that two tests written with resultFlags produced identical results
+def haveSameResults(testName,referenceName):
+  success = True
+  for kind in ["target","decoy"]:
+    outputFile = os.path.join(pathToOutputData,"PERCOLATOR_"+testName+"."+kind+".psms.txt")
+    referenceFile = os.path.join(pathToOutputData,"PERCOLATOR_"+referenceName+"."+kind+".psms.txt")
+    if not os.path.isfile(outputFile) or not os.path.isfile(referenceFile) or \
+        open(outputFile).read() != open(referenceFile).read():
+      print("...TEST FAILED: the "+kind+" psms of "+testName+" differ from those of "+referenceName)
+      print("check "+outputFile+" and "+referenceFile+" for details")
+      success = False
+  return success
+
 
 T = Tester()
 
@@ -110,7 +130,52 @@ print("(*) running percolator with description of correct features option...")
 T.doTest(canPercRunThisTab("tab_D4on","-y -D 4 -U","percolator/tab/percolatorTabDOC"))
 
 print("(*) running percolator with subset training option...")
-T.doTest(canPercRunThisTab("tab_subset_training","-y -N 1000 -U","percolator/tab/percolatorTab"))
+T.doTest(canPercRunThisTab("tab_subset_training","-y -N 1000 -U " + resultFlags("tab_subset_training"),"percolator/tab/percolatorTab"))
+
+print("(*) running percolator with 5 cross validation bins...")
+T.doTest(canPercRunThisTab("tab_num_folds","-y -U --num-folds 5","percolator/tab/percolatorTab"))
+
+print("(*) running percolator with warm started SVM trainings...")
+T.doTest(canPercRunThisTab("tab_svm_warm_start","-y -U --svm-warm-start","percolator/tab/percolatorTab"))
+
+print("(*) running percolator with a batched parallel search of the PEP spline penalty...")
+T.doTest(canPercRunThisTab("tab_pep_alpha_batch","-U --pep-alpha-batch 4","percolator/tab/percolatorTab"))
+
+print("(*) running percolator with a parallel bootstrap of the pi0 estimate...")
+T.doTest(canPercRunThisTab("tab_pi0_parallel_bootstrap","-y -U --pi0-parallel-bootstrap","percolator/tab/percolatorTab"))
+
+print("(*) running percolator with subset training and streamed scoring of all PSMs, comparing the results with those of the in-memory scoring...")
+T.doTest(canPercRunThis("tab_stream_scoring","-y -N 1000 -U --stream-scoring " + resultFlags("tab_stream_scoring"),"percolator/tab/percolatorTab","",False,False) and
+         haveSameResults("tab_stream_scoring","tab_subset_training"))
+
+print("(*) running percolator to save the trained model...")
+modelFile=os.path.join(pathToOutputData, "percolatorTab.model")
+T.doTest(canPercRunThisTab("tab_save_model","-y -U --save-model " + modelFile,"percolator/tab/percolatorTab"))
+
+print("(*) running percolator with a saved model instead of training...")
+T.doTest(canPercRunThisTab("tab_apply_model","-U --apply-model " + modelFile,"percolator/tab/percolatorTab"))
+
+print("(*) running percolator to save a model trained on a subset...")
+subsetModelFile=os.path.join(pathToOutputData, "percolatorTabSubset.model")
+T.doTest(canPercRunThisTab("tab_save_subset_model","-Y -N 1000 -U --save-model " + doubleQuote(subsetModelFile) + " " + resultFlags("tab_save_subset_model"),"percolator/tab/percolatorTab"))
+
+print("(*) running percolator with the saved subset model, comparing the results with those of the training run...")
+T.doTest(canPercRunThisTab("tab_apply_subset_model","-U --apply-model " + doubleQuote(subsetModelFile) + " " + resultFlags("tab_apply_subset_model"),"percolator/tab/percolatorTab") and
+         haveSameResults("tab_apply_subset_model","tab_save_subset_model"))
+
+# running percolator with option to process binary input
+print("- PERCOLATOR BINARY FORMAT")
+
+print("(*) running percolator to generate binary input...")
+binData=os.path.join(pathToOutputData, "percolatorTab.bin")
+T.doTest(canPercRunThisTab("bin_generate","-y -U --bin-out " + doubleQuote(binData) + " " + resultFlags("bin_generate"),"percolator/tab/percolatorTab"))
+
+print("(*) running percolator on binary input to calculate psm probabilities, comparing the results with those of the tab input...")
+T.doTest(canPercRunThisTab("bin_psms","-y -U " + resultFlags("bin_psms"),binData) and
+         haveSameResults("bin_psms","bin_generate"))
+
+print("(*) running percolator on binary input with subset training option...")
+T.doTest(canPercRunThisTab("bin_subset_training","-y -N 1000 -U",binData))
 
 # if no errors were encountered, succeed
 if T.failures == 0:
@@ -33,6 +33,23 @@ if exitStatus is not None:
   print("check qvalityOutput.txt for details")
   success = False
 
+# running qvality with the scores sorted on disk
+print("(*): running qvality with streamed scores...")
+processFile = os.popen(' '.join([doubleQuote(os.path.join(pathToBinaries, "qvality")), "-S",
+  doubleQuote(os.path.join(pathToData, "qvality/target.xcorr")),
+  doubleQuote(os.path.join(pathToData, "qvality/null.xcorr")), 
+  '>', doubleQuote(os.path.join(pathToOutputData, "qvalityStreamOutput.txt")),'2>&1']))
+
+exitStatus = processFile.close()
+if exitStatus is not None:
+  print(' '.join([doubleQuote(os.path.join(pathToBinaries, "qvality")), "-S",
+    doubleQuote(os.path.join(pathToData, "qvality/target.xcorr")),
+    doubleQuote(os.path.join(pathToData, "qvality/null.xcorr")), 
+    '>', doubleQuote(os.path.join(pathToOutputData, "qvalityStreamOutput.txt")),'2>&1']))
+  print("...TEST FAILED: qvality -S terminated with " + str(exitStatus) + " exit status")
+  print("check qvalityStreamOutput.txt for details")
+  success = False
+
 # if no errors were encountered, succeed
 if success == True:
  print("...TEST SUCCEEDED")
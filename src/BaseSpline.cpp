@@ -41,6 +41,7 @@ double BaseSpline::convergeEpsilon = 1e-4;
 double BaseSpline::stepEpsilon = 1e-8;
 double BaseSpline::weightSlope = 1e1;
 double BaseSpline::scaleAlpha = 1;
+unsigned int BaseSpline::alphaBatchSize = 0;
 
 double BaseSpline::splineEval(double xx) {
   xx = transf(xx);
@@ -77,6 +78,69 @@ double BaseSpline::splineEval(double xx) {
   return gx;
 }
 
+/**
+ * Factorizes the matrix as L D L^T, L unit lower triangular with two
+ * subdiagonals. No pivoting is needed as the matrix is positive definite.
+ */
+void PentadiagonalLDLT::factorize(const std::vector<double>& k0,
+    const std::vector<double>& k1, const std::vector<double>& k2) {
+  int n = k0.size();
+  d.resize(n);
+  l1.assign(n, 0.0);
+  l2.assign(n, 0.0);
+  for (int row = 0; row < n; ++row) {
+    d[row] = k0[row];
+    if (row >= 1) d[row] -= l1[row - 1] * l1[row - 1] * d[row - 1];
+    if (row >= 2) d[row] -= l2[row - 2] * l2[row - 2] * d[row - 2];
+    if (row + 1 < n) {
+      l1[row] = k1[row];
+      if (row >= 1) l1[row] -= l1[row - 1] * l2[row - 1] * d[row - 1];
+      l1[row] /= d[row];
+    }
+    if (row + 2 < n) {
+      l2[row] = k2[row] / d[row];
+    }
+  }
+}
+
+void PentadiagonalLDLT::solveInPlace(std::vector<double>& b) const {
+  int n = d.size();
+  // forward substitution with L, then D, then backward substitution with L^T
+  for (int row = 1; row < n; ++row) {
+    b[row] -= l1[row - 1] * b[row - 1];
+    if (row >= 2) b[row] -= l2[row - 2] * b[row - 2];
+  }
+  for (int row = 0; row < n; ++row) {
+    b[row] /= d[row];
+  }
+  for (int row = n - 1; row--; ) {
+    b[row] -= l1[row] * b[row + 1];
+    if (row + 2 < n) b[row] -= l2[row] * b[row + 2];
+  }
+}
+
+/**
+ * Calculates the three central diagonals of the inverse from the bottom up,
+ * without forming the rest of it (Hutchinson and de Hoog)
+ */
+void PentadiagonalLDLT::inverseBands(std::vector<double>& b0,
+    std::vector<double>& b1, std::vector<double>& b2) const {
+  int n = d.size();
+  b0.assign(n, 0.0);
+  b1.assign(n, 0.0);
+  b2.assign(n, 0.0);
+  for (int row = n; row--; ) {
+    if (row + 2 < n) {
+      b2[row] = -l1[row] * b1[row + 1] - l2[row] * b0[row + 2];
+    }
+    if (row + 1 < n) {
+      b1[row] = -l1[row] * b0[row + 1];
+      if (row + 2 < n) b1[row] -= l2[row] * b1[row + 1];
+    }
+    b0[row] = 1 / d[row] - l1[row] * b1[row] - l2[row] * b2[row];
+  }
+}
+
 static double tao = 2 / (1 + sqrt(5.0)); // inverse of golden section
 
 void BaseSpline::roughnessPenaltyIRLS_Old() {
@@ -116,14 +180,19 @@ void BaseSpline::roughnessPenaltyIRLS_Old() {
 void BaseSpline::roughnessPenaltyIRLS() {
   initiateQR();
   initg();
-  double p1 = 1 - tao;
-  double p2 = tao;
-  double alpha = alphaLinearSearchBA(0.0,
-                          1.0,
-                          p1,
-                          p2,
-                          evaluateSlope(-scaleAlpha*log(p1)),
-                          evaluateSlope(-scaleAlpha*log(p2)));
+  double alpha;
+  if (alphaBatchSize > 1) {
+    alpha = alphaBatchSearch(0.0, 1.0);
+  } else {
+    double p1 = 1 - tao;
+    double p2 = tao;
+    alpha = alphaLinearSearchBA(0.0,
+                                1.0,
+                                p1,
+                                p2,
+                                evaluateSlope(-scaleAlpha*log(p1)),
+                                evaluateSlope(-scaleAlpha*log(p2)));
+  }
   if (VERB > 2) {
     cerr << "Alpha selected to be " << alpha << endl;
   }
@@ -134,18 +203,33 @@ void BaseSpline::iterativeReweightedLeastSquares(double alpha) {
   double step = 0.0;
   int iter = 0;
   unsigned int n = x.size();
+  std::vector<double> k0, k1, k2;
+  PentadiagonalLDLT ldlt;
   do {
     g = gnew;
     calcPZW();
-    PackedMatrix diag = PackedMatrix::packedDiagonalMatrix(PackedVector(n, 1) / w).packedMultiply(alpha);
-    PackedMatrix aWiQ = (diag).packedMultiply(Q);
-    PackedMatrix M = R.packedAdd(Qt.packedMultiply(aWiQ));
-    gamma = Qt.packedMultiply(z);
-    solveInPlace(M,gamma);
-    gnew = z.packedSubtract(aWiQ.packedMultiply(gamma));
+    // solve (R + alpha Q^T W^-1 Q) gamma = Q^T z
+    penalizedBands(alpha, k0, k1, k2);
+    ldlt.factorize(k0, k1, k2);
+    for (unsigned int j = 0; j < n - 2; ++j) {
+      gamma[j] = qa[j] * z[j] + qb[j] * z[j + 1] + qc[j] * z[j + 2];
+    }
+    ldlt.solveInPlace(gamma);
+    // gnew = z - alpha W^-1 Q gamma
+    double diffSq = 0.0;
+    for (unsigned int ix = 0; ix < n; ++ix) {
+      double qGamma = 0.0;
+      if (ix < n - 2) qGamma += qa[ix] * gamma[ix];
+      if (ix >= 1 && ix - 1 < n - 2) qGamma += qb[ix - 1] * gamma[ix - 1];
+      if (ix >= 2) qGamma += qc[ix - 2] * gamma[ix - 2];
+      gnew[ix] = z[ix] - alpha / w[ix] * qGamma;
+    }
     limitg();
-    PackedVector difference = g.packedSubtract(gnew);
-    step = packedNorm(difference) / n;
+    for (unsigned int ix = 0; ix < n; ++ix) {
+      double diff = g[ix] - gnew[ix];
+      diffSq += diff * diff;
+    }
+    step = sqrt(diffSq) / n;
     if (VERB > 3) {
       cerr << "step size:" << step << endl;
     }
@@ -224,47 +308,129 @@ double BaseSpline::alphaLinearSearchBA(double min_p,
   return alphaLinearSearchBA(min_p, max_p, p1, p2, cv1, cv2);
 }
 
+/**
+ * Minimizes the slope score like alphaLinearSearchBA, but evaluates
+ * alphaBatchSize equally spaced points of the bracket concurrently, each on
+ * its own copy of the spline, and then narrows the bracket to the evaluated
+ * neighbours of the best point. All copies start from the fit of the best
+ * point so far, as each probe of alphaLinearSearchBA starts from the fit of
+ * the previous one.
+ * @param min_p lower end of the bracket, in p = exp(-alpha/scaleAlpha)
+ * @param max_p upper end of the bracket
+ * @return the selected alpha
+ */
+double BaseSpline::alphaBatchSearch(double min_p, double max_p) {
+  const int numPoints = static_cast<int>(alphaBatchSize);
+  vector<BaseSpline*> splines(numPoints);
+  for (int ix = 0; ix < numPoints; ++ix) {
+    splines[ix] = clone();
+  }
+  vector<double> ps(numPoints), cvs(numPoints);
+  vector<double> bestGnew = gnew;
+  double bestP = -1.0, bestCV = 0.0;
+  unsigned int round = 0;
+  do {
+    double step = (max_p - min_p) / (numPoints + 1);
+    for (int ix = 0; ix < numPoints; ++ix) {
+      ps[ix] = min_p + (ix + 1) * step;
+      splines[ix]->gnew = bestGnew;
+    }
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int ix = 0; ix < numPoints; ++ix) {
+      cvs[ix] = splines[ix]->evaluateSlope(-scaleAlpha*log(ps[ix]));
+    }
+    // the best point of the previous round lies inside the bracket as well
+    vector<pair<double, double> > points;
+    for (int ix = 0; ix < numPoints; ++ix) {
+      points.push_back(make_pair(ps[ix], cvs[ix]));
+      if (VERB > 3) {
+        cerr << "New point with alpha=" << -scaleAlpha*log(ps[ix]) << ", giving slopeScore=" << cvs[ix] << endl;
+      }
+    }
+    if (bestP > 0.0) {
+      points.push_back(make_pair(bestP, bestCV));
+      sort(points.begin(), points.end());
+    }
+    size_t bestIx = 0;
+    double worstCV = points[0].second;
+    for (size_t ix = 1; ix < points.size(); ++ix) {
+      if (points[ix].second < points[bestIx].second) bestIx = ix;
+      worstCV = max(worstCV, points[ix].second);
+    }
+    if (points[bestIx].first != bestP) {
+      int splineIx = static_cast<int>(find(ps.begin(), ps.end(),
+          points[bestIx].first) - ps.begin());
+      bestGnew = splines[splineIx]->gnew;
+    }
+    bestP = points[bestIx].first;
+    bestCV = points[bestIx].second;
+    if (bestIx > 0) min_p = points[bestIx - 1].first;
+    if (bestIx + 1 < points.size()) max_p = points[bestIx + 1].first;
+    if (worstCV - bestCV <= 1e-5 * fabs(worstCV) || max_p - min_p < 1e-10) {
+      break;
+    }
+  } while (++round < 100);
+  for (int ix = 0; ix < numPoints; ++ix) {
+    delete splines[ix];
+  }
+  gnew = bestGnew;
+  return -scaleAlpha*log(bestP);
+}
+
 void BaseSpline::initiateQR() {
   int n = x.size();
-  dx.resize(n-1);
+  dx.resize(n - 1);
   for (int ix = 0; ix < n - 1; ix++) {
-    dx.addElement(ix, x[ix + 1] - x[ix]);
+    dx[ix] = x[ix + 1] - x[ix];
     assert(dx[ix] > 0);
   }
-  Q = PackedMatrix(n,n-2);
-  R = PackedMatrix(n-2, n-2);
-  //Fill Q
-  Q[0].packedAddElement(0, 1 / dx[0]);
-  Q[1].packedAddElement(0, -1 / dx[0] - 1 / dx[1]);
-  Q[1].packedAddElement(1, 1 / dx[1]);
-  for (int j = 2; j < n - 2; j++) {
-    Q[j].packedAddElement(j-2, 1 / dx[j - 1]);
-    Q[j].packedAddElement(j-1, -1 / dx[j - 1] - 1 / dx[j]);
-    Q[j].packedAddElement(j, 1 / dx[j]);
+  qa.resize(n - 2);
+  qb.resize(n - 2);
+  qc.resize(n - 2);
+  r0.resize(n - 2);
+  r1.resize(n - 2, 0.0);
+  for (int j = 0; j < n - 2; j++) {
+    qa[j] = 1 / dx[j];
+    qb[j] = -1 / dx[j] - 1 / dx[j + 1];
+    qc[j] = 1 / dx[j + 1];
+    r0[j] = (dx[j] + dx[j + 1]) / 3;
+    if (j < n - 3) {
+      r1[j] = dx[j + 1] / 6;
+    }
   }
-  Q[n - 2].packedAddElement(n-4, 1 / dx[n - 3]);
-  Q[n - 2].packedAddElement(n - 3, -1 / dx[n - 3] - 1 / dx[n - 2]);
-  Q[n - 1].packedAddElement(n - 3,  1 / dx[n - 2]);
-  //Fill R
-  for (int i = 0; i < n - 3; i++) {
-    R[i].packedAddElement(i, (dx[i] + dx[i + 1]) / 3);
-    R[i].packedAddElement(i + 1, dx[i + 1] / 6);
-    R[i + 1].packedAddElement(i, dx[i + 1] / 6);
+}
+
+/**
+ * Calculates the bands of the pentadiagonal matrix R + alpha Q^T W^-1 Q,
+ * using that column j of Q only has entries in the rows j to j+2
+ */
+void BaseSpline::penalizedBands(double alpha, std::vector<double>& k0,
+    std::vector<double>& k1, std::vector<double>& k2) {
+  int m = qa.size();
+  k0.resize(m);
+  k1.assign(m, 0.0);
+  k2.assign(m, 0.0);
+  for (int j = 0; j < m; j++) {
+    k0[j] = r0[j] + alpha * (qa[j] * qa[j] / w[j] + qb[j] * qb[j] / w[j + 1]
+                             + qc[j] * qc[j] / w[j + 2]);
+    if (j + 1 < m) {
+      k1[j] = r1[j] + alpha * (qb[j] * qa[j + 1] / w[j + 1]
+                               + qc[j] * qb[j + 1] / w[j + 2]);
+    }
+    if (j + 2 < m) {
+      k2[j] = alpha * qc[j] * qa[j + 2] / w[j + 2];
+    }
   }
-  R[n - 3].packedAddElement(n - 3, (dx[n - 3] + dx[n - 2]) / 3);
-  Qt = PackedMatrix(n-2,n);
-  Qt = Qt.packedTranspose(Q);
 }
 
 double BaseSpline::evaluateSlope(double alpha) {
   // Calculate a spline for current alpha
   iterativeReweightedLeastSquares(alpha);
   // Find highest point (we only want to evaluate things to the right of that point)
-  int n = g.numberEntries();
+  int n = g.size();
   int mixg=1; // Ignore 0 and n-1
   double maxg = g[mixg];
   for (int ix=mixg;ix<n-1;++ix) {
-    assert(ix=g.index(ix)); //This should be a filled vector
     if (g[ix]>=maxg) {
       maxg = g[ix];
       mixg = ix;
@@ -290,61 +456,15 @@ double BaseSpline::evaluateSlope(double alpha) {
 
 
 double BaseSpline::crossValidation(double alpha) {
-  int n = R.numRows();
-  //  Vec k0(n),k1(n),k2(n);
-  vector<double> k0(n), k1(n), k2(n);
-  PackedMatrix B = R.packedAdd( ((Qt.packedMultiply(alpha)).packedMultiply(
-      PackedMatrix::packedDiagonalMatrix(Vector(n+2, 1.0) / w)).packedMultiply(Q)));
-  // Get the diagonals from K
-  // ka[i]=B[i,i+a]=B[i+a,i]
-  for (int row = 0; row < n; ++row) {
-    for (int rowPos = B[row].numberEntries(); rowPos--;) {
-      int col = B[row].index(rowPos);
-      if (col == row) {
-        k0[row] = B[row][rowPos];
-      } else if (col + 1 == row) {
-        k1[row] = B[row][rowPos];
-      } else if (col + 2 == row) {
-        k2[row] = B[row][rowPos];
-      }
-    }
-  }
-  // LDL decompose Page 26 Green Silverman
-  // d[i]=D[i,i]
-  // la[i]=L[i+a,i]
-  //  Vec d(n),l1(n),l2(n);
-  vector<double> d(n), l1(n), l2(n);
-  d[0] = k0[0];
-  l1[0] = k1[0] / d[0];
-  d[1] = k0[1] - l1[0] * l1[0] * d[0];
-  for (int row = 2; row < n; ++row) {
-    l2[row - 2] = k2[row - 2] / d[row - 2];
-    l1[row - 1] = (k1[row - 1] - l1[row - 2] * l2[row - 2] * d[row - 2])
-        / d[row - 1];
-    d[row] = k0[row] - l1[row - 1] * l1[row - 1] * d[row - 1]
-        - l2[row - 2] * l2[row - 2] * d[row - 2];
-  }
-  // Find diagonals of inverse Page 34 Green Silverman
-  // ba[i]=B^{-1}[i+a,i]=B^{-1}[i,i+a]
-  //  Vec b0(n),b1(n),b2(n);
-  vector<double> b0(n), b1(n), b2(n);
-  for (int row = n; --row;) {
-    if (row == n - 1) {
-      b0[n - 1] = 1 / d[n - 1];
-    } else if (row == n - 2) {
-      b0[n - 2] = 1 / d[n - 2] - l1[n - 2] * b1[n - 2];
-    } else {
-      b0[row] = 1 / d[row] - l1[row] * b1[row] - l2[row] * b2[row];
-    }
-    if (row == n - 1) {
-      b1[n - 2] = -l1[n - 2] * b0[n - 1];
-    } else if (row >= 1) {
-      b1[row - 1] = -l1[row - 1] * b0[row] - l1[row] * b1[row];
-    }
-    if (row >= 2) {
-      b2[row - 2] = -l1[row - 2] * b0[row];
-    }
-  }
+  int n = qa.size();
+  vector<double> k0, k1, k2;
+  penalizedBands(alpha, k0, k1, k2);
+  // LDL decompose Page 26 Green Silverman and find the diagonals of the
+  // inverse Page 34 Green Silverman
+  PentadiagonalLDLT ldlt;
+  ldlt.factorize(k0, k1, k2);
+  vector<double> b0, b1, b2;
+  ldlt.inverseBands(b0, b1, b2);
   // Calculate diagonal elements a[i]=Aii p35 Green Silverman
   // (expanding q according to p12)
   //  Vec a(n+2),c(n+1);
@@ -405,165 +525,3 @@ void BaseSpline::setData(const vector<double>& xx) {
   }
   transform(xx.begin(), xx.end(), back_inserter(x), transf);
 }
-
-void BaseSpline::solveInPlace(PackedMatrix& mat, PackedVector& res) {
-  res = res.makeSparse();
-  // Current implementation requires a quadratic mat
-  int nCol = mat.numCols();
-  PackedVector nonEmpty;
-  int col, row, rowPos;
-  for (col = 0; col < nCol; col++) {
-    //int stop = 1;
-    //if(col==stop-1){
-//      cout << "*********************"<<endl;
-//      cout << col << endl;
-//      cout << "*********************"<<endl;
-//      mat.displayMatrix();
-//      cout << "RES: " <<res.values<<endl;
-    //}
-
-    // find the non-null elements in this column (below row "col")
-    nonEmpty = PackedVector();
-    int pivotPos(-1);
-    for (row = col; row < mat.numRows(); row++) {
-      int rowEntries = mat[row].numberEntries();
-      for (rowPos = rowEntries; rowPos--;) {
-        int entryIndex = mat[row].index(rowPos);
-        if (entryIndex == col) {
-          nonEmpty.packedAddElement(row, mat[row][rowPos]);
-          if (row == col) {
-            pivotPos = nonEmpty.numberEntries()-1;
-          }
-        }
-      }
-    }
-//    if(col==stop-1){
-//      cout<<"nonEmpty " << nonEmpty.values<< endl;
-//      cout<<"pivot " << pivotPos<< endl<<endl;
-//    }
-
-    //find most significant row
-    double maxVal(0.0);
-    int maxRow(-1), maxRowPos(-1);
-    for (rowPos = nonEmpty.numberEntries(); rowPos--;) {
-      double val = nonEmpty[rowPos];
-      assert(isfinite(val));
-      if (fabs(val) > fabs(maxVal)) {
-        maxVal = val;
-        maxRow = nonEmpty.index(rowPos);
-        maxRowPos = rowPos;
-      }
-    }
-    //int imaxRow = maxRow;
-    //int imaxRowPos = maxRowPos;
-//    if(col==stop-1){
-//      cout << "imaxRow " << imaxRow << endl;
-//      cout << "imaxRowPos " << imaxRowPos << endl<<endl;
-//    }
-
-    // Put the most significant row at row "col"
-    if (maxVal != 0.0) {
-      if (maxRow != col) {
-        swap(mat[col], mat[maxRow]);
-        res.swapElements(col, maxRow);
-
-        if (pivotPos >= 0) {
-          nonEmpty.swapElements(maxRowPos, pivotPos);
-        }
-      }
-//      if(col==stop-1){
-//        cout << "SWAP\n";
-//        mat.displayMatrix();
-//      }
-
-      // Divide the row with maxVal
-      mat[col].packedDiv(maxVal);
-      double value = res[col] / maxVal;
-      res.packedReplace(col,value);
-//      if(col==stop-1){
-//        cout << "\nDIVIDE ROW\n";
-//        mat.displayMatrix();
-//        cout << "res " << res.values<<endl;
-//        cout << "nonEmpty " << nonEmpty.values<<endl;
-//        cout << "\n\n";
-//      }
-    }
-    // subtract the row from other rows
-    for (rowPos = nonEmpty.numberEntries(); rowPos--;) {
-      row = nonEmpty.index(rowPos);
-      if (row == col) {
-        continue;
-      }
-      // If the pivotRow was empty (prior to swap) at col=row do not process this row
-      if (pivotPos < 0 && row == maxRow) {
-        continue;
-      }
-      double val = nonEmpty[rowPos];
-      PackedVector prodVector = mat[col];
-      mat[row] = mat[row].packedSubtract(prodVector.packedProd(val));
-      double value = res[row] - (val * res[col]);
-      res.packedReplace(row, value);
-
-//      if(col==stop-1){
-//        cout << "SUBTRACT ROW\n";
-//        mat.displayMatrix();
-//        cout << "res " << res.values<<endl;
-//        cout << "nonEmpty " << nonEmpty.values<<endl;
-//        cout << "\n\n";
-//      }
-    }
-  }
-  // Go bottom up and clear upper halfmatrix
-//  mat.displayMatrix();
-//  res.displayVector();
-//  nonEmpty.displayVector();
-//  cout << "\n\n\n\n";
-  for (col = mat.numCols(); col--;) {
-    nonEmpty = PackedVector();
-    for (row = 0; row < col; row++) {
-      for (rowPos = mat[row].numberEntries(); rowPos--;) {
-        if (mat[row].index(rowPos) == col) {
-          nonEmpty.packedAddElement(row, mat[row][rowPos]);
-        }
-      }
-    }
-//    cout << nonEmpty.values<<endl;
-    // subtract the row from other rows
-    for (rowPos = nonEmpty.numberEntries(); rowPos--;) {
-      row = nonEmpty.index(rowPos);
-      double val = nonEmpty[rowPos];
-      mat[row] = mat[row].packedSubtract(mat[col].packedProd(val));
-      double value = res[row] - (val * res[col]);
-      res.packedReplace(row, value);
-    }
-//    cout << res.values<<endl;
-  }
-  return;
-}
-
-void BaseSpline::testPerformance(){
-  cout << "\nTesting performance for fido:\n";
-  PackedVector v;
-  PackedMatrix M1;
-  PackedMatrix M2;
-  for (int n= 500; n <= 1000; n+=100){
-    cout << "********** " << "\n";
-    cout << "MATRIX DIM: " << n << "\n";
-    cout << "********** "<< "\n";
-    double s = 2.0;
-    v = PackedVector(n,3.0);
-    M1 = PackedMatrix(n,n);
-    M2 = PackedMatrix(n,n);
-    for (signed i = 0; i < signed (n); ++ i){
-      for (signed j = max (i-1, 0); j < min (i+2, signed (n)); ++ j){
-        M1[i].packedAddElement(j, 3 * i + j);
-        M2[i].packedAddElement(j, 2 * i + j);
-      }
-    }
-    M1.packedMultiply(s);
-    M1.packedMultiply(v);
-    M1.packedAdd(M2);
-    M1.packedMultiply(M2);
-    cout << endl;
-  }
-}
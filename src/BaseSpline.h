@@ -19,9 +19,30 @@
 #define BASESPLINE_H_
 
 #include <assert.h>
+#include <utility>
+#include <vector>
 #include "Transform.h"
-#include "PackedVector.h"
-#include "PackedMatrix.h"
+using namespace std;
+
+/*
+* PentadiagonalLDLT factorizes a symmetric positive definite pentadiagonal
+* matrix as L D L^T in O(n) and solves linear systems with it. The matrix is
+* given by its diagonal k0 and its first two off diagonals,
+* k1[i] = A[i][i+1] and k2[i] = A[i][i+2].
+*/
+class PentadiagonalLDLT {
+  public:
+    void factorize(const std::vector<double>& k0,
+                   const std::vector<double>& k1,
+                   const std::vector<double>& k2);
+    void solveInPlace(std::vector<double>& b) const;
+    // diagonals of the inverse, ba[i] = A^{-1}[i][i+a]
+    void inverseBands(std::vector<double>& b0, std::vector<double>& b1,
+                      std::vector<double>& b2) const;
+  protected:
+    // d[i] = D[i][i], la[i] = L[i+a][i]
+    std::vector<double> d, l1, l2;
+};
 
 class BaseSpline {
   public:
@@ -34,6 +55,9 @@ class BaseSpline {
     static double stepEpsilon;
     static double weightSlope;
     static double scaleAlpha;
+    // number of alphas evaluated concurrently in each step of the alpha
+    // search, the sequential golden section search is used if below 2
+    static unsigned int alphaBatchSize;
     void roughnessPenaltyIRLS();
     void roughnessPenaltyIRLS_Old();
     void iterativeReweightedLeastSquares(double alpha);
@@ -42,20 +66,24 @@ class BaseSpline {
     double predict(double xx) {
       return splineEval(xx);
     }
-    static void solveInPlace(PackedMatrix& mat, PackedVector& res);
   protected:
+    virtual BaseSpline* clone() const {
+      return new BaseSpline(*this);
+    }
     virtual void calcPZW() {;}
     virtual void initg() {
       int n = x.size();
-      g = PackedVector(n);
-      gnew = PackedVector(n);
-      w = PackedVector(n);
-      z = PackedVector(n,0.5);
-      gamma = PackedVector(n-2);
+      g.assign(n, 0.0);
+      gnew.assign(n, 0.0);
+      w.assign(n, 0.0);
+      z.assign(n, 0.5);
+      gamma.assign(n - 2, 0.0);
     }
     virtual void limitg() {;}
     virtual void limitgamma() {;}
     void initiateQR();
+    void penalizedBands(double alpha, std::vector<double>& k0,
+                        std::vector<double>& k1, std::vector<double>& k2);
     double crossValidation(double alpha);
     double evaluateSlope(double alpha);
     pair<double, double> alphaLinearSearch(double min_p, double max_p,
@@ -64,12 +92,15 @@ class BaseSpline {
     double alphaLinearSearchBA(double min_p, double max_p,
                                double p1, double p2,
                                double cv1, double cv2);
-    void testPerformance();
+    double alphaBatchSearch(double min_p, double max_p);
     Transform transf;
 
-    PackedMatrix Q, Qt, R;
-    PackedVector gnew, w, z, dx;
-    PackedVector g, gamma;
+    // Q (n x n-2) and R (n-2 x n-2) of the Reinsch form, stored as bands:
+    // column j of Q holds qa[j], qb[j] and qc[j] in rows j, j+1 and j+2,
+    // R has the diagonal r0 and the off diagonal r1[j] = R[j][j+1]
+    std::vector<double> qa, qb, qc, r0, r1;
+    std::vector<double> gnew, w, z, dx;
+    std::vector<double> g, gamma;
     vector<double> x;
 };
 
@@ -0,0 +1,460 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+
+#include "BinaryPin.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#include "DataSet.h"
+#include "MyException.h"
+
+namespace {
+
+const char kMagic[8] = { 'P', 'E', 'R', 'C', 'P', 'I', 'N', 'B' };
+const uint32_t kByteOrderMark = 0x01020304u;
+const uint64_t kSectionAlignment = 8u;
+const uint64_t kFeatureAlignment = 64u;
+
+inline uint64_t alignOffset(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1u) / alignment * alignment;
+}
+
+inline void padTo(std::ofstream& out, uint64_t& pos, uint64_t offset) {
+  static const char zeros[64] = { 0 };
+  out.write(zeros, offset - pos);
+  pos = offset;
+}
+
+template <typename T>
+inline void writeValue(std::ofstream& out, uint64_t& pos, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  pos += sizeof(T);
+}
+
+inline void writeString(std::ofstream& out, uint64_t& pos, const std::string& s) {
+  out.write(s.c_str(), s.size() + 1u);
+  pos += s.size() + 1u;
+}
+
+inline std::string joinProteins(const PSMDescription* psm) {
+  std::string proteins;
+  for (size_t ix = 0; ix < psm->getNumProteins(); ++ix) {
+    if (ix > 0) proteins += '\t';
+    proteins += psm->getProteinId(ix);
+  }
+  return proteins;
+}
+
+} // namespace
+
+BinaryPin::BinaryPin() : data_(NULL), dataSize_(0u), isMapped_(false),
+    header_(NULL), labels_(NULL), scans_(NULL), expMass_(NULL),
+    calcMass_(NULL), retentionTime_(NULL), massDiff_(NULL), features_(NULL),
+    stringOffsets_(NULL), strings_(NULL) {}
+
+BinaryPin::~BinaryPin() {
+  close();
+}
+
+bool BinaryPin::isBinaryPin(const std::string& fileName) {
+  std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!in.read(magic, sizeof(kMagic))) return false;
+  return memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+/**
+ * Writes the PSMs of the given DataSets to a binary pin file. Feature rows are
+ * written with the given row stride, any slots after the features read from
+ * the input (e.g. DOC features) are written as zeroes.
+ */
+void BinaryPin::write(const std::string& fileName,
+    const std::vector<DataSet*>& subsets, size_t rowStride,
+    const std::vector<std::string>& featureNames,
+    const std::vector<double>& initValues, bool calcDoc,
+    bool concatenatedSearch) {
+  size_t numInputFeatures = FeatureNames::getNumFeatures();
+  if (calcDoc) numInputFeatures -= DescriptionOfCorrect::numDOCFeatures();
+
+  Header header;
+  memset(&header, 0, sizeof(Header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byteOrderMark = kByteOrderMark;
+  header.flags = (calcDoc ? CALC_DOC : 0u) |
+                 (concatenatedSearch ? CONCATENATED_SEARCH : 0u);
+  header.numFeatureNames = static_cast<uint32_t>(featureNames.size());
+  header.rowStride = static_cast<uint32_t>(rowStride);
+  header.numInitValues = static_cast<uint32_t>(initValues.size());
+
+  uint64_t numPSMs = 0u, stringsSize = 0u, featureNamesSize = 0u;
+  std::vector<DataSet*>::const_iterator setIt = subsets.begin();
+  for ( ; setIt != subsets.end(); ++setIt) {
+    const std::vector<PSMDescription*>& psms = (*setIt)->getPsms();
+    std::vector<PSMDescription*>::const_iterator it = psms.begin();
+    for ( ; it != psms.end(); ++it) {
+      stringsSize += (*it)->id_.size() + (*it)->peptide.size() +
+                     joinProteins(*it).size() + 3u;
+    }
+    numPSMs += psms.size();
+  }
+  header.numPSMs = numPSMs;
+  std::vector<std::string>::const_iterator nameIt = featureNames.begin();
+  for ( ; nameIt != featureNames.end(); ++nameIt) {
+    featureNamesSize += nameIt->size() + 1u;
+  }
+
+  uint64_t offset = sizeof(Header);
+  header.featureNamesOffset = offset;
+  offset = alignOffset(offset + featureNamesSize, kSectionAlignment);
+  header.initValuesOffset = offset;
+  offset += initValues.size() * sizeof(double);
+  header.labelsOffset = offset;
+  offset = alignOffset(offset + numPSMs * sizeof(int32_t), kSectionAlignment);
+  header.scansOffset = offset;
+  offset = alignOffset(offset + numPSMs * sizeof(uint32_t), kSectionAlignment);
+  header.expMassOffset = offset;
+  offset += numPSMs * sizeof(double);
+  header.calcMassOffset = offset;
+  offset += numPSMs * sizeof(double);
+  if (calcDoc) {
+    header.retentionTimeOffset = offset;
+    offset += numPSMs * sizeof(double);
+    header.massDiffOffset = offset;
+    offset += numPSMs * sizeof(double);
+  }
+  header.featuresOffset = alignOffset(offset, kFeatureAlignment);
+  offset = header.featuresOffset + numPSMs * rowStride * sizeof(double);
+  header.stringOffsetsOffset = offset;
+  offset += (3u * numPSMs + 1u) * sizeof(uint64_t);
+  header.stringsOffset = offset;
+  header.fileSize = offset + stringsSize;
+
+  std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+  if (!out) {
+    ostringstream temp;
+    temp << "ERROR: Could not open " << fileName << " for writing." << std::endl;
+    throw MyException(temp.str());
+  }
+
+  uint64_t pos = 0u;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  pos += sizeof(Header);
+  for (nameIt = featureNames.begin(); nameIt != featureNames.end(); ++nameIt) {
+    writeString(out, pos, *nameIt);
+  }
+  padTo(out, pos, header.initValuesOffset);
+  for (size_t i = 0; i < initValues.size(); ++i) {
+    writeValue(out, pos, initValues[i]);
+  }
+
+  // the per-PSM columns are written one at a time to avoid having to buffer
+  // the full file in memory
+  for (int column = 0; column < 6; ++column) {
+    if (column >= 4 && !calcDoc) break;
+    if (column == 1) padTo(out, pos, header.scansOffset);
+    if (column == 2) padTo(out, pos, header.expMassOffset);
+    for (setIt = subsets.begin(); setIt != subsets.end(); ++setIt) {
+      const std::vector<PSMDescription*>& psms = (*setIt)->getPsms();
+      int32_t label = (*setIt)->getLabel();
+      std::vector<PSMDescription*>::const_iterator it = psms.begin();
+      for ( ; it != psms.end(); ++it) {
+        switch (column) {
+          case 0: writeValue(out, pos, label); break;
+          case 1: writeValue(out, pos, static_cast<uint32_t>((*it)->scan)); break;
+          case 2: writeValue(out, pos, (*it)->expMass); break;
+          case 3: writeValue(out, pos, (*it)->calcMass); break;
+          case 4: writeValue(out, pos, (*it)->getRetentionTime()); break;
+          case 5: writeValue(out, pos, (*it)->getMassDiff()); break;
+        }
+      }
+    }
+  }
+
+  padTo(out, pos, header.featuresOffset);
+  std::vector<double> row(rowStride, 0.0);
+  for (setIt = subsets.begin(); setIt != subsets.end(); ++setIt) {
+    const std::vector<PSMDescription*>& psms = (*setIt)->getPsms();
+    std::vector<PSMDescription*>::const_iterator it = psms.begin();
+    for ( ; it != psms.end(); ++it) {
+      std::copy((*it)->features, (*it)->features + numInputFeatures, row.begin());
+      out.write(reinterpret_cast<const char*>(&row[0]), rowStride * sizeof(double));
+      pos += rowStride * sizeof(double);
+    }
+  }
+
+  uint64_t stringOffset = 0u;
+  writeValue(out, pos, stringOffset);
+  for (setIt = subsets.begin(); setIt != subsets.end(); ++setIt) {
+    const std::vector<PSMDescription*>& psms = (*setIt)->getPsms();
+    std::vector<PSMDescription*>::const_iterator it = psms.begin();
+    for ( ; it != psms.end(); ++it) {
+      stringOffset += (*it)->id_.size() + 1u;
+      writeValue(out, pos, stringOffset);
+      stringOffset += (*it)->peptide.size() + 1u;
+      writeValue(out, pos, stringOffset);
+      stringOffset += joinProteins(*it).size() + 1u;
+      writeValue(out, pos, stringOffset);
+    }
+  }
+  for (setIt = subsets.begin(); setIt != subsets.end(); ++setIt) {
+    const std::vector<PSMDescription*>& psms = (*setIt)->getPsms();
+    std::vector<PSMDescription*>::const_iterator it = psms.begin();
+    for ( ; it != psms.end(); ++it) {
+      writeString(out, pos, (*it)->id_);
+      writeString(out, pos, (*it)->peptide);
+      writeString(out, pos, joinProteins(*it));
+    }
+  }
+
+  if (!out || pos != header.fileSize) {
+    ostringstream temp;
+    temp << "ERROR: Failed to write binary pin file " << fileName << "." << std::endl;
+    throw MyException(temp.str());
+  }
+}
+
+/**
+ * Maps the binary pin file into memory. The mapping is private and writable,
+ * so that the feature rows can be normalized in place without modifying the
+ * file on disk.
+ */
+void BinaryPin::open(const std::string& fileName) {
+  close();
+  fileName_ = fileName;
+#ifdef _WIN32
+  std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+  if (in) {
+    in.seekg(0, std::ios::end);
+    dataSize_ = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    // allocate as doubles to guarantee the alignment of the feature matrix
+    data_ = reinterpret_cast<char*>(
+        new double[dataSize_ / sizeof(double) + 1u]);
+    in.read(data_, dataSize_);
+  }
+  if (!in) {
+    close();
+    ostringstream temp;
+    temp << "ERROR: Could not read binary pin file " << fileName << "." << std::endl;
+    throw MyException(temp.str());
+  }
+#else
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  struct stat fileStat;
+  if (fd < 0 || fstat(fd, &fileStat) != 0) {
+    if (fd >= 0) ::close(fd);
+    ostringstream temp;
+    temp << "ERROR: Could not open binary pin file " << fileName << "." << std::endl;
+    throw MyException(temp.str());
+  }
+  dataSize_ = static_cast<size_t>(fileStat.st_size);
+  void* addr = MAP_FAILED;
+  if (dataSize_ > 0u) {
+    addr = mmap(NULL, dataSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    ostringstream temp;
+    temp << "ERROR: Could not map binary pin file " << fileName
+         << " into memory." << std::endl;
+    throw MyException(temp.str());
+  }
+  data_ = static_cast<char*>(addr);
+  isMapped_ = true;
+#endif
+
+  if (dataSize_ < sizeof(Header)) {
+    close();
+    ostringstream temp;
+    temp << "ERROR: Binary pin file " << fileName << " is truncated." << std::endl;
+    throw MyException(temp.str());
+  }
+  header_ = reinterpret_cast<const Header*>(data_);
+  if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+    close();
+    ostringstream temp;
+    temp << "ERROR: " << fileName << " is not a binary pin file." << std::endl;
+    throw MyException(temp.str());
+  }
+  if (header_->byteOrderMark != kByteOrderMark) {
+    close();
+    ostringstream temp;
+    temp << "ERROR: Binary pin file " << fileName << " was written on a "
+         << "machine with a different byte order." << std::endl;
+    throw MyException(temp.str());
+  }
+  if (header_->version != kVersion) {
+    uint32_t version = header_->version;
+    close();
+    ostringstream temp;
+    temp << "ERROR: Binary pin file " << fileName << " has version " << version
+         << ", this version of percolator reads version " << kVersion
+         << "." << std::endl;
+    throw MyException(temp.str());
+  }
+
+  uint64_t numPSMs = header_->numPSMs;
+  checkSection(header_->fileSize, 0u, 1u, "file size");
+  if (header_->featureNamesOffset > header_->initValuesOffset) {
+    throwCorrupt("the feature names section is out of order");
+  }
+  checkSection(header_->featureNamesOffset, 
+               header_->initValuesOffset - header_->featureNamesOffset, 1u,
+               "feature names");
+  checkSection(header_->initValuesOffset, header_->numInitValues,
+               sizeof(double), "default direction");
+  checkSection(header_->labelsOffset, numPSMs, sizeof(int32_t), "labels");
+  checkSection(header_->scansOffset, numPSMs, sizeof(uint32_t), "scan numbers");
+  checkSection(header_->expMassOffset, numPSMs, sizeof(double), "expMass");
+  checkSection(header_->calcMassOffset, numPSMs, sizeof(double), "calcMass");
+  if (getCalcDoc()) {
+    checkSection(header_->retentionTimeOffset, numPSMs, sizeof(double),
+                 "retention times");
+    checkSection(header_->massDiffOffset, numPSMs, sizeof(double),
+                 "mass differences");
+  }
+  checkSection(header_->featuresOffset, numPSMs, 
+               header_->rowStride * sizeof(double), "features");
+  checkSection(header_->stringOffsetsOffset, 3u * numPSMs + 1u, 
+               sizeof(uint64_t), "string offsets");
+  checkSection(header_->stringsOffset, 0u, 1u, "strings");
+
+  labels_ = reinterpret_cast<const int32_t*>(data_ + header_->labelsOffset);
+  scans_ = reinterpret_cast<const uint32_t*>(data_ + header_->scansOffset);
+  expMass_ = reinterpret_cast<const double*>(data_ + header_->expMassOffset);
+  calcMass_ = reinterpret_cast<const double*>(data_ + header_->calcMassOffset);
+  if (getCalcDoc()) {
+    retentionTime_ = reinterpret_cast<const double*>(
+        data_ + header_->retentionTimeOffset);
+    massDiff_ = reinterpret_cast<const double*>(data_ + header_->massDiffOffset);
+  }
+  features_ = reinterpret_cast<double*>(data_ + header_->featuresOffset);
+  stringOffsets_ = reinterpret_cast<const uint64_t*>(
+      data_ + header_->stringOffsetsOffset);
+  strings_ = data_ + header_->stringsOffset;
+  
+  // every string holds at least its terminating '\0', so the offsets have to
+  // increase strictly and end within the strings section
+  if (stringOffsets_[0] != 0u) {
+    throwCorrupt("the string offsets do not start at zero");
+  }
+  for (uint64_t ix = 1u; ix <= 3u * numPSMs; ++ix) {
+    if (stringOffsets_[ix] <= stringOffsets_[ix - 1u]) {
+      throwCorrupt("the string offsets are not increasing");
+    }
+  }
+  checkSection(header_->stringsOffset, stringOffsets_[3u * numPSMs], 1u, 
+               "strings");
+}
+
+void BinaryPin::close() {
+  if (data_ != NULL) {
+#ifdef _WIN32
+    delete[] reinterpret_cast<double*>(data_);
+#else
+    if (isMapped_) munmap(data_, dataSize_);
+#endif
+  }
+  data_ = NULL;
+  dataSize_ = 0u;
+  isMapped_ = false;
+  header_ = NULL;
+  features_ = NULL;
+}
+
+/**
+ * Throws unless count elements of elementSize bytes starting at offset lie
+ * within the file. Formulated with a division, as count and offset are read
+ * from the file and their products could overflow.
+ */
+void BinaryPin::checkSection(uint64_t offset, uint64_t count, 
+                             uint64_t elementSize, const char* name) const {
+  if (offset > dataSize_ || 
+      (count > 0u && elementSize > 0u && 
+       count > (dataSize_ - offset) / elementSize)) {
+    ostringstream temp;
+    temp << "the " << name << " section exceeds the file size";
+    throwCorrupt(temp.str());
+  }
+}
+
+void BinaryPin::throwCorrupt(const std::string& reason) const {
+  ostringstream temp;
+  temp << "ERROR: Binary pin file " << fileName_ << " is corrupt, " << reason
+       << "." << std::endl;
+  throw MyException(temp.str());
+}
+
+void BinaryPin::getFeatureNames(std::vector<std::string>& featureNames) const {
+  const char* name = data_ + header_->featureNamesOffset;
+  const char* end = data_ + header_->initValuesOffset;
+  for (uint32_t i = 0; i < header_->numFeatureNames; ++i) {
+    const char* nameEnd = static_cast<const char*>(memchr(name, '\0', end - name));
+    if (nameEnd == NULL) {
+      throwCorrupt("could not read the feature names");
+    }
+    featureNames.push_back(std::string(name, nameEnd - name));
+    name = nameEnd + 1;
+  }
+}
+
+void BinaryPin::getInitValues(std::vector<double>& initValues) const {
+  const double* values = reinterpret_cast<const double*>(
+      data_ + header_->initValuesOffset);
+  initValues.assign(values, values + header_->numInitValues);
+}
+
+int BinaryPin::readPsm(size_t row, bool readProteins,
+                       PSMDescription*& myPsm) const {
+  if (getCalcDoc()) {
+    myPsm = new PSMDescriptionDOC();
+    myPsm->setRetentionTime(retentionTime_[row]);
+    myPsm->setMassDiff(massDiff_[row]);
+  } else {
+    myPsm = new PSMDescription();
+  }
+  const uint64_t* offsets = stringOffsets_ + 3u * row;
+  myPsm->setId(std::string(strings_ + offsets[0], offsets[1] - offsets[0] - 1u));
+  myPsm->peptide.assign(strings_ + offsets[1], offsets[2] - offsets[1] - 1u);
+  myPsm->scan = scans_[row];
+  myPsm->expMass = expMass_[row];
+  myPsm->calcMass = calcMass_[row];
+  myPsm->features = getFeatureRow(row);
+
+  if (readProteins) {
+    const char* protein = strings_ + offsets[2];
+    const char* end = strings_ + offsets[3] - 1u;
+    while (protein < end) {
+      const char* proteinEnd = static_cast<const char*>(
+          memchr(protein, '\t', end - protein));
+      if (proteinEnd == NULL) proteinEnd = end;
+      myPsm->addProteinId(std::string(protein, proteinEnd - protein));
+      protein = proteinEnd + 1;
+    }
+  }
+  return labels_[row];
+}
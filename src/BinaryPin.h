@@ -0,0 +1,126 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+#ifndef BINARYPIN_H_
+#define BINARYPIN_H_
+
+#ifndef WIN32
+  #include <stdint.h>
+#endif
+
+#include <string>
+#include <vector>
+
+class DataSet;
+class PSMDescription;
+
+/*
+* BinaryPin reads and writes the binary pin format (pin-bin), a column
+* oriented companion to the tab delimited pin format. The feature matrix is
+* stored row-major with the same row stride as FeatureMemoryPool, so a memory
+* mapped file can be handed to the pool and to PSMDescription::features
+* without any parsing.
+*
+* File layout (native byte order, checked by a byte order mark):
+*   header | feature names | default direction | labels | scan numbers |
+*   expMass | calcMass | [retention times | mass differences] |
+*   feature matrix (64 byte aligned) | string offsets | strings
+* Each PSM contributes three '\0' terminated strings: the PSM id, the peptide
+* and its tab separated protein ids.
+*
+*/
+class BinaryPin {
+ public:
+  static const uint32_t kVersion = 1u;
+
+  enum Flags {
+    CALC_DOC = 1u, CONCATENATED_SEARCH = 2u
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t flags;
+    uint32_t numFeatureNames;
+    uint32_t rowStride;
+    uint32_t numInitValues;
+    uint64_t numPSMs;
+    uint64_t featureNamesOffset, initValuesOffset;
+    uint64_t labelsOffset, scansOffset, expMassOffset, calcMassOffset;
+    uint64_t retentionTimeOffset, massDiffOffset;
+    uint64_t featuresOffset, stringOffsetsOffset, stringsOffset;
+    uint64_t fileSize;
+  };
+
+  BinaryPin();
+  ~BinaryPin();
+
+  static bool isBinaryPin(const std::string& fileName);
+  static void write(const std::string& fileName,
+    const std::vector<DataSet*>& subsets, size_t rowStride,
+    const std::vector<std::string>& featureNames,
+    const std::vector<double>& initValues, bool calcDoc,
+    bool concatenatedSearch);
+
+  void open(const std::string& fileName);
+  void close();
+
+  inline uint64_t getNumPSMs() const { return header_->numPSMs; }
+  inline size_t getRowStride() const { return header_->rowStride; }
+  inline bool getCalcDoc() const { return (header_->flags & CALC_DOC) != 0; }
+  inline bool concatenatedSearch() const {
+    return (header_->flags & CONCATENATED_SEARCH) != 0;
+  }
+
+  void getFeatureNames(std::vector<std::string>& featureNames) const;
+  void getInitValues(std::vector<double>& initValues) const;
+
+  inline int getLabel(size_t row) const { return labels_[row]; }
+  inline unsigned int getScan(size_t row) const { return scans_[row]; }
+  inline double getExpMass(size_t row) const { return expMass_[row]; }
+  inline double* getFeatures() const { return features_; }
+  inline double* getFeatureRow(size_t row) const {
+    return features_ + row * header_->rowStride;
+  }
+
+  // creates a PSMDescription whose feature row points into the mapped file
+  int readPsm(size_t row, bool readProteins, PSMDescription*& myPsm) const;
+
+ private:
+  std::string fileName_;
+  char* data_;
+  size_t dataSize_;
+  bool isMapped_;
+
+  const Header* header_;
+  const int32_t* labels_;
+  const uint32_t* scans_;
+  const double *expMass_, *calcMass_, *retentionTime_, *massDiff_;
+  double* features_;
+  const uint64_t* stringOffsets_;
+  const char* strings_;
+
+  void checkSection(uint64_t offset, uint64_t count, uint64_t elementSize,
+                    const char* name) const;
+  void throwCorrupt(const std::string& reason) const;
+
+  // prevent copying of the mapping
+  BinaryPin(const BinaryPin&);
+  BinaryPin& operator=(const BinaryPin&);
+};
+
+#endif /* BINARYPIN_H_ */
@@ -30,16 +30,17 @@ using namespace std;
 Caller::Caller() :
     pNorm_(NULL), pCheck_(NULL), protEstimator_(NULL), tabInput_(true), 
     readStdIn_(false), inputFN_(""), xmlSchemaValidation_(true), 
-    tabOutputFN_(""), xmlOutputFN_(""), weightOutputFN_(""),
+    tabOutputFN_(""), binOutputFN_(""), xmlOutputFN_(""), weightOutputFN_(""),
     psmResultFN_(""), peptideResultFN_(""), proteinResultFN_(""), 
     decoyPsmResultFN_(""), decoyPeptideResultFN_(""), decoyProteinResultFN_(""),
     xmlPrintDecoys_(false), xmlPrintExpMass_(true), reportUniquePeptides_(true), 
     targetDecoyCompetition_(false), useMixMax_(false), inputSearchType_("auto"),
     selectionFdr_(0.01), initialSelectionFdr_(0.01), testFdr_(0.01), 
     numIterations_(10), maxPSMs_(0u),
-    nestedXvalBins_(1u), selectedCpos_(0.0), selectedCneg_(0.0),
+    nestedXvalBins_(1u), numFolds_(3u), selectedCpos_(0.0), selectedCneg_(0.0),
     reportEachIteration_(false), quickValidation_(false), 
-    trainBestPositive_(false) {
+    trainBestPositive_(false), svmWarmStart_(false), streamScoring_(false),
+    streamTempDir_(""), modelOutputFN_(""), modelInputFN_("") {
 }
 
 Caller::~Caller() {
@@ -338,6 +339,41 @@ bool Caller::parseOptions(int argc, char **argv) {
       "nested-xval-bins",
       "Number of nested cross validation bins within each cross validation bin. This should reduce overfitting of the hyperparameters. Default = 1.",
       "value");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "num-folds",
+      "Number of cross validation bins. Default = 3.",
+      "value");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "pi0-parallel-bootstrap",
+      "Draw the bootstrap resamples of the pi0 estimates concurrently, from a counter based random number generator. The estimates do not depend on the number of threads, but can differ slightly from those of the default sequential bootstrap.",
+      "",
+      TRUE_IF_SET);
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "pep-alpha-batch",
+      "Number of candidate roughness penalties evaluated concurrently in each step of the spline fit of the posterior error probabilities. Values of 2 or more make the fit use multiple threads, the selected penalty and hence the PEPs can differ slightly from those of the default sequential search. Default = 0 (sequential search).",
+      "value");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "svm-warm-start",
+      "Start each SVM training from the weights of the bin's previous iteration instead of from zero. Usually needs fewer solver iterations, but the weights can differ slightly from those of a cold start.",
+      "",
+      TRUE_IF_SET);
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "save-model",
+      "Save the trained SVMs, together with the feature normalization, the selected soft margin parameters and the feature names, to the given file, for use with --apply-model.",
+      "filename");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "apply-model",
+      "Skip the training and score all PSMs with the SVMs of a file written by --save-model, averaged over the cross validation bins. The input has to contain the same features as the training input. Uses the post-processing method of the training run unless -y, -Y or -I is given.",
+      "filename");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "stream-scoring",
+      "Score the full list of PSMs after training on a subset (-N flag) or with --apply-model without keeping the PSMs in memory. Scores are sorted on disk, together with the PSM ids, peptides and proteins for the output. Only available for PSM level results (-U flag) from a pin file without XML output, protein inference, DOC features or target-decoy competition.",
+      "",
+      TRUE_IF_SET);
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "stream-temp-dir",
+      "Directory for the temporary files of --stream-scoring. Default = $TMPDIR or /tmp.",
+      "directory");
   cmd.defineOption(Option::NO_SHORT_OPT,
       "spectral-counting-fdr",
       "Activates spectral counting on protein level (either --fido-protein or --picked-protein has to be set) at the specified PSM q-value threshold. Adds two columns, \"spec_count_unique\" and \"spec_count_all\", to the protein tab separated output, containing the spectral count for the peptides unique to the protein and the spectral count including shared peptides respectively.",
@@ -351,6 +387,10 @@ bool Caller::parseOptions(int argc, char **argv) {
       "train-fdr-initial",
       "Set the FDR threshold for the first iteration. This is useful in cases where the original features do not display a good separation between targets and decoys. In subsequent iterations, the normal --trainFDR will be used.",
       "value");
+  cmd.defineOption(Option::NO_SHORT_OPT,
+      "bin-out",
+      "Output the input PSMs to given file in binary pin format (pin-bin). Binary pin files are detected automatically when given as input file and are read without any parsing, which considerably speeds up reading large inputs. Cannot be combined with -N.",
+      "filename");
   
   /*
   cmd.defineOption(Option::NO_SHORT_OPT,
@@ -541,6 +581,9 @@ bool Caller::parseOptions(int argc, char **argv) {
   if (cmd.optionSet("tab-out")) {
     tabOutputFN_ = cmd.options["tab-out"];
   }
+  if (cmd.optionSet("bin-out")) {
+    binOutputFN_ = cmd.options["bin-out"];
+  }
   
   if (cmd.optionSet("weights")) {
     weightOutputFN_ = cmd.options["weights"];
@@ -566,6 +609,21 @@ bool Caller::parseOptions(int argc, char **argv) {
   if (cmd.optionSet("train-best-positive")) {
     trainBestPositive_ = true;
   }
+  if (cmd.optionSet("svm-warm-start")) {
+    svmWarmStart_ = true;
+  }
+  if (cmd.optionSet("stream-scoring")) {
+    streamScoring_ = true;
+  }
+  if (cmd.optionSet("stream-temp-dir")) {
+    streamTempDir_ = cmd.options["stream-temp-dir"];
+  }
+  if (cmd.optionSet("save-model")) {
+    modelOutputFN_ = cmd.options["save-model"];
+  }
+  if (cmd.optionSet("apply-model")) {
+    modelInputFN_ = cmd.options["apply-model"];
+  }
   if (cmd.optionSet("trainFDR")) {
     selectionFdr_ = cmd.getDouble("trainFDR", 0.0, 1.0);
     initialSelectionFdr_ = selectionFdr_;
@@ -634,6 +692,60 @@ bool Caller::parseOptions(int argc, char **argv) {
   if (cmd.optionSet("nested-xval-bins")) {
     nestedXvalBins_ = cmd.getInt("nested-xval-bins", 1, 1000);
   }
+  if (cmd.optionSet("num-folds")) {
+    numFolds_ = cmd.getInt("num-folds", 2, 1000);
+  }
+  if (cmd.optionSet("pi0-parallel-bootstrap")) {
+    PosteriorEstimator::setParallelBootstrap(true);
+  }
+  if (cmd.optionSet("pep-alpha-batch")) {
+    BaseSpline::alphaBatchSize = cmd.getInt("pep-alpha-batch", 0, 1000);
+  }
+  if (binOutputFN_.size() > 0 && maxPSMs_ > 0u) {
+    cerr << "Error: the binary pin output (--bin-out) needs all PSMs in memory "
+         << "and cannot be combined with subset-max-train (-N).";
+    cerr << "\nInvoke with -h option for help\n";
+    return 0; // ...error
+  }
+  if (modelInputFN_.size() > 0) {
+    if (cmd.optionSet("xml-in") || cmd.optionSet("stdinput-xml") || 
+        DataSet::getCalcDoc()) {
+      cerr << "Error: --apply-model needs tab delimited or binary pin input "
+           << "and does not support DOC features (-D).";
+      cerr << "\nInvoke with -h option for help\n";
+      return 0; // ...error
+    }
+    if (modelOutputFN_.size() > 0 || weightOutputFN_.size() > 0 || 
+        tabOutputFN_.size() > 0 || binOutputFN_.size() > 0) {
+      cerr << "Error: --apply-model skips the training and cannot be combined "
+           << "with --save-model, --weights, --tab-out or --bin-out.";
+      cerr << "\nInvoke with -h option for help\n";
+      return 0; // ...error
+    }
+  }
+  if (modelOutputFN_.size() > 0 && DataSet::getCalcDoc()) {
+    cerr << "Error: --save-model does not support DOC features (-D).";
+    cerr << "\nInvoke with -h option for help\n";
+    return 0; // ...error
+  }
+  if (streamScoring_) {
+    if ((maxPSMs_ == 0u && modelInputFN_.empty()) || reportUniquePeptides_) {
+      cerr << "Error: --stream-scoring requires subset-max-train (-N) or "
+           << "--apply-model and PSM level results only (-U).";
+      cerr << "\nInvoke with -h option for help\n";
+      return 0; // ...error
+    }
+    if (cmd.optionSet("xml-in") || cmd.optionSet("stdinput-xml") || 
+        cmd.optionSet("stdinput-tab") || xmlOutputFN_.size() > 0 || 
+        ProteinProbEstimator::getCalcProteinLevelProb() || 
+        DataSet::getCalcDoc() || targetDecoyCompetition_) {
+      cerr << "Error: --stream-scoring needs a pin file as input and cannot "
+           << "be combined with XML output (-X), protein inference, DOC "
+           << "features (-D) or target-decoy competition (-Y).";
+      cerr << "\nInvoke with -h option for help\n";
+      return 0; // ...error
+    }
+  }
   // if there are no arguments left...
   if (cmd.arguments.size() == 0) {
     if(!cmd.optionSet("tab-in") && !cmd.optionSet("xml-in") && !cmd.optionSet("stdinput-xml") && !cmd.optionSet("stdinput-tab")){ // unless the input comes from -j, -k or -e option
@@ -758,6 +870,61 @@ void Caller::calculatePSMProb(Scores& allScores, bool isUniquePeptideRun,
   }
 }
 
+/** Calculates the PSM probabilities of the full list of PSMs scored by
+ * StreamingScores, the counterpart of calculatePSMProb for --stream-scoring
+ * @param procStart clock time when process started
+ * @param procStartClock clock associated with procStart
+ * @param diff runtime of the calculations
+ */
+void Caller::calculateStreamedPSMProb(StreamingScores& streamScores, 
+    time_t& procStart, clock_t& procStartClock, double& diff) {
+  if (VERB > 0) {
+    if (useMixMax_) {
+      std::cerr << "Selecting pi_0=" << streamScores.getPi0() << std::endl;
+    }
+    std::cerr << "Calculating q values." << std::endl;
+  }
+  
+  int foundPSMs = streamScores.calcQ(testFdr_);
+  
+  if (VERB > 0) {
+    if (useMixMax_) {
+      std::cerr << "New pi_0 estimate on final list yields ";
+    } else {
+      std::cerr << "Final list yields ";
+    }
+    std::cerr << foundPSMs << " target PSMs with q<" << testFdr_ << "." << endl;
+    std::cerr << "Calculating posterior error probabilities (PEPs)." << std::endl;
+  }
+  
+  streamScores.calcPep();
+  
+  if (VERB > 1) {
+    time_t end;
+    time(&end);
+    diff = difftime(end, procStart);
+    ostringstream timerValues;
+    timerValues.precision(4);
+    timerValues << "Processing took " << ((double)(clock() - procStartClock)) / (double)CLOCKS_PER_SEC
+                << " cpu seconds or " << diff << " seconds wall clock time." << endl;
+    std::cerr << timerValues.str();
+  }
+  
+  // targets and decoys are written in the same pass over the scores
+  ofstream targetStream, decoyStream;
+  std::ostream* targetOs = &std::cout;
+  std::ostream* decoyOs = NULL;
+  if (!psmResultFN_.empty()) {
+    targetStream.open(psmResultFN_.c_str(), ios::out);
+    targetOs = &targetStream;
+  }
+  if (!decoyPsmResultFN_.empty()) {
+    decoyStream.open(decoyPsmResultFN_.c_str(), ios::out);
+    decoyOs = &decoyStream;
+  }
+  streamScores.print(*targetOs, decoyOs);
+}
+
 /** 
  * Calculates the protein probabilites by calling Fido and directly writes 
  * the results to XML
@@ -834,6 +1001,7 @@ int Caller::run() {
   }
   
   int success = 0;
+  bool binInput = (tabInput_ && !readStdIn_ && BinaryPin::isBinaryPin(inputFN_));
   std::ifstream fileStream;
   if (!readStdIn_) {
     if (!tabInput_) fileStream.exceptions(ifstream::badbit | ifstream::failbit);
@@ -849,11 +1017,20 @@ int Caller::run() {
   XMLInterface xmlInterface(xmlOutputFN_, xmlSchemaValidation_, 
                             xmlPrintDecoys_, xmlPrintExpMass_);
   SetHandler setHandler(maxPSMs_);
+  if (modelInputFN_.size() > 0) {
+    return applyModel(dataStream, binInput, setHandler, xmlInterface);
+  }
+  
   if (!tabInput_) {
     if (VERB > 1) {
       std::cerr << "Reading pin-xml input from datafile " << inputFN_ << std::endl;
     }
     success = xmlInterface.readPin(dataStream, inputFN_, setHandler, pCheck_, protEstimator_);
+  } else if (binInput) {
+    if (VERB > 1) {
+      std::cerr << "Reading binary pin input from datafile " << inputFN_ << std::endl;
+    }
+    success = setHandler.readBin(inputFN_, pCheck_);
   } else {
     if (VERB > 1) {
       std::cerr << "Reading tab-delimited input from datafile " << inputFN_ << std::endl;
@@ -872,6 +1049,11 @@ int Caller::run() {
     std::cerr << "FeatureNames::getNumFeatures(): "<< FeatureNames::getNumFeatures() << endl;
   }
   
+  // the binary pin file contains the unnormalized features
+  if (binOutputFN_.length() > 0) {
+    setHandler.writeBin(binOutputFN_, pCheck_);
+  }
+  
   setHandler.normalizeFeatures(pNorm_);
   
   /*
@@ -944,7 +1126,8 @@ int Caller::run() {
   CrossValidation crossValidation(quickValidation_, reportEachIteration_, 
                                   testFdr_, selectionFdr_, initialSelectionFdr_, selectedCpos_, 
                                   selectedCneg_, numIterations_, useMixMax_,
-                                  nestedXvalBins_, trainBestPositive_);
+                                  nestedXvalBins_, trainBestPositive_, numFolds_);
+  crossValidation.setWarmStart(svmWarmStart_);
   int firstNumberOfPositives = crossValidation.preIterationSetup(allScores, pCheck_, pNorm_, setHandler.getFeaturePool());
   if (VERB > 0) {
     cerr << "Found " << firstNumberOfPositives << " test set positives with q<"
@@ -953,6 +1136,7 @@ int Caller::run() {
   
   if (DataSet::getCalcDoc()) {
     setHandler.normalizeDOCFeatures(pNorm_);
+    allScores.featuresChanged();
   }
   
   time_t procStart;
@@ -983,6 +1167,17 @@ int Caller::run() {
     crossValidation.printDOC();
   }
   
+  if (modelOutputFN_.size() > 0) {
+    TrainedModel model;
+    model.setFeatureNames(DataSet::getFeatureNames());
+    model.setNormalizer(pNorm_);
+    model.setFolds(crossValidation.getWeights(), crossValidation.getFoldCpos(),
+                   crossValidation.getFoldCneg());
+    model.setPostProcessing(useMixMax_ ? "mix-max" : 
+                            (targetDecoyCompetition_ ? "tdc" : "none"));
+    model.write(modelOutputFN_);
+  }
+  
   if (setHandler.getMaxPSMs() > 0u) {
     if (VERB > 0) {
       cerr << "Scoring full list of PSMs with trained SVMs." << endl;
@@ -994,29 +1189,100 @@ int Caller::run() {
     
     fileStream.clear();
     fileStream.seekg(0, ios::beg);
-    if (!tabInput_) {
-      success = xmlInterface.readAndScorePin(fileStream, rawWeights, allScores, inputFN_, setHandler, pCheck_, protEstimator_);
-    } else {
-      success = setHandler.readAndScoreTab(fileStream, rawWeights, allScores, pCheck_);
+    if (streamScoring_) {
+      success = streamFullList(fileStream, binInput, rawWeights, setHandler, 
+                               procStart, procStartClock, diff);
+      Enzyme::destroy();
+      return success;
     }
-        
-    // Reading input files (pin or temporary file)
-    if (!success) {
-      std::cerr << "ERROR: Failed to read in file, check if the correct " <<
-                   "file-format was used.";
+    if (!scoreFullList(fileStream, binInput, rawWeights, setHandler, 
+                       xmlInterface, allScores)) {
       return 0;
     }
-    
-    if (VERB > 1) {
-      cerr << "Evaluated set contained " << allScores.posSize()
-          << " positives and " << allScores.negSize() << " negatives." << endl;
-    }
-    
-    allScores.postMergeStep();
-    allScores.calcQ(selectionFdr_);
-    allScores.normalizeScores(selectionFdr_);
   }
   
+  processResults(allScores, xmlInterface, procStart, procStartClock, diff);
+  Enzyme::destroy();
+  return 1;
+}
+
+/** 
+ * Reads and scores the full list of PSMs with the given raw weights, e.g. 
+ * after training on a subset, and normalizes the scores
+ * @return 0 on error, 1 on success
+ */
+int Caller::scoreFullList(std::istream& dataStream, bool binInput, 
+    std::vector<double>& rawWeights, SetHandler& setHandler, 
+    XMLInterface& xmlInterface, Scores& allScores) {
+  int success = 0;
+  if (!tabInput_) {
+    success = xmlInterface.readAndScorePin(dataStream, rawWeights, allScores, inputFN_, setHandler, pCheck_, protEstimator_);
+  } else if (binInput) {
+    success = setHandler.readAndScoreBin(inputFN_, rawWeights, allScores);
+  } else {
+    success = setHandler.readAndScoreTab(dataStream, rawWeights, allScores, pCheck_);
+  }
+      
+  // Reading input files (pin or temporary file)
+  if (!success) {
+    std::cerr << "ERROR: Failed to read in file, check if the correct " <<
+                 "file-format was used.";
+    return 0;
+  }
+  
+  if (VERB > 1) {
+    cerr << "Evaluated set contained " << allScores.posSize()
+        << " positives and " << allScores.negSize() << " negatives." << endl;
+  }
+  
+  allScores.postMergeStep();
+  allScores.calcQ(selectionFdr_);
+  allScores.normalizeScores(selectionFdr_);
+  return 1;
+}
+
+/** 
+ * Scores the full list of PSMs with the given raw weights without keeping 
+ * the PSMs in memory and writes the PSM level results
+ * @return 0 on error, 1 on success
+ */
+int Caller::streamFullList(std::istream& dataStream, bool binInput, 
+    std::vector<double>& rawWeights, SetHandler& setHandler, 
+    time_t& procStart, clock_t& procStartClock, double& diff) {
+  int success = 0;
+  StreamingScores streamScores(useMixMax_, streamTempDir_);
+  if (binInput) {
+    success = setHandler.readAndStreamBin(inputFN_, rawWeights, streamScores);
+  } else {
+    Scores noScores(useMixMax_);
+    success = setHandler.readAndScoreTab(dataStream, rawWeights, noScores, 
+                                         pCheck_, &streamScores);
+  }
+  if (!success) {
+    std::cerr << "ERROR: Failed to read in file, check if the correct " <<
+                 "file-format was used.";
+    return 0;
+  }
+  
+  if (VERB > 1) {
+    cerr << "Evaluated set contained " << streamScores.posSize()
+        << " positives and " << streamScores.negSize() << " negatives." << endl;
+  }
+  
+  streamScores.postMergeStep();
+  streamScores.calcQ(selectionFdr_);
+  streamScores.normalizeScores(selectionFdr_);
+  
+  calculateStreamedPSMProb(streamScores, procStart, procStartClock, diff);
+  return 1;
+}
+
+/** 
+ * Calculates the PSM, peptide and protein level results of the scored PSMs 
+ * and writes them
+ */
+void Caller::processResults(Scores& allScores, XMLInterface& xmlInterface, 
+    time_t& procStart, clock_t& procStartClock, double& diff) {
   // calculate psms level probabilities TDA or TDC
   bool isUniquePeptideRun = false;
   calculatePSMProb(allScores, isUniquePeptideRun, procStart, procStartClock, diff);
@@ -1051,6 +1317,59 @@ int Caller::run() {
   }
   // write output to file
   xmlInterface.writeXML(allScores, protEstimator_, call_);
+}
+
+/** 
+ * Scores all PSMs with the SVMs of a model file written by an earlier run 
+ * instead of training them, the features are normalized with the stored 
+ * normalizer
+ * @return 0 on error, 1 on success
+ */
+int Caller::applyModel(std::istream& dataStream, bool binInput, 
+    SetHandler& setHandler, XMLInterface& xmlInterface) {
+  TrainedModel model;
+  model.read(modelInputFN_);
+  if (VERB > 0) {
+    cerr << "Scoring all PSMs with the " << model.getNumFolds() 
+         << " SVMs of model " << modelInputFN_ << "." << endl;
+  }
+  
+  // the post-processing of the training run, unless set explicitly
+  if (!useMixMax_ && !targetDecoyCompetition_ && inputSearchType_ == "auto") {
+    useMixMax_ = (model.getPostProcessing() == "mix-max");
+    targetDecoyCompetition_ = (model.getPostProcessing() == "tdc");
+  }
+  if (streamScoring_ && targetDecoyCompetition_) {
+    cerr << "Error: model " << modelInputFN_ << " was trained with "
+         << "target-decoy competition, which --stream-scoring does not "
+         << "support. Set -I/--search-input or -y/--post-processing-mix-max "
+         << "to override the post-processing of the model." << endl;
+    return 0;
+  }
+
+  pNorm_ = Normalizer::getNormalizer();
+  model.initNormalizer(pNorm_);
+  std::vector<double> rawWeights;
+  model.getAvgWeights(rawWeights, pNorm_);
+  setHandler.setModelFeatureNames(model.getFeatureNames());
+  
+  time_t procStart;
+  clock_t procStartClock = clock();
+  time(&procStart);
+  double diff = 0.0;
+  
+  int success = 0;
+  if (streamScoring_) {
+    success = streamFullList(dataStream, binInput, rawWeights, setHandler, 
+                             procStart, procStartClock, diff);
+  } else {
+    Scores allScores(useMixMax_);
+    success = scoreFullList(dataStream, binInput, rawWeights, setHandler, 
+                            xmlInterface, allScores);
+    if (success) {
+      processResults(allScores, xmlInterface, procStart, procStartClock, diff);
+    }
+  }
   Enzyme::destroy();
-  return 1;
+  return success;
 }
@@ -35,6 +35,7 @@
 #include "SetHandler.h"
 #include "DataSet.h"
 #include "Scores.h"
+#include "StreamingScores.h"
 #include "SanityCheck.h"
 #include "Normalizer.h"
 #include "ProteinProbEstimator.h"
@@ -42,6 +43,8 @@
 #include "PickedProteinInterface.h"
 #include "XMLInterface.h"
 #include "CrossValidation.h"
+#include "TrainedModel.h"
+#include "BaseSpline.h"
 
 /*
 * Main class that starts and controls the calculations.
@@ -77,7 +80,7 @@ class Caller {
   bool xmlSchemaValidation_;
   
   // file output parameters
-  std::string tabOutputFN_, xmlOutputFN_;
+  std::string tabOutputFN_, binOutputFN_, xmlOutputFN_;
   std::string weightOutputFN_;
   std::string psmResultFN_, peptideResultFN_, proteinResultFN_;
   std::string decoyPsmResultFN_, decoyPeptideResultFN_, decoyProteinResultFN_;
@@ -91,15 +94,31 @@ class Caller {
   
   // SVM / cross validation parameters
   double selectionFdr_, initialSelectionFdr_, testFdr_;
-  unsigned int numIterations_, maxPSMs_, nestedXvalBins_;
+  unsigned int numIterations_, maxPSMs_, nestedXvalBins_, numFolds_;
   double selectedCpos_, selectedCneg_;
   bool reportEachIteration_, quickValidation_, trainBestPositive_;
+  bool svmWarmStart_;
+  bool streamScoring_;
+  std::string streamTempDir_;
+  std::string modelOutputFN_, modelInputFN_;
   
   // reporting parameters
   std::string call_;
   
   void calculatePSMProb(Scores& allScores, bool uniquePeptideRun, 
       time_t& procStart, clock_t& procStartClock, double& diff);
+  int scoreFullList(std::istream& dataStream, bool binInput, 
+      std::vector<double>& rawWeights, SetHandler& setHandler, 
+      XMLInterface& xmlInterface, Scores& allScores);
+  int streamFullList(std::istream& dataStream, bool binInput, 
+      std::vector<double>& rawWeights, SetHandler& setHandler, 
+      time_t& procStart, clock_t& procStartClock, double& diff);
+  void processResults(Scores& allScores, XMLInterface& xmlInterface, 
+      time_t& procStart, clock_t& procStartClock, double& diff);
+  int applyModel(std::istream& dataStream, bool binInput, 
+      SetHandler& setHandler, XMLInterface& xmlInterface);
+  void calculateStreamedPSMProb(StreamingScores& streamScores, 
+      time_t& procStart, clock_t& procStartClock, double& diff);
   void calculateProteinProbabilities(Scores& allScores);
 
 #ifdef CRUX
@@ -17,35 +17,25 @@
 
 #include "CrossValidation.h"
 
-// number of folds for cross validation
-const unsigned int CrossValidation::numFolds_ = 3u;
-#ifdef _OPENMP
-const unsigned int CrossValidation::numAlgInObjects_ = CrossValidation::numFolds_;
-#else
-const unsigned int CrossValidation::numAlgInObjects_ = 1u;
-#endif
 // checks cross validation convergence in case of quickValidation_
 const double CrossValidation::requiredIncreaseOver2Iterations_ = 0.01; 
 
 CrossValidation::CrossValidation(bool quickValidation, 
   bool reportPerformanceEachIteration, double testFdr, double selectionFdr, 
   double initialSelectionFdr, double selectedCpos, double selectedCneg, int niter, bool usePi0,
-  int nestedXvalBins, bool trainBestPositive) :
+  int nestedXvalBins, bool trainBestPositive, unsigned int numFolds) :
     quickValidation_(quickValidation), usePi0_(usePi0),
     reportPerformanceEachIteration_(reportPerformanceEachIteration), 
     testFdr_(testFdr), selectionFdr_(selectionFdr), initialSelectionFdr_(initialSelectionFdr),
     selectedCpos_(selectedCpos), selectedCneg_(selectedCneg), niter_(niter),
-    nestedXvalBins_(nestedXvalBins), trainBestPositive_(trainBestPositive) {}
+    nestedXvalBins_(nestedXvalBins), trainBestPositive_(trainBestPositive),
+    numFolds_(numFolds), warmStart_(false), numSvmTrainings_(0) {
+  solverStats_.mfn_iterations = 0;
+  solverStats_.cgls_iterations = 0;
+}
 
 
-CrossValidation::~CrossValidation() { 
-  for (unsigned int set = 0; set < numAlgInObjects_; ++set) {
-    if (svmInputs_[set]) {
-      delete svmInputs_[set];
-    }
-    svmInputs_[set] = NULL;
-  }
-}
+CrossValidation::~CrossValidation() {}
 
 /** 
  * Sets up the SVM classifier: 
@@ -62,18 +52,13 @@ int CrossValidation::preIterationSetup(Scores& fullset, SanityCheck* pCheck,
   w_ = vector<vector<double> >(numFolds_, 
            vector<double> (FeatureNames::getNumFeatures() + 1));
   
-  // One input set, to be reused multiple times
-  for (unsigned int set = 0; set < numAlgInObjects_; ++set) {
-    svmInputs_.push_back(new AlgIn(fullset.size(), FeatureNames::getNumFeatures() + 1));
-    assert( svmInputs_.back() );
-  }
-  
   int numPositive = 0;
   if (selectedCpos_ >= 0 && selectedCneg_ >= 0) {
     trainScores_.resize(numFolds_, Scores(usePi0_));
     testScores_.resize(numFolds_, Scores(usePi0_));
     
-    fullset.createXvalSetsBySpectrum(trainScores_, testScores_, numFolds_, featurePool);
+    fullset.createXvalSetsBySpectrum(trainScores_, testScores_, numFolds_, 
+                                     featurePool);
     
     if (selectionFdr_ <= 0.0) {
       selectionFdr_ = testFdr_;
@@ -101,7 +86,8 @@ int CrossValidation::preIterationSetup(Scores& fullset, SanityCheck* pCheck,
     numPositive = pCheck->getInitDirection(testScores_, trainScores_, pNorm, w_, 
                                            testFdr_, initialSelectionFdr_);
   } else {
-    vector<Scores> myset(1, fullset);
+    vector<Scores> noTrainSet, myset;
+    fullset.createXvalSetsBySpectrum(noTrainSet, myset, 1u, featurePool);
     numPositive = pCheck->getInitDirection(myset, myset, pNorm, w_, testFdr_, initialSelectionFdr_);
   }
   
@@ -224,6 +210,9 @@ int CrossValidation::doStep(bool updateDOC, Normalizer* pNorm, double selectionF
   pOptions->cgitermax = CGITERMAX;
   pOptions->mfnitermax = MFNITERMAX;
   int estTruePos = 0;
+  numSvmTrainings_ = 0;
+  solverStats_.mfn_iterations = 0;
+  solverStats_.cgls_iterations = 0;
   
   // for determining an appropriate positive training set, the decoys+1 in the 
   // FDR estimates is too restrictive for small datasets
@@ -242,220 +231,294 @@ int CrossValidation::doStep(bool updateDOC, Normalizer* pNorm, double selectionF
     }
   }
   
+  std::vector<double> bestCpos(numFolds_, 1.0), bestCfrac(numFolds_, 1.0);
   if (!quickValidation_) {
-  #pragma omp parallel for schedule(dynamic, 1) ordered
-    for (int set = 0; set < numFolds_; ++set) {
-      struct vector_double* pWeights = new vector_double;
-      pWeights->d = FeatureNames::getNumFeatures() + 1;
-      pWeights->vec = new double[pWeights->d];
-      
-      double bestCpos = 1, bestCfrac = 1;
-      
-      int estTruePosFold = processSingleFold(set, selectionFdr, candidatesCpos_, 
-                                      candidatesCfrac_, bestCpos, bestCfrac, 
-                                      pWeights, pOptions);
-      #pragma omp critical (add_tps)
-      {
-        estTruePos += estTruePosFold;
-      }
-      
-      delete[] pWeights->vec;
-      delete pWeights;
+    std::vector<unsigned int> folds;
+    for (unsigned int set = 0; set < numFolds_; ++set) {
+      folds.push_back(set);
     }
+    estTruePos += trainFolds(folds, selectionFdr, candidatesCpos_, 
+                             candidatesCfrac_, bestCpos, bestCfrac, pOptions);
   } else {
-    struct vector_double* pWeights = new vector_double;
-    pWeights->d = FeatureNames::getNumFeatures() + 1;
-    pWeights->vec = new double[pWeights->d];
-    
-    double bestCpos = 1, bestCfrac = 1;
-    
     // Use limited internal cross validation, i.e take the cpos and cfrac 
     // values of the first bin and use it for the subsequent bins 
-    estTruePos += processSingleFold(0, selectionFdr, candidatesCpos_, 
-                                    candidatesCfrac_, bestCpos, bestCfrac, 
-                                    pWeights, pOptions);
-    vector<double> cp(1, bestCpos), cf(1, bestCfrac);
-  #pragma omp parallel for schedule(dynamic, 1) ordered
-    for (int set = 1; set < numFolds_; ++set) {
-      int estTruePosFold = processSingleFold(set, selectionFdr, cp, cf, bestCpos, 
-                                      bestCfrac, pWeights, pOptions);
-      #pragma omp critical (add_tps)
-      {
-        estTruePos += estTruePosFold;
-      }  
+    std::vector<unsigned int> folds(1, 0u);
+    estTruePos += trainFolds(folds, selectionFdr, candidatesCpos_, 
+                             candidatesCfrac_, bestCpos, bestCfrac, pOptions);
+    vector<double> cp(1, bestCpos[0]), cf(1, bestCfrac[0]);
+    folds.clear();
+    for (unsigned int set = 1; set < numFolds_; ++set) {
+      folds.push_back(set);
     }
-    delete[] pWeights->vec;
-    delete pWeights;
+    estTruePos += trainFolds(folds, selectionFdr, cp, cf, bestCpos, bestCfrac, 
+                             pOptions);
   }
   delete pOptions;
+  foldCpos_ = bestCpos;
+  foldCneg_.resize(numFolds_);
+  for (unsigned int set = 0; set < numFolds_; ++set) {
+    foldCneg_[set] = bestCfrac[set] * bestCpos[set];
+  }
+  if (VERB > 2) {
+    cerr << "Trained " << numSvmTrainings_ << " SVMs" 
+         << (warmStart_ ? " from the previous weights" : "") << " in "
+         << solverStats_.mfn_iterations << " MFN iterations and " 
+         << solverStats_.cgls_iterations << " CGLS iterations" << endl;
+  }
   return estTruePos / (numFolds_ - 1);
 }
 
 /** 
- * Train one of the crossvalidation bins 
- * @param set identification number of the bin that is processed
+ * Train a set of the crossvalidation bins. The SVM trainings of all 
+ * combinations of bin, nested bin and soft margin parameters are independent
+ * and run as one flat pool of tasks; the best parameters are selected 
+ * afterwards in the same order as a serial grid search would, so the 
+ * resulting weights do not depend on the number of threads.
+ * @param folds identification numbers of the bins that are processed
+ * @param selectionFdr FDR threshold for the positive training set
  * @param cposCandidates candidate soft margin parameters for positives
  * @param cfracCandidates candidate soft margin parameters for fraction neg/pos
- * @param bestCpos best soft margin parameter for positives
- * @param bestCfrac best soft margin parameter for fraction neg/pos
- * @param pWeights results vector from the SVM algorithm
+ * @param bestCpos best soft margin parameter for positives for each bin
+ * @param bestCfrac best soft margin parameter for fraction neg/pos for each bin
  * @param pOptions options for the SVM algorithm
+ * @return sum of the estimated number of true positives of the bins
 */
-int CrossValidation::processSingleFold(unsigned int set, double selectionFdr,
-    const vector<double>& cposCandidates, const vector<double>& cfracCandidates, 
-    double &bestCpos, double &bestCfrac, vector_double* pWeights, 
-    options * pOptions) {
+int CrossValidation::trainFolds(const std::vector<unsigned int>& folds, 
+    double selectionFdr, const vector<double>& cposCandidates, 
+    const vector<double>& cfracCandidates, std::vector<double>& bestCpos, 
+    std::vector<double>& bestCfrac, options* pOptions) {
   // for determining the number of positives, the decoys+1 in the FDR estimates 
   // is too restrictive for small datasets
   bool skipDecoysPlusOne = true;
+  const int numTrainFolds = static_cast<int>(folds.size());
   
-  int bestTruePos = 0;
-  vector<double> ww = w_[set]; // SVM weights initial guess and result holder
-  vector<double> bestW = w_[set]; // SVM weights with highest true pos estimate
-  
-  if (VERB > 3) {
-    cerr << "Starting processing CV split " << set + 1 << " out of "
-         << numFolds_ << endl;
+  // Set up the nested sets and SVM inputs serially, the nested sets have to 
+  // draw their random numbers in the order of the bins
+  std::vector< std::vector<Scores> > nestedTrainScores(numTrainFolds), 
+                                     nestedTestScores(numTrainFolds);
+  std::vector<Scores*> nestedTests(numTrainFolds * nestedXvalBins_);
+  std::vector<AlgIn*> svmInputs(numTrainFolds * nestedXvalBins_);
+  std::vector<GridPoint> gridPoints;
+  for (int ix = 0; ix < numTrainFolds; ++ix) {
+    unsigned int set = folds[ix];
+    if (VERB > 3) {
+      cerr << "Starting processing CV split " << set + 1 << " out of "
+           << numFolds_ << endl;
+    }
+    // sub-optimal cross validation without nested bins trains and tests on 
+    // the bin's training set
+    if (nestedXvalBins_ > 1) {
+      FeatureMemoryPool featurePool;
+      trainScores_[set].createXvalSetsBySpectrum(nestedTrainScores[ix], 
+          nestedTestScores[ix], nestedXvalBins_, featurePool);
+    }
+    
+    for (unsigned int nestedFold = 0; nestedFold < nestedXvalBins_; ++nestedFold) {
+      Scores* nestedTrain = &trainScores_[set];
+      Scores* nestedTest = &trainScores_[set];
+      if (!nestedTrainScores[ix].empty()) {
+        nestedTrain = &nestedTrainScores[ix][nestedFold];
+      }
+      if (!nestedTestScores[ix].empty()) {
+        nestedTest = &nestedTestScores[ix][nestedFold];
+      }
+      AlgIn* svmInput = new AlgIn(nestedTrain->size(), 
+                                  FeatureNames::getNumFeatures() + 1);
+      nestedTrain->generateNegativeTrainingSet(*svmInput, 1.0);
+      nestedTrain->generatePositiveTrainingSet(*svmInput, selectionFdr, 1.0, 
+                                               trainBestPositive_);
+      svmInputs[ix * nestedXvalBins_ + nestedFold] = svmInput;
+      nestedTest->prepareFeatureMatrix();
+      nestedTests[ix * nestedXvalBins_ + nestedFold] = nestedTest;
+      
+      if (VERB > 2) {
+        cerr << "Split " << set + 1 << ": Training with " 
+          << svmInput->positives << " positives and "
+          << svmInput->negatives << " negatives" << std::endl;
+      }
+      
+      std::vector<double>::const_iterator itCpos = cposCandidates.begin();
+      for ( ; itCpos != cposCandidates.end(); ++itCpos) {
+        std::vector<double>::const_iterator itCfrac = cfracCandidates.begin();
+        for ( ; itCfrac != cfracCandidates.end(); ++itCfrac) {
+          GridPoint gridPoint;
+          gridPoint.fold = ix;
+          gridPoint.nestedFold = nestedFold;
+          gridPoint.cpos = *itCpos;
+          gridPoint.cfrac = *itCfrac;
+          gridPoint.truePos = 0;
+          if (warmStart_) {
+            gridPoint.w = w_[set];
+          }
+          gridPoints.push_back(gridPoint);
+        }
+      }
+    }
   }
   
-  std::vector<Scores> nestedTrainScores(nestedXvalBins_, usePi0_), nestedTestScores(nestedXvalBins_, usePi0_);
-  if (nestedXvalBins_ > 1) {
-    FeatureMemoryPool featurePool;
-  #pragma omp ordered
-    {
-      trainScores_[set].createXvalSetsBySpectrum(nestedTrainScores, nestedTestScores, nestedXvalBins_, featurePool);
+  // Find the number of true positives for every grid point, each thread
+  // reuses its own buffers for the ranking and q-value passes
+  const int numGridPoints = static_cast<int>(gridPoints.size());
+#pragma omp parallel
+  {
+    ScoreBuffers buffers;
+  #pragma omp for schedule(dynamic, 1)
+    for (int i = 0; i < numGridPoints; ++i) {
+      GridPoint& gridPoint = gridPoints[i];
+      if (VERB > 3) cerr << "- cross-validation with Cpos=" << gridPoint.cpos
+          << ", Cneg=" << gridPoint.cfrac * gridPoint.cpos << endl;
+      trainSvm(*svmInputs[gridPoint.fold * nestedXvalBins_ + gridPoint.nestedFold],
+               gridPoint.cpos, gridPoint.cfrac, pOptions, gridPoint.w, 
+               gridPoint.stats);
+      gridPoint.truePos = nestedTests[gridPoint.fold * nestedXvalBins_ + 
+          gridPoint.nestedFold]->estimateTruePositives(gridPoint.w, testFdr_, 
+                                                       skipDecoysPlusOne,
+                                                       buffers);
+      if (VERB > 3) {
+        cerr << "- cross-validation found " << gridPoint.truePos
+             << " training set PSMs with q_liberal<" << testFdr_ << "." << endl;
+      }
     }
-  } else {
-    // sub-optimal cross validation
-    nestedTrainScores[0] = trainScores_[set];
-    nestedTestScores[0] = trainScores_[set];
+  }
+  for (size_t i = 0; i < svmInputs.size(); ++i) {
+    delete svmInputs[i];
+  }
+  for (int i = 0; i < numGridPoints; ++i) {
+    addSolverStats(gridPoints[i].stats);
   }
   
-  AlgIn* svmInput = svmInputs_[set % numAlgInObjects_];
-  std::map<std::pair<double, double>, int> intermediateResults;
-  for (unsigned int nestedFold = 0; nestedFold < nestedXvalBins_; ++nestedFold) {
-    nestedTrainScores[nestedFold].generateNegativeTrainingSet(*svmInput, 1.0);
-    nestedTrainScores[nestedFold].generatePositiveTrainingSet(*svmInput, selectionFdr, 1.0, trainBestPositive_);
-    
-    if (VERB > 2) {
-      cerr << "Split " << set + 1 << ": Training with " 
-        << svmInput->positives << " positives and "
-        << svmInput->negatives << " negatives" << std::endl;
-    }
-    
-    // Create storage vector for SVM algorithm
-    struct vector_double* Outputs = new vector_double;
-    size_t numInputs = svmInput->positives + svmInput->negatives;
-    Outputs->vec = new double[numInputs];
-    Outputs->d = numInputs;
-    
-    // Find soft margin parameters with highest estimate of true positives
-    std::vector<double>::const_iterator itCpos = cposCandidates.begin();
-    for ( ; itCpos != cposCandidates.end(); ++itCpos) {
-      double cpos = *itCpos;  
-      std::vector<double>::const_iterator itCfrac = cfracCandidates.begin();
-      for ( ; itCfrac != cfracCandidates.end(); ++itCfrac) {
-        double cfrac = *itCfrac;
-        if (VERB > 3) cerr << "- cross-validation with Cpos=" << cpos
-            << ", Cneg=" << cfrac*cpos << endl;
-        int tp = 0;
-        for (int ix = 0; ix < pWeights->d; ix++) {
-          pWeights->vec[ix] = 0;
-        }
-        for (int ix = 0; ix < Outputs->d; ix++) {
-          Outputs->vec[ix] = 0;
-        }
-        svmInput->setCost(cpos, cpos * cfrac);
-        
-        // Call SVM algorithm (see ssl.cpp)
-        L2_SVM_MFN(*svmInput, pOptions, pWeights, Outputs);
-        
-        for (int i = FeatureNames::getNumFeatures() + 1; i--;) {
-          ww[i] = pWeights->vec[i];
-        }
-        
-        tp = nestedTestScores[nestedFold].calcScores(ww, testFdr_, skipDecoysPlusOne);
+  // Find soft margin parameters with highest estimate of true positives, 
+  // ties are resolved in favor of the last grid point as in the serial order
+  std::vector< std::vector<double> > bestW(numTrainFolds);
+  std::vector<GridPoint>::const_iterator gridIt = gridPoints.begin();
+  for (int ix = 0; ix < numTrainFolds; ++ix) {
+    unsigned int set = folds[ix];
+    int bestTruePos = 0;
+    bestW[ix] = w_[set];
+    std::map<std::pair<double, double>, int> intermediateResults;
+    for ( ; gridIt != gridPoints.end() && gridIt->fold == (unsigned int)ix; ++gridIt) {
+      if (nestedXvalBins_ > 1) {
+        intermediateResults[std::make_pair(gridIt->cpos, gridIt->cfrac)] += 
+            gridIt->truePos;
+      } else if (gridIt->truePos >= bestTruePos) {
         if (VERB > 3) {
-          cerr << "- cross-validation found " << tp
-               << " training set PSMs with q_liberal<" << testFdr_ << "." << endl;
+          cerr << "Better than previous result, store this." << endl;
         }
-        
-        if (nestedXvalBins_ > 1) {
-          intermediateResults[std::make_pair(cpos, cfrac)] += tp;
-        } else {
+        bestTruePos = gridIt->truePos;
+        bestW[ix] = gridIt->w;
+        bestCpos[set] = gridIt->cpos;
+        bestCfrac[set] = gridIt->cfrac;
+      }
+    }
+    if (nestedXvalBins_ > 1) {
+      std::vector<double>::const_iterator itCpos = cposCandidates.begin();
+      for ( ; itCpos != cposCandidates.end(); ++itCpos) {
+        double cpos = *itCpos;  
+        std::vector<double>::const_iterator itCfrac = cfracCandidates.begin();
+        for ( ; itCfrac != cfracCandidates.end(); ++itCfrac) {
+          double cfrac = *itCfrac;
+          int tp = intermediateResults[std::make_pair(cpos, cfrac)];
           if (tp >= bestTruePos) {
             if (VERB > 3) {
-              cerr << "Better than previous result, store this." << endl;
+              cerr << "Better than previous result, store this: tp = " << tp << ", cpos = " << cpos << ", cneg = " << cfrac*cpos << endl;
             }
             bestTruePos = tp;
-            bestW = ww;
-            bestCpos = cpos;
-            bestCfrac = cfrac;
+            bestCpos[set] = cpos;
+            bestCfrac[set] = cfrac;
           }
         }
       }
     }
-    delete[] Outputs->vec;
-    delete Outputs;
   }
   
-  if (nestedXvalBins_ > 1) {
-    // Find soft margin parameters with highest estimate of true positives
-    std::vector<double>::const_iterator itCpos = cposCandidates.begin();
-    for ( ; itCpos != cposCandidates.end(); ++itCpos) {
-      double cpos = *itCpos;  
-      std::vector<double>::const_iterator itCfrac = cfracCandidates.begin();
-      for ( ; itCfrac != cfracCandidates.end(); ++itCfrac) {
-        double cfrac = *itCfrac;
-        int tp = intermediateResults[std::make_pair(cpos, cfrac)];
-        if (tp >= bestTruePos) {
-          if (VERB > 3) {
-            cerr << "Better than previous result, store this: tp = " << tp << ", cpos = " << cpos << ", cneg = " << cfrac*cpos << endl;
-          }
-          bestTruePos = tp;
-          bestCpos = cpos;
-          bestCfrac = cfrac;
-        }
+  int estTruePos = 0;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int ix = 0; ix < numTrainFolds; ++ix) {
+    unsigned int set = folds[ix];
+    if (nestedXvalBins_ > 1) {
+      AlgIn svmInput(trainScores_[set].size(), FeatureNames::getNumFeatures() + 1);
+      trainScores_[set].generateNegativeTrainingSet(svmInput, 1.0);
+      trainScores_[set].generatePositiveTrainingSet(svmInput, selectionFdr, 1.0, 
+                                                    trainBestPositive_);
+      solver_stats stats;
+      trainSvm(svmInput, bestCpos[set], bestCfrac[set], pOptions, bestW[ix], 
+               stats);
+    #pragma omp critical (add_solver_stats)
+      {
+        addSolverStats(stats);
       }
-    }    
-    trainScores_[set].generateNegativeTrainingSet(*svmInput, 1.0);
-    trainScores_[set].generatePositiveTrainingSet(*svmInput, selectionFdr, 1.0, trainBestPositive_);
+    }
     
-    // Create storage vector for SVM algorithm
-    struct vector_double* Outputs = new vector_double;
-    size_t numInputs = svmInput->positives + svmInput->negatives;
-    Outputs->vec = new double[numInputs];
-    Outputs->d = numInputs;
+    int bestTruePos = trainScores_[set].calcScores(bestW[ix], testFdr_);
     
-    for (int ix = 0; ix < pWeights->d; ix++) {
-      pWeights->vec[ix] = 0;
-    }
-    for (int ix = 0; ix < Outputs->d; ix++) {
-      Outputs->vec[ix] = 0;
+    if (VERB > 2) {
+      std::cerr << "Split " << set + 1 << ": Found " << 
+          bestTruePos << " training set PSMs with q<" << testFdr_ <<
+          " for hyperparameters Cpos=" << bestCpos[set] << 
+          ", Cneg=" << bestCfrac[set] * bestCpos[set] << "." << std::endl;
     }
-    svmInput->setCost(bestCpos, bestCpos * bestCfrac);
-    
-    // Call SVM algorithm (see ssl.cpp)
-    L2_SVM_MFN(*svmInput, pOptions, pWeights, Outputs);
     
-    for (int i = FeatureNames::getNumFeatures() + 1; i--;) {
-      bestW[i] = pWeights->vec[i];
+    w_[set] = bestW[ix];
+  #pragma omp critical (add_tps)
+    {
+      estTruePos += bestTruePos;
     }
-    delete[] Outputs->vec;
-    delete Outputs;
   }
+  return estTruePos;
+}
+
+/** 
+ * Trains the SVM on the given examples with the given soft margin parameters,
+ * starting from zero weights, or from the given weights in warm start mode
+ * @param svmInput training examples, the costs are set on a private copy
+ * @param cpos soft margin parameter for positives
+ * @param cfrac soft margin parameter for fraction neg/pos
+ * @param pOptions options for the SVM algorithm
+ * @param w initial SVM weights in warm start mode, resulting SVM weights
+ * @param stats number of iterations used by the SVM algorithm
+*/
+void CrossValidation::trainSvm(const AlgIn& svmInput, double cpos, 
+    double cfrac, options* pOptions, std::vector<double>& w, 
+    solver_stats& stats) {
+  AlgIn costInput(svmInput);
+  costInput.setCost(cpos, cpos * cfrac);
   
-  bestTruePos = trainScores_[set].calcScores(bestW, testFdr_);
+  // Create storage vectors for SVM algorithm
+  struct vector_double* pWeights = new vector_double;
+  pWeights->d = FeatureNames::getNumFeatures() + 1;
+  pWeights->vec = new double[pWeights->d]();
+  struct vector_double* Outputs = new vector_double;
+  Outputs->d = costInput.positives + costInput.negatives;
+  Outputs->vec = new double[Outputs->d]();
   
-  if (VERB > 2) {
-    std::cerr << "Split " << set + 1 << ": Found " << 
-        bestTruePos << " training set PSMs with q<" << testFdr_ <<
-        " for hyperparameters Cpos=" << bestCpos << 
-        ", Cneg=" << bestCfrac * bestCpos << "." << std::endl;
+  // the outputs have to match the initial weights
+  if (warmStart_ && w.size() == static_cast<size_t>(pWeights->d)) {
+    const int n = pWeights->d;
+    std::copy(w.begin(), w.end(), pWeights->vec);
+    for (int i = 0; i < Outputs->d; ++i) {
+      const double* val = costInput.vals[i];
+      double t = pWeights->vec[n - 1];
+      for (int j = n - 1; j--;) {
+        t += val[j] * pWeights->vec[j];
+      }
+      Outputs->vec[i] = t;
+    }
   }
   
-  w_[set] = bestW;
-  return bestTruePos;
+  // Call SVM algorithm (see ssl.cpp)
+  L2_SVM_MFN(costInput, pOptions, pWeights, Outputs, &stats);
+  
+  w.assign(pWeights->vec, pWeights->vec + pWeights->d);
+  delete[] Outputs->vec;
+  delete Outputs;
+  delete[] pWeights->vec;
+  delete pWeights;
+}
+
+void CrossValidation::addSolverStats(const solver_stats& stats) {
+  ++numSvmTrainings_;
+  solverStats_.mfn_iterations += stats.mfn_iterations;
+  solverStats_.cgls_iterations += stats.cgls_iterations;
 }
 
 void CrossValidation::postIterationProcessing(Scores& fullset,
@@ -530,13 +593,13 @@ void CrossValidation::printAllWeightsColumns(
     std::vector< std::vector<double> > weightMatrix, ostream & outputStream) {
   // write to intermediate stream to prevent the fixed precision from sticking
   ostringstream weightStream;
-  for (unsigned int set = 0; set < numFolds_; ++set) {
+  for (unsigned int set = 0; set < weightMatrix.size(); ++set) {
     weightStream << " Split" << set + 1 << '\t'; // right-align with weights
   }
   weightStream << "FeatureName" << std::endl;
   size_t numRows = FeatureNames::getNumFeatures() + 1;
   for (unsigned int ix = 0; ix < numRows; ix++) {
-    for (unsigned int set = 0; set < numFolds_; ++set) {
+    for (unsigned int set = 0; set < weightMatrix.size(); ++set) {
       // align positive and negative weights
       if (weightMatrix[set][ix] >= 0) weightStream << " ";
       weightStream << fixed << setprecision(4) << weightMatrix[set][ix];
@@ -28,6 +28,7 @@
 #include "Scores.h"
 #include "DataSet.h"
 #include "FeatureMemoryPool.h"
+#include "PosteriorEstimator.h"
 #include "ssl.h"
 
 class CrossValidation {
@@ -36,7 +37,7 @@ class CrossValidation {
   CrossValidation(bool quickValidation, bool reportPerformanceEachIteration, 
     double testFdr, double selectionFdr, double initialSelectionFdr, 
     double selectedCpos, double selectedCneg, int niter, bool usePi0, 
-    int nestedXvalBins, bool trainBestPositive);
+    int nestedXvalBins, bool trainBestPositive, unsigned int numFolds);
   ~CrossValidation();
   
   int preIterationSetup(Scores & fullset, SanityCheck * pCheck, 
@@ -66,9 +67,15 @@ class CrossValidation {
   void inline setReportPerformanceEachIteration(bool on) { 
     reportPerformanceEachIteration_ = on;
   }
+  void inline setWarmStart(bool on) { warmStart_ = on; }
+  
+  inline const std::vector< std::vector<double> >& getWeights() const {
+    return w_;
+  }
+  inline const std::vector<double>& getFoldCpos() const { return foldCpos_; }
+  inline const std::vector<double>& getFoldCneg() const { return foldCneg_; }
   
  protected:
-  std::vector<AlgIn*> svmInputs_;
   std::vector< std::vector<double> > w_; // svm weights for each fold
   
   bool quickValidation_;
@@ -80,24 +87,43 @@ class CrossValidation {
   double initialSelectionFdr_; // fdr used for determining positive training set in first iteration
   double selectedCpos_; // soft margin parameter for positive training set
   double selectedCneg_; // soft margin parameter for negative training set
+  // soft margin parameters selected for each bin in the last iteration
+  std::vector<double> foldCpos_, foldCneg_;
   
   unsigned int niter_;
   unsigned int nestedXvalBins_;
   
   bool trainBestPositive_;
+  unsigned int numFolds_;
+  bool warmStart_; // start SVM trainings from the bin's previous weights
+  
+  // solver statistics of the SVM trainings of the current iteration
+  int numSvmTrainings_;
+  solver_stats solverStats_;
   
   const static double requiredIncreaseOver2Iterations_;
   
-  const static unsigned int numFolds_;
-  const static unsigned int numAlgInObjects_;
   std::vector<Scores> trainScores_, testScores_;
   std::vector<double> candidatesCpos_, candidatesCfrac_;
   
-  int processSingleFold(unsigned int set, double selectionFdr,
-                         const vector<double>& cpos_vec, 
-                         const vector<double>& cfrac_vec, 
-                         double& best_cpos, double& best_cfrac, 
-                         vector_double* pWeights, options* pOptions);
+  // one SVM training of the soft margin parameter grid search
+  struct GridPoint {
+    unsigned int fold, nestedFold;
+    double cpos, cfrac;
+    int truePos;
+    std::vector<double> w;
+    solver_stats stats;
+  };
+  
+  int trainFolds(const std::vector<unsigned int>& folds, double selectionFdr,
+                 const vector<double>& cposCandidates, 
+                 const vector<double>& cfracCandidates, 
+                 std::vector<double>& bestCpos, std::vector<double>& bestCfrac,
+                 options* pOptions);
+  void trainSvm(const AlgIn& svmInput, double cpos, double cfrac, 
+                options* pOptions, std::vector<double>& w, 
+                solver_stats& stats);
+  void addSolverStats(const solver_stats& stats);
   int doStep(bool updateDOC, Normalizer* pNorm, double selectionFdr);
   
   void printSetWeights(ostream & weightStream, unsigned int set);
@@ -129,6 +129,18 @@ void DataSet::readPsm(const std::string& line, const unsigned int lineNr,
 int DataSet::readPsm(const std::string& line, const unsigned int lineNr,
     const std::vector<OptionalField>& optionalFields, bool readProteins,
     PSMDescription*& myPsm, FeatureMemoryPool& featurePool) {
+  return readPsm(line, lineNr, optionalFields, readProteins, myPsm, 
+                 featurePool.allocate());
+}
+
+/**
+ * Parses a PSM into an already allocated feature row. If the protein ids are
+ * interned into a local proteinPool, no shared state is touched, so that 
+ * different lines can be parsed concurrently.
+ */
+int DataSet::readPsm(const std::string& line, const unsigned int lineNr,
+    const std::vector<OptionalField>& optionalFields, bool readProteins,
+    PSMDescription*& myPsm, double* featureRow, StringPool* proteinPool) {
   TabReader reader(line);
   std::string tmp;
   
@@ -172,7 +184,6 @@ int DataSet::readPsm(const std::string& line, const unsigned int lineNr,
   if (!hasScannr) myPsm->scan = lineNr;
   
   unsigned int numFeatures = FeatureNames::getNumFeatures();
-  double* featureRow = featurePool.allocate();
   if (calcDOC_) {
     numFeatures -= DescriptionOfCorrect::numDOCFeatures();
     double rt, dm;
@@ -218,12 +229,17 @@ int DataSet::readPsm(const std::string& line, const unsigned int lineNr,
   }
   
   if (readProteins) {
-    std::vector<std::string> proteins;
     while (!reader.error()) {
       std::string tmp = reader.readString();
-      if (tmp.size() > 0) proteins.push_back(tmp);
+      if (tmp.size() > 0) {
+        if (proteinPool != NULL) {
+          myPsm->addProteinId(tmp, *proteinPool);
+        } else {
+          myPsm->addProteinId(tmp);
+        }
+      }
     }
-    proteins.swap(myPsm->proteinIds); // shrink to fit
+    myPsm->shrinkProteinIds();
   }
   
   return label;
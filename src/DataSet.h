@@ -127,6 +127,7 @@ class DataSet {
   int inline getLabel() const { return label_; }
   
   unsigned int inline getSize() const { return psms_.size(); }
+  const std::vector<PSMDescription*>& getPsms() const { return psms_; }
   
   static inline void setCalcDoc(bool on) { calcDOC_ = on; }
   static inline bool getCalcDoc() { return calcDOC_; }
@@ -158,6 +159,10 @@ class DataSet {
   static int readPsm(const std::string& line, const unsigned int lineNr,
     const std::vector<OptionalField>& optionalFields, bool readProteins,
     PSMDescription*& myPsm, FeatureMemoryPool& featurePool);
+  static int readPsm(const std::string& line, const unsigned int lineNr,
+    const std::vector<OptionalField>& optionalFields, bool readProteins,
+    PSMDescription*& myPsm, double* featureRow, 
+    StringPool* proteinPool = NULL);
   
   void registerPsm(PSMDescription* myPsm);
   
@@ -0,0 +1,213 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+
+#include "FeatureMatrix.h"
+
+#include <cassert>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+  #define FEATURE_MATRIX_X86_KERNELS
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+const size_t kAlignment = 64u; // in bytes
+
+typedef void (*ScoreBlocksFunction)(const double* data, size_t numBlocks,
+    size_t numFeatures, const double* w, double* scores);
+
+/*
+ * All kernels start from the bias term and add the feature terms from the
+ * last feature to the first, with separate multiplications and additions,
+ * i.e. in exactly the order used by Scores::calcScore.
+ */
+void scoreBlocksPortable(const double* data, size_t numBlocks,
+    size_t numFeatures, const double* w, double* scores) {
+  const size_t kLanes = FeatureMatrix::kBlockSize;
+  for (size_t block = 0; block < numBlocks; ++block) {
+    const double* blockData = data + block * numFeatures * kLanes;
+    double* blockScores = scores + block * kLanes;
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+      blockScores[lane] = w[numFeatures];
+    }
+    for (size_t ix = numFeatures; ix--;) {
+      const double* featureData = blockData + ix * kLanes;
+      for (size_t lane = 0; lane < kLanes; ++lane) {
+        blockScores[lane] += featureData[lane] * w[ix];
+      }
+    }
+  }
+}
+
+#ifdef FEATURE_MATRIX_X86_KERNELS
+__attribute__((target("avx2")))
+void scoreBlocksAvx2(const double* data, size_t numBlocks,
+    size_t numFeatures, const double* w, double* scores) {
+  for (size_t block = 0; block < numBlocks; ++block) {
+    const double* blockData = data + block * numFeatures * 8u;
+    __m256d lo = _mm256_set1_pd(w[numFeatures]);
+    __m256d hi = lo;
+    for (size_t ix = numFeatures; ix--;) {
+      __m256d weight = _mm256_set1_pd(w[ix]);
+      lo = _mm256_add_pd(lo, _mm256_mul_pd(
+          _mm256_load_pd(blockData + ix * 8u), weight));
+      hi = _mm256_add_pd(hi, _mm256_mul_pd(
+          _mm256_load_pd(blockData + ix * 8u + 4u), weight));
+    }
+    _mm256_storeu_pd(scores + block * 8u, lo);
+    _mm256_storeu_pd(scores + block * 8u + 4u, hi);
+  }
+}
+
+// AVX-512F implies FMA, the explicitly rounded operations keep the compiler
+// from contracting the multiplication and addition into one instruction
+__attribute__((target("avx512f")))
+void scoreBlocksAvx512(const double* data, size_t numBlocks,
+    size_t numFeatures, const double* w, double* scores) {
+  for (size_t block = 0; block < numBlocks; ++block) {
+    const double* blockData = data + block * numFeatures * 8u;
+    __m512d acc = _mm512_set1_pd(w[numFeatures]);
+    for (size_t ix = numFeatures; ix--;) {
+      __m512d product = _mm512_mul_round_pd(
+          _mm512_load_pd(blockData + ix * 8u), _mm512_set1_pd(w[ix]),
+          _MM_FROUND_CUR_DIRECTION);
+      acc = _mm512_add_round_pd(acc, product, _MM_FROUND_CUR_DIRECTION);
+    }
+    _mm512_storeu_pd(scores + block * 8u, acc);
+  }
+}
+#endif
+
+ScoreBlocksFunction selectScoreBlocksFunction() {
+#ifdef FEATURE_MATRIX_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return scoreBlocksAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return scoreBlocksAvx2;
+  }
+#endif
+  return scoreBlocksPortable;
+}
+
+const ScoreBlocksFunction scoreBlocks = selectScoreBlocksFunction();
+
+} // namespace
+
+FeatureMatrix::FeatureMatrix() : numRows_(0u), numFeatures_(0u),
+    numBlocks_(0u), version_(0u), buffer_(NULL), data_(NULL) {}
+
+FeatureMatrix::FeatureMatrix(const FeatureMatrix& other) : numRows_(0u),
+    numFeatures_(0u), numBlocks_(0u), version_(0u), buffer_(NULL), 
+    data_(NULL) {
+  *this = other;
+}
+
+FeatureMatrix& FeatureMatrix::operator=(const FeatureMatrix& other) {
+  if (this != &other) {
+    allocate(other.numBlocks_, other.numFeatures_);
+    numRows_ = other.numRows_;
+    version_ = other.version_;
+    rowFeatures_ = other.rowFeatures_;
+    if (numBlocks_ > 0u) {
+      memcpy(data_, other.data_, 
+             numBlocks_ * numFeatures_ * kBlockSize * sizeof(double));
+    }
+  }
+  return *this;
+}
+
+FeatureMatrix::~FeatureMatrix() {
+  delete[] buffer_;
+}
+
+void FeatureMatrix::allocate(size_t numBlocks, size_t numFeatures) {
+  if (numBlocks * numFeatures != numBlocks_ * numFeatures_) {
+    delete[] buffer_;
+    buffer_ = NULL;
+    data_ = NULL;
+    if (numBlocks * numFeatures > 0u) {
+      const size_t kPadding = kAlignment / sizeof(double) - 1u;
+      buffer_ = new double[numBlocks * numFeatures * kBlockSize + kPadding];
+      size_t offset = reinterpret_cast<size_t>(buffer_) % kAlignment;
+      data_ = buffer_ + (offset ? (kAlignment - offset) / sizeof(double) : 0u);
+    }
+  }
+  numBlocks_ = numBlocks;
+  numFeatures_ = numFeatures;
+}
+
+/**
+ * Prepares the matrix for numRows rows of numFeatures features, the rows
+ * have to be filled in with setRow before scoring, rows that are not set
+ * remain zero
+ */
+void FeatureMatrix::reset(size_t numRows, size_t numFeatures) {
+  allocate(roundUpToBlock(numRows) / kBlockSize, numFeatures);
+  numRows_ = numRows;
+  rowFeatures_.assign(numRows, NULL);
+  if (numBlocks_ > 0u) {
+    memset(data_, 0, numBlocks_ * numFeatures_ * kBlockSize * sizeof(double));
+  }
+}
+
+void FeatureMatrix::clear() {
+  allocate(0u, 0u);
+  numRows_ = 0u;
+  std::vector<const double*>().swap(rowFeatures_);
+}
+
+void FeatureMatrix::setRow(size_t row, const double* features) {
+  assert(row < numRows_);
+  rowFeatures_[row] = features;
+  copyRow(row, features);
+}
+
+void FeatureMatrix::refresh() {
+  for (size_t row = 0; row < numRows_; ++row) {
+    if (rowFeatures_[row] != NULL) copyRow(row, rowFeatures_[row]);
+  }
+}
+
+void FeatureMatrix::copyRow(size_t row, const double* features) {
+  double* blockData = data_ + (row / kBlockSize) * numFeatures_ * kBlockSize;
+  size_t lane = row % kBlockSize;
+  for (size_t ix = 0; ix < numFeatures_; ++ix) {
+    blockData[ix * kBlockSize + lane] = features[ix];
+  }
+}
+
+void FeatureMatrix::calcScores(const std::vector<double>& w, size_t firstRow,
+                               size_t lastRow, double* scores) const {
+  assert(w.size() > numFeatures_);
+  assert(firstRow % kBlockSize == 0u && lastRow <= numRows_);
+  if (lastRow > firstRow) {
+    size_t firstBlock = firstRow / kBlockSize;
+    size_t lastBlock = roundUpToBlock(lastRow) / kBlockSize;
+    scoreBlocks(data_ + firstBlock * numFeatures_ * kBlockSize, 
+                lastBlock - firstBlock, numFeatures_, &w[0], scores);
+  }
+}
+
+void FeatureMatrix::calcScores(const std::vector<double>& w, 
+                               double* scores) const {
+  calcScores(w, 0u, numRows_, scores);
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+#ifndef FEATURE_MATRIX_H_
+#define FEATURE_MATRIX_H_
+
+#include <cstddef>
+#include <vector>
+
+/*
+* FeatureMatrix is a contiguous copy of the feature rows of a set of PSMs,
+* used to score all PSMs of a Scores object in a single pass. A matrix can be
+* shared by several Scores objects, e.g. the cross validation folds, which
+* then each score the row ranges of their own PSMs.
+*
+* The rows are stored as a blocked structure-of-arrays: kBlockSize PSMs form
+* a block, and within a block the values of each feature are contiguous. A
+* block is scored with one vector register per kBlockSize doubles (AVX-512,
+* AVX2 or a portable fallback, selected at runtime), accumulating the features
+* in the same order as Scores::calcScore, so the scores are bit-identical to
+* the scalar dot product.
+*
+*/
+class FeatureMatrix {
+ public:
+  static const size_t kBlockSize = 8u; // PSMs per block
+  
+  FeatureMatrix();
+  FeatureMatrix(const FeatureMatrix& other);
+  FeatureMatrix& operator=(const FeatureMatrix& other);
+  ~FeatureMatrix();
+  
+  void reset(size_t numRows, size_t numFeatures);
+  void clear();
+  void setRow(size_t row, const double* features);
+  // copies the features of all rows again, after they changed in place
+  void refresh();
+  
+  // calculates w[numFeatures] + sum_i features[i]*w[i] for the rows
+  // [firstRow, lastRow), firstRow has to be a multiple of kBlockSize and
+  // scores has to hold lastRow - firstRow rounded up to a full block
+  void calcScores(const std::vector<double>& w, size_t firstRow, 
+                  size_t lastRow, double* scores) const;
+  // same as above for all getNumPaddedRows() rows
+  void calcScores(const std::vector<double>& w, double* scores) const;
+  
+  inline size_t getNumRows() const { return numRows_; }
+  inline size_t getNumFeatures() const { return numFeatures_; }
+  inline size_t getNumPaddedRows() const { return numBlocks_ * kBlockSize; }
+  inline bool empty() const { return numRows_ == 0u; }
+  
+  // version of the features the matrix was filled with, set by the owner
+  inline unsigned int getVersion() const { return version_; }
+  inline void setVersion(unsigned int version) { version_ = version; }
+  
+  static inline size_t roundUpToBlock(size_t numRows) {
+    return (numRows + kBlockSize - 1u) / kBlockSize * kBlockSize;
+  }
+  
+ private:
+  size_t numRows_, numFeatures_, numBlocks_;
+  unsigned int version_;
+  double* buffer_; // unaligned allocation owning the data
+  double* data_; // 64 byte aligned start of the first block
+  std::vector<const double*> rowFeatures_; // source of each row, or NULL
+  
+  void allocate(size_t numBlocks, size_t numFeatures);
+  void copyRow(size_t row, const double* features);
+};
+
+#endif /* FEATURE_MATRIX_H_ */
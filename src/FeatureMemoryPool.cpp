@@ -15,6 +15,8 @@
 
  *******************************************************************************/
 
+#include <cassert>
+
 #include "FeatureMemoryPool.h"
 
 void FeatureMemoryPool::createPool(size_t numFeatures) {
@@ -23,13 +25,31 @@ void FeatureMemoryPool::createPool(size_t numFeatures) {
   isInitialized_ = true;
 }
 
+/**
+ * Uses an externally owned buffer, e.g. a memory mapped binary pin file, with
+ * numRows consecutive rows as the first blocks of the pool. The rows are not
+ * handed out by allocate(), the caller assigns them directly by index. Newly
+ * allocated rows are taken from blocks owned by the pool after the buffer.
+ * Has to be called on a pool without any blocks.
+ */
+void FeatureMemoryPool::createPoolFromBuffer(size_t numFeatures, 
+    double* buffer, size_t numRows) {
+  assert(memStarts_.empty());
+  createPool(numFeatures);
+  for (size_t row = 0; row < numRows; row += numRowsPerBlock_) {
+    memStarts_.push_back(buffer + row * numFeatures_);
+  }
+  numExternalBlocks_ = memStarts_.size();
+  initializedRows_ = numRowsPerBlock_ * memStarts_.size();
+}
+
 void FeatureMemoryPool::createNewBlock() {
   double* memStart = new double[numFeatures_ * numRowsPerBlock_]();
   memStarts_.push_back(memStart);
 }
 
 void FeatureMemoryPool::destroyPool() {
-  for (size_t i = 0; i < memStarts_.size(); ++i) {
+  for (size_t i = numExternalBlocks_; i < memStarts_.size(); ++i) {
     if (memStarts_.at(i) != NULL) {
       delete[] memStarts_.at(i);
       memStarts_.at(i) = NULL;
@@ -26,20 +26,24 @@ class FeatureMemoryPool {
  private:
    static const unsigned int kBlockSize = 65536; // in number of doubles
    unsigned int numRowsPerBlock_, numFeatures_, initializedRows_;
+   size_t numExternalBlocks_; // leading blocks not owned by the pool
    std::vector<double*> memStarts_;
    std::vector<double*> freeRows_;
    bool isInitialized_;
  public:
   FeatureMemoryPool() : numRowsPerBlock_(0), numFeatures_(0), 
-                        initializedRows_(0), isInitialized_(false) {}
+                        initializedRows_(0), numExternalBlocks_(0), 
+                        isInitialized_(false) {}
 
   ~FeatureMemoryPool() { destroyPool(); }
 
   void createPool(size_t numFeatures);
+  void createPoolFromBuffer(size_t numFeatures, double* buffer, size_t numRows);
   void createNewBlock();
   void destroyPool();
   
   bool isInitialized() const { return isInitialized_; }
+  unsigned int getNumFeatures() const { return numFeatures_; }
 
   double* addressFromIdx(unsigned int i) const;
 
@@ -16,6 +16,7 @@
  *******************************************************************************/
 
 #include "FidoInterface.h"
+#include "MyException.h"
 
 const double FidoInterface::kPsmThreshold = 0.0;
 const double FidoInterface::kPeptideThreshold = 0.001;
@@ -134,13 +135,11 @@ double FidoInterface::estimatePriors(Scores& peptideScores) {
   for (vector<ScoreHolder>::iterator psm = peptideScores.begin(); 
          psm!= peptideScores.end(); ++psm) {
     if(!psm->isDecoy()) {
-      unsigned size = psm->pPSM->proteinIds.size();
+      unsigned size = psm->pPSM->getNumProteins();
       double prior = prior_protein * size;
       double tmp_prior = prior;
       // for each protein
-      for(std::vector<std::string>::iterator protIt = psm->pPSM->proteinIds.begin(); 
-	          protIt != psm->pPSM->proteinIds.end(); protIt++) {
-	      unsigned index = std::distance(psm->pPSM->proteinIds.begin(), protIt);
+      for(unsigned index = 0; index < size; ++index) {
 	      tmp_prior = (tmp_prior * prior_protein * (size - index)) / (index + 1);
 	      prior +=  pow(-1.0,(int)index) * tmp_prior;
       }
@@ -417,37 +416,94 @@ void FidoInterface::gridSearch(std::vector<double>& alpha_search,
   double best_objective = -100000000;
   double current_objective;
   
+  // grid points in the order of the serial search: gamma, alpha, then beta
+  std::vector<Model> gridPoints;
+  gridPoints.reserve(gamma_search.size() * alpha_search.size() * beta_search.size());
   for (unsigned int i = 0; i < gamma_search.size(); i++) {
-    double gamma_local = gamma_search[i];
     for (unsigned int j = 0; j < alpha_search.size(); j++) {
-      double alpha_local = alpha_search[j];
       for (unsigned int k = 0; k < beta_search.size(); k++) {
-        double beta_local = beta_search[k];
-        
-        current_objective = calcObjective(alpha_local, beta_local, gamma_local);
-        if (current_objective > best_objective) {
-          best_objective = current_objective;
-          gamma_best = gamma_local;
-          alpha_best = alpha_local;
-          beta_best = beta_local;
+        gridPoints.push_back(Model(alpha_search[j], beta_search[k], gamma_search[i]));
+      }
+    }
+  }
+  
+  // The protein probabilities of a batch of grid points are computed 
+  // concurrently, each thread on its own copy of the graph, as only the 
+  // parameters change between grid points. The objectives are evaluated 
+  // serially in grid order afterwards, since they update rocN_ and may draw
+  // random numbers for the pi0 estimation, so that the first best grid point
+  // wins exactly as in a serial search. Exceptions cannot leave the OpenMP 
+  // region, so they are collected per grid point, the search stops after the
+  // batch of the first one and its message is rethrown afterwards.
+  std::vector<std::vector<std::vector<std::string> > > batchNames(kGridSearchBatchSize);
+  std::vector<std::vector<double> > batchProbs(kGridSearchBatchSize);
+  int numGridPoints = static_cast<int>(gridPoints.size());
+  std::vector<std::string> errors(gridPoints.size());
+  bool failed = false;
+#pragma omp parallel
+  {
+    GroupPowerBigraph* localGraph = NULL;
+    for (int batchStart = 0; batchStart < numGridPoints && !failed; 
+         batchStart += kGridSearchBatchSize) {
+      int batchEnd = batchStart + kGridSearchBatchSize;
+      if (batchEnd > numGridPoints) batchEnd = numGridPoints;
+#pragma omp for schedule(dynamic, 1)
+      for (int p = batchStart; p < batchEnd; ++p) {
+        try {
+          if (localGraph == NULL) {
+            localGraph = new GroupPowerBigraph(*proteinGraph_);
+          }
+          const Model& params = gridPoints[p];
+          std::vector<std::vector<std::string> >& names = batchNames[p - batchStart];
+          std::vector<double>& probs = batchProbs[p - batchStart];
+          localGraph->setAlphaBetaGamma(params.alpha, params.beta, params.gamma);
+          localGraph->getProteinProbs();
+          localGraph->getProteinProbsAndNames(names, probs);
+        } catch (const std::exception& e) {
+          errors[p] = e.what();
+        }
+      }
+#pragma omp single
+      {
+        for (int p = batchStart; p < batchEnd && !failed; ++p) {
+          if (!errors[p].empty()) {
+            failed = true;
+            break;
+          }
+          try {
+            const Model& params = gridPoints[p];
+            current_objective = calcObjective(params.alpha, params.beta, 
+                params.gamma, batchNames[p - batchStart], batchProbs[p - batchStart]);
+            if (current_objective > best_objective) {
+              best_objective = current_objective;
+              gamma_best = params.gamma;
+              alpha_best = params.alpha;
+              beta_best = params.beta;
+            }
+          } catch (const std::exception& e) {
+            errors[p] = e.what();
+            failed = true;
+          }
         }
       }
     }
+    delete localGraph;
+  }
+  std::vector<std::string>::const_iterator errorIt = errors.begin();
+  for ( ; errorIt != errors.end(); ++errorIt) {
+    if (!errorIt->empty()) throw MyException(*errorIt);
   }
   alpha_ = alpha_best;
   beta_ = beta_best;
   gamma_ = gamma_best;
 }
 
-double FidoInterface::calcObjective(double alpha, double beta, double gamma) {
-  std::vector<std::vector<std::string> > names;
-  std::vector<double> probs, empq, estq; 
+double FidoInterface::calcObjective(double alpha, double beta, double gamma,
+    const std::vector<std::vector<std::string> >& names,
+    const std::vector<double>& probs) {
+  std::vector<double> empq, estq; 
   double roc ,mse, objective;
   
-  proteinGraph_->setAlphaBetaGamma(alpha, beta, gamma);
-  proteinGraph_->getProteinProbs();
-  proteinGraph_->getProteinProbsAndNames(names, probs);
-  
   getEstimated_and_Empirical_FDR(names, probs, empq, estq);
   getFDR_MSE(estq, empq, mse);
   getROC_AUC(names, probs, roc);
@@ -62,6 +62,8 @@ class FidoInterface : public ProteinProbEstimator {
   const static bool kUpdateRocN = true;
   /** activate the optimization of the parameters to see the best boundaries**/
   const static bool kOptimizeParams = false;
+  /** number of grid points whose protein probabilities are computed concurrently before their objectives are evaluated **/
+  const static unsigned kGridSearchBatchSize = 64u;
 
  public:
   FidoInterface(double alpha = -1, double beta = -1, double gamma = -1, 
@@ -132,7 +134,9 @@ class FidoInterface : public ProteinProbEstimator {
   void gridSearch(std::vector<double>& alpha_search, 
                   std::vector<double>& beta_search, 
                   std::vector<double>& gamma_search);
-  double calcObjective(double alpha, double beta, double gamma);  
+  double calcObjective(double alpha, double beta, double gamma,
+                       const std::vector<std::vector<std::string> >& names,
+                       const std::vector<double>& probs);
   
 };
 
@@ -43,22 +43,22 @@ double logit(double p) {
 }
 
 void LogisticRegression::limitg() {
-  for (int ix = gnew.numberEntries(); ix--;) {
-    gnew.packedReplace(ix, min(gRange, max(-gRange, gnew[ix])));
+  for (int ix = gnew.size(); ix--;) {
+    gnew[ix] = min(gRange, max(-gRange, gnew[ix]));
     assert(isfinite(gnew[ix]));
   }
 }
 
 void LogisticRegression::limitgamma() {
-  for (int ix = gamma.numberEntries(); ix--;) {
-    gamma.packedReplace(ix, min(gRange, max(-gRange, gamma[ix])));
+  for (int ix = gamma.size(); ix--;) {
+    gamma[ix] = min(gRange, max(-gRange, gamma[ix]));
     assert(isfinite(gamma[ix]));
   }
 }
 
 void LogisticRegression::calcPZW() {
 
-  for (int ix = z.numberEntries(); ix--;) {
+  for (int ix = z.size(); ix--;) {
     assert(isfinite(g[ix]));
     double e = exp(g[ix]);
     assert(isfinite(e));
@@ -66,10 +66,10 @@ void LogisticRegression::calcPZW() {
     p[ix] = min(max(e / (1 + e), epsilon), 1
         - epsilon);
     assert(isfinite(p[ix]));
-    w.packedReplace(ix, max(m[ix] * p[ix] * (1 - p[ix]), epsilon));
+    w[ix] = max(m[ix] * p[ix] * (1 - p[ix]), epsilon);
     assert(isfinite(w[ix]));
-    z.packedReplace(ix, min(gRange, max(-gRange, g[ix] +
-        (y[ix] - p[ix] * m[ix]) / w[ix])));
+    z[ix] = min(gRange, max(-gRange, g[ix] +
+        (y[ix] - p[ix] * m[ix]) / w[ix]));
     assert(isfinite(z[ix]));
   }
 }
@@ -78,10 +78,10 @@ void LogisticRegression::initg() {
   BaseSpline::initg();
   int n = x.size();
   p.resize(n);
-  gnew = PackedVector(n);
+  gnew.assign(n, 0.0);
   for (int ix = g.size(); ix--;) {
     double p = (y[ix] + 0.05) / (m[ix] + 0.1);
-    gnew.packedReplace(ix, log(p / (1 - p)));
+    gnew[ix] = log(p / (1 - p));
     assert(isfinite(p));
     assert(isfinite(g[ix]));
   }
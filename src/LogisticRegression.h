@@ -36,13 +36,16 @@ class LogisticRegression : public BaseSpline {
       m = mm;
     }
   protected:
+    virtual BaseSpline* clone() const {
+      return new LogisticRegression(*this);
+    }
     virtual void calcPZW();
     virtual void initg();
     virtual void limitg();
     virtual void limitgamma();
     std::vector<double> y, m;
     static const double gRange;
-    Array<double> p;
+    std::vector<double> p;
 };
 
 #endif /*LOGISTICREGRESSION_H_*/
@@ -21,6 +21,8 @@
 #include "PSMDescription.h"
 #include "DescriptionOfCorrect.h"
 
+StringPool PSMDescription::proteinPool_;
+
 PSMDescription::PSMDescription() :
     features(NULL), expMass(0.), calcMass(0.), scan(0),
     id_(""), peptide("") {
@@ -69,8 +71,30 @@ std::string PSMDescription::removePTMs(const string& peptide) {
 }
 
 void PSMDescription::printProteins(std::ostream& out) {
-  std::vector<std::string>::const_iterator it = proteinIds.begin();
-  for ( ; it != proteinIds.end(); ++it) {
-    out << '\t' << *it;
+  std::vector<unsigned int>::const_iterator it = proteinIds_.begin();
+  for ( ; it != proteinIds_.end(); ++it) {
+    out << '\t' << proteinPool_.get(*it);
+  }
+}
+
+void PSMDescription::addProteinId(const std::string& proteinId) {
+  proteinIds_.push_back(proteinPool_.intern(proteinId));
+}
+
+void PSMDescription::addProteinId(const std::string& proteinId, 
+                                  StringPool& localPool) {
+  proteinIds_.push_back(localPool.intern(proteinId));
+}
+
+/**
+ * Replaces the handles into a local pool by those into the shared pool
+ * @param handleMap the shared handle of each local handle, see 
+ *        mergeProteinPool
+ */
+void PSMDescription::remapProteinIds(
+    const std::vector<unsigned int>& handleMap) {
+  std::vector<unsigned int>::iterator it = proteinIds_.begin();
+  for ( ; it != proteinIds_.end(); ++it) {
+    *it = handleMap[*it];
   }
 }
@@ -22,6 +22,7 @@
 #include <iostream>
 
 #include "Enzyme.h"
+#include "StringPool.h"
 
 /*
 * PSMDescription
@@ -40,7 +41,7 @@ class PSMDescription {
   static void deletePtr(PSMDescription* psm);
   virtual void deleteRetentionFeatures() {}
   
-  void clear() { proteinIds.clear(); }
+  void clear() { proteinIds_.clear(); }
   double* getFeatures() { return features; }
   
   // TODO: move these static functions somewhere else
@@ -56,6 +57,11 @@ class PSMDescription {
   }
   
   std::string getPeptideSequence() { return peptide.substr(2, peptide.size()-4); }
+  // compares the peptide sequences without flanks, without copying them
+  bool hasSamePeptideSequence(const PSMDescription& other) const {
+    return peptide.compare(2, peptide.size() - 4, other.peptide, 2, 
+                           other.peptide.size() - 4) == 0;
+  }
   std::string& getFullPeptideSequence() { return peptide; }
   std::string getFlankN() { return peptide.substr(0, 1); }    
   std::string getFlankC() { return peptide.substr(peptide.size()-1, peptide.size()); }  
@@ -64,6 +70,24 @@ class PSMDescription {
   friend std::ostream& operator<<(std::ostream& out, PSMDescription& psm);
   void printProteins(std::ostream& out);
   
+  // the protein ids are interned in a pool shared by all PSMs, which is not
+  // thread safe. Concurrent parsers intern into local pools instead and 
+  // merge those into the shared pool afterwards, see SetHandler::parseChunk
+  void addProteinId(const std::string& proteinId);
+  void addProteinId(const std::string& proteinId, StringPool& localPool);
+  void remapProteinIds(const std::vector<unsigned int>& handleMap);
+  static void mergeProteinPool(const StringPool& localPool, 
+                               std::vector<unsigned int>& handleMap) {
+    proteinPool_.merge(localPool, handleMap);
+  }
+  inline size_t getNumProteins() const { return proteinIds_.size(); }
+  inline const std::string& getProteinId(size_t ix) const {
+    return proteinPool_.get(proteinIds_[ix]);
+  }
+  inline void shrinkProteinIds() {
+    std::vector<unsigned int>(proteinIds_).swap(proteinIds_);
+  }
+  
   bool operator<(const PSMDescription& other) const {
     return (peptide < other.peptide) || 
            (peptide == other.peptide && getRetentionTime() < other.getRetentionTime());
@@ -121,7 +145,10 @@ class PSMDescription {
   unsigned int scan;
   std::string id_;
   std::string peptide;
-  std::vector<std::string> proteinIds;
+  
+ protected:
+  static StringPool proteinPool_;
+  std::vector<unsigned int> proteinIds_; // handles into proteinPool_
 };
 
 inline std::ostream& operator<<(std::ostream& out, PSMDescription& psm) {
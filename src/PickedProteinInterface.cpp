@@ -163,8 +163,8 @@ void PickedProteinInterface::groupProteins(Scores& peptideScores) {
     
     if (peptideIt->p > maxPeptidePval_) continue;
     
-    for (std::vector<std::string>::iterator protIt = peptideIt->pPSM->proteinIds.begin(); 
-            protIt != peptideIt->pPSM->proteinIds.end(); protIt++) {
+    for (size_t protIx = 0; protIx < peptideIt->pPSM->getNumProteins(); ++protIx) {
+      const std::string* protIt = &peptideIt->pPSM->getProteinId(protIx);
       std::string proteinId = *protIt;
       
       if (fragment_map.find(proteinId) != fragment_map.end()) {
@@ -37,6 +37,7 @@ using namespace std;
 #include "PosteriorEstimator.h"
 #include "Transform.h"
 #include "Globals.h"
+#include "StreamingScores.h"
 
 static unsigned int noIntervals = 500;
 static unsigned int numLambda = 100;
@@ -47,6 +48,7 @@ bool PosteriorEstimator::pvalInput = false;
 bool PosteriorEstimator::competition = false;
 bool PosteriorEstimator::includeNegativesInResult = false;
 bool PosteriorEstimator::usePi0_ = true;
+bool PosteriorEstimator::parallelBootstrap_ = false;
 
 pair<double, bool> make_my_pair(double d, bool b) {
   return make_pair(d, b);
@@ -290,48 +292,41 @@ void PosteriorEstimator::finishStandaloneGeneralized(
 	}
 }
 
+// number of bins the scores are divided into for PEP estimation
+unsigned int PosteriorEstimator::getNumBins() {
+  return noIntervals;
+}
+
 /*
  * If pi0 == 1.0 this is equal to the "traditional" binning
  */
 void PosteriorEstimator::binData(const vector<pair<double, bool> >& combined,
     double pi0, vector<double>& medians, vector<double> & negatives,
     vector<double> & sizes) {
-  std::vector<double> h_w_le_z, h_z_le_z; // N_{w<=z} and N_{z<=z}
-  getMixMaxCounts(combined, h_w_le_z, h_z_le_z);
-  
-  double estPx_lt_zj = 0.0;
-  double E_f1_mod_run_tot = 0.0;
+  size_t numDecoys = 0u;
+  if (pi0 < 1.0) {
+    numDecoys = count_if(combined.begin(), combined.end(), IsDecoy());
+  }
+  MixMaxCounter counter(pi0, combined.size() - numDecoys, numDecoys);
   
   int binsLeft = noIntervals - 1;
   double targetedBinSize = max(combined.size() / (double)(noIntervals), 1.0);
   
   std::vector<pair<double, bool> >::const_iterator myPair = combined.begin();
-  int n_z_ge_w = 0, sum_n_z_ge_w = 0; // N_{z>=w} in bin and total
-  int decoyQueue = 0, psmsInBin = 0, binStartIdx = 0;
+  int psmsInBin = 0, binStartIdx = 0;
   for (; myPair != combined.end(); ++myPair) {
-    if (!(myPair->second)) { // decoy PSM
-      ++n_z_ge_w;
-      ++decoyQueue;
-    }
+    counter.add(myPair->second);
     ++psmsInBin;
     
     // handles ties
     if (myPair+1 == combined.end() || myPair->first != (myPair+1)->first) {
-      if (pi0 < 1.0 && decoyQueue > 0) {
-        int j = h_w_le_z.size() - sum_n_z_ge_w - n_z_ge_w;
-        int cnt_w = h_w_le_z.at(j);
-        int cnt_z = h_z_le_z.at(j);
-        estPx_lt_zj = (double)(cnt_w - pi0*cnt_z) / ((1.0 - pi0)*cnt_z);
-        estPx_lt_zj = estPx_lt_zj > 1 ? 1 : estPx_lt_zj;
-        estPx_lt_zj = estPx_lt_zj < 0 ? 0 : estPx_lt_zj;
-        E_f1_mod_run_tot += decoyQueue * estPx_lt_zj * (1.0 - pi0);
-      }
-      decoyQueue = 0;
+      counter.closeGroup();
       
       if (combined.size() - binStartIdx - psmsInBin <= binsLeft * targetedBinSize) {
         double median = combined.at(binStartIdx + psmsInBin / 2).first;
-        double numNegatives = n_z_ge_w * pi0 + E_f1_mod_run_tot;
-        double numPsmsCorrected = psmsInBin - n_z_ge_w + numNegatives;
+        double numNegatives = counter.getBinNegatives();
+        double numPsmsCorrected = psmsInBin - (double)counter.getBinDecoys() 
+                                  + numNegatives;
         
         if (medians.size() > 0 && *(medians.rbegin()) == median) {
           *(negatives.rbegin()) += numNegatives;
@@ -345,43 +340,15 @@ void PosteriorEstimator::binData(const vector<pair<double, bool> >& combined,
         if (VERB > 4) {
           std::cerr << "Median = " << median << ", Num psms = " << psmsInBin 
                     << ", Num psms corrected = " << numPsmsCorrected
-                    << ", Num decoys = " << n_z_ge_w 
+                    << ", Num decoys = " << counter.getBinDecoys() 
                     << ", Num negatives = " << numNegatives << std::endl;
         }
         binStartIdx += psmsInBin;
         --binsLeft;
         
         psmsInBin = 0;
-        E_f1_mod_run_tot = 0.0;
-        sum_n_z_ge_w += n_z_ge_w;
-        n_z_ge_w = 0;
-      }
-    }
-  }
-}
-
-/**
- * Assumes that scores are sorted in descending order
- */
-void PosteriorEstimator::getMixMaxCounts(const vector<pair<double, bool> >& combined,
-    std::vector<double>& h_w_le_z, std::vector<double>& h_z_le_z) {
-  int cnt_z = 0, cnt_w = 0, queue = 0;
-  std::vector<pair<double, bool> >::const_reverse_iterator myPairRev = combined.rbegin();
-  for ( ; myPairRev != combined.rend(); ++myPairRev) {
-    if (myPairRev->second) {
-      ++cnt_w; // target PSM
-    } else {
-      ++cnt_z; // decoy PSM
-      ++queue;
-    }
-    
-    // handles ties
-    if (myPairRev+1 == combined.rend() || myPairRev->first != (myPairRev+1)->first) {
-      for (int i = 0; i < queue; ++i) {
-        h_w_le_z.push_back(static_cast<double>(cnt_w));
-        h_z_le_z.push_back(static_cast<double>(cnt_z));
+        counter.startBin();
       }
-      queue = 0;
     }
   }
 }
@@ -398,54 +365,35 @@ void PosteriorEstimator::getMixMaxCounts(const vector<pair<double, bool> >& comb
 void PosteriorEstimator::getQValues(double pi0, 
     const vector<pair<double, bool> >& combined, vector<double>& q,
     bool skipDecoysPlusOne) {
-  std::vector<double> h_w_le_z, h_z_le_z; // N_{w<=z} and N_{z<=z}
+  size_t numDecoys = 0u;
   if (pi0 < 1.0) {
-    getMixMaxCounts(combined, h_w_le_z, h_z_le_z);
+    numDecoys = count_if(combined.begin(), combined.end(), IsDecoy());
   }
-
-  double estPx_lt_zj = 0.0;
-  double E_f1_mod_run_tot = 0.0;
-  double fdr = 0.0;
-
-  int n_z_ge_w = 1, n_w_ge_w = 0; // N_{z>=w} and N_{w>=w}
-  if (skipDecoysPlusOne) n_z_ge_w = 0;
+  MixMaxCounter counter(pi0, combined.size() - numDecoys, numDecoys,
+                        skipDecoysPlusOne);
+  q.reserve(q.size() + combined.size());
   
   std::vector<pair<double, bool> >::const_iterator myPair = combined.begin();
-  int decoyQueue = 0, targetQueue = 0; // handles ties
   for ( ; myPair != combined.end(); ++myPair) {
-    if (myPair->second) { 
-      ++n_w_ge_w; // target PSM
-      ++targetQueue;
-    } else {
-      ++n_z_ge_w; // decoy PSM
-      ++decoyQueue;
-    }
+    counter.add(myPair->second);
     
     // handles ties
     if (myPair+1 == combined.end() || myPair->first != (myPair+1)->first) {
-      if (pi0 < 1.0 && decoyQueue > 0) {
-        int j = h_w_le_z.size() - (n_z_ge_w - 1);
-        int cnt_w = h_w_le_z.at(j);
-        int cnt_z = h_z_le_z.at(j);
-        estPx_lt_zj = (double)(cnt_w - pi0*cnt_z) / ((1.0 - pi0)*cnt_z);
-        estPx_lt_zj = estPx_lt_zj > 1 ? 1 : estPx_lt_zj;
-        estPx_lt_zj = estPx_lt_zj < 0 ? 0 : estPx_lt_zj;
-        E_f1_mod_run_tot += decoyQueue * estPx_lt_zj * (1.0 - pi0);
-        if (VERB > 4) {
-          std::cerr << "Mix-max num negatives correction: "
-            << (1.0-pi0) * n_z_ge_w << " vs. " << E_f1_mod_run_tot << std::endl;
-        }
-      }
-      
+      uint64_t groupDecoys = counter.getGroupDecoys();
+      uint64_t numInGroup = counter.getGroupTargets();
       if (includeNegativesInResult) {
-        targetQueue += decoyQueue;
+        numInGroup += groupDecoys;
+      }
+      counter.closeGroup();
+      if (VERB > 4 && pi0 < 1.0 && groupDecoys > 0) {
+        std::cerr << "Mix-max num negatives correction: "
+          << (1.0-pi0) * counter.getNumDecoys() << " vs. " 
+          << counter.getCorrection() << std::endl;
       }
-      fdr = (n_z_ge_w * pi0 + E_f1_mod_run_tot) / (double)((std::max)(1, n_w_ge_w));
-      for (int i = 0; i < targetQueue; ++i) {
+      double fdr = counter.getFdr();
+      for (uint64_t i = 0; i < numInGroup; ++i) {
         q.push_back((std::min)(fdr, 1.0));
       }
-      decoyQueue = 0;
-      targetQueue = 0;
     }
   }
   // Convert the FDRs into q-values.
@@ -477,26 +425,18 @@ void PosteriorEstimator::getQValuesFromPEP(const vector<double>& pep, vector<dou
 void PosteriorEstimator::getPValues(const vector<pair<double, bool> >& combined,
                                     vector<double>& p) {
   // assuming combined sorted in best hit first order
+  MixMaxCounter counter(1.0, 0u, 0u);
   vector<pair<double, bool> >::const_iterator myPair = combined.begin();
-  size_t nDecoys = 1, posSame = 0, negSame = 0;
   for ( ; myPair != combined.end(); ++myPair) {
-    if (myPair->second) { // isTarget
-      ++posSame;
-    } else { // isDecoy
-      ++negSame;
-    }
+    counter.add(myPair->second);
     if (myPair+1 == combined.end() || myPair->first != (myPair+1)->first) {
-      for (size_t ix = 0; ix < posSame; ++ix) {
-        p.push_back(nDecoys + negSame * (ix + 1) / (double)(posSame + 1) );
-      }
-      nDecoys += negSame;
-      negSame = 0;
-      posSame = 0;
+      counter.appendPValues(p);
+      counter.closeGroup();
     }
   }
   // p values sorted in ascending order
   transform(p.begin(), p.end(), p.begin(), 
-            bind2nd(divides<double>(), (double)(nDecoys)));
+            bind2nd(divides<double>(), (double)(counter.getNumDecoys())));
 }
 
 bool PosteriorEstimator::checkSeparation(std::vector<double>& p) {
@@ -538,19 +478,38 @@ double PosteriorEstimator::estimatePi0(vector<double>& p,
         << "and decoy PSMs.\nImpossible to estimate pi0. Terminating.\n";
     return -1;
   }
-  double minPi0 = *min_element(pi0s.begin(), pi0s.end());
   
-  vector<double> pBoot, mse;
-  // Initialize the vector mse with zeroes.
-  fill_n(back_inserter(mse), pi0s.size(), 0.0);
   // Examine which lambda level that is most stable under bootstrap
+  if (parallelBootstrap_) {
+    return selectPi0Parallel(p, lambdas, pi0s, numBoot);
+  }
+  vector<vector<double> > pBoots(numBoot);
   for (unsigned int boot = 0; boot < numBoot; ++boot) {
     // Create an array of bootstrapped p-values, and sort in ascending order.
-    bootstrap<double> (p, pBoot);
-    n = pBoot.size();
+    bootstrap<double> (p, pBoots[boot]);
+  }
+  return selectPi0(lambdas, pi0s, pBoots);
+}
+
+/**
+ * Selects the pi0 estimate of the lambda level that is most stable under 
+ * bootstrap, as measured by the mean squared error of the bootstrapped 
+ * estimates to the smallest pi0 estimate
+ * @param pBoots bootstrapped p-values, each resample in ascending order
+ */
+double PosteriorEstimator::selectPi0(const vector<double>& lambdas,
+    const vector<double>& pi0s, const vector<vector<double> >& pBoots) {
+  double minPi0 = *min_element(pi0s.begin(), pi0s.end());
+  
+  // Initialize the vector mse with zeroes.
+  vector<double> mse(pi0s.size(), 0.0);
+  vector<vector<double> >::const_iterator pBoot = pBoots.begin();
+  for ( ; pBoot != pBoots.end(); ++pBoot) {
+    size_t n = pBoot->size();
     for (unsigned int ix = 0; ix < lambdas.size(); ++ix) {
-      start = lower_bound(pBoot.begin(), pBoot.end(), lambdas[ix]);
-      double Wl = (double)distance(start, pBoot.end());
+      vector<double>::const_iterator start = 
+          lower_bound(pBoot->begin(), pBoot->end(), lambdas[ix]);
+      double Wl = (double)distance(start, pBoot->end());
       double pi0Boot = Wl / n / (1 - lambdas[ix]);
       // Estimated mean-squared error.
       mse[ix] += (pi0Boot - minPi0) * (pi0Boot - minPi0);
@@ -563,7 +522,245 @@ double PosteriorEstimator::estimatePi0(vector<double>& p,
   return pi0;
 }
 
+/**
+ * Position of the ix-th draw of bootstrap resample boot in a list of 
+ * numPValues p-values, from the counter based generator, so that the
+ * resamples can be drawn concurrently and in any order
+ * @param key key of the generator, one number of the shared generator
+ */
+size_t PosteriorEstimator::bootstrapDraw(uint64_t key, unsigned int boot, 
+                                         size_t ix, size_t numPValues) {
+  double u = PseudoRandom::counter_uniform(key, boot, ix);
+  return (std::min)((size_t)(u * numPValues), numPValues - 1u);
+}
+
+/**
+ * Selects pi0 as selectPi0 does, from numBoot bootstrap resamples that are 
+ * evaluated concurrently. The draws come from bootstrapDraw, so the result 
+ * does not depend on the number of threads. As p is sorted, a draw only has 
+ * to be located among the positions of the lambdas in p, so the resamples 
+ * are neither stored nor sorted.
+ * @param p p-values in ascending order
+ */
+double PosteriorEstimator::selectPi0Parallel(const vector<double>& p,
+    const vector<double>& lambdas, const vector<double>& pi0s,
+    unsigned int numBoot) {
+  size_t n = p.size(), numLambdas = lambdas.size();
+  size_t numDraw = min(n, (size_t)1000u);
+  uint64_t key = PseudoRandom::lcg_rand();
+  
+  // index of the first p-value >= lambda, in one merge as both are sorted
+  vector<size_t> cuts(numLambdas);
+  size_t pos = 0u;
+  for (size_t ix = 0; ix < numLambdas; ++ix) {
+    while (pos < n && p[pos] < lambdas[ix]) ++pos;
+    cuts[ix] = pos;
+  }
+  
+  double minPi0 = *min_element(pi0s.begin(), pi0s.end());
+  vector<double> bootMse(numBoot * numLambdas);
+  const int numBoots = static_cast<int>(numBoot);
+#pragma omp parallel for schedule(static)
+  for (int boot = 0; boot < numBoots; ++boot) {
+    // aboveCuts[k] is the number of draws at or after exactly k cuts
+    vector<size_t> aboveCuts(numLambdas + 1u, 0u);
+    for (size_t ix = 0; ix < numDraw; ++ix) {
+      size_t draw = bootstrapDraw(key, boot, ix, n);
+      ++aboveCuts[upper_bound(cuts.begin(), cuts.end(), draw) - cuts.begin()];
+    }
+    size_t Wl = 0u;
+    for (size_t ix = numLambdas; ix-- > 0; ) {
+      Wl += aboveCuts[ix + 1];
+      double pi0Boot = (double)Wl / numDraw / (1 - lambdas[ix]);
+      bootMse[boot * numLambdas + ix] = (pi0Boot - minPi0) * (pi0Boot - minPi0);
+    }
+  }
+  
+  // sum in the order of the resamples, as selectPi0 does
+  vector<double> mse(numLambdas, 0.0);
+  for (unsigned int boot = 0; boot < numBoot; ++boot) {
+    for (size_t ix = 0; ix < numLambdas; ++ix) {
+      mse[ix] += bootMse[boot * numLambdas + ix];
+    }
+  }
+  unsigned int minIx = distance(mse.begin(), 
+                                min_element(mse.begin(), mse.end()));
+  double pi0 = max(min(pi0s[minIx], 1.0), 0.0);
+  return pi0;
+}
+
+/**
+ * @param pi0 estimated fraction of incorrect targets, the mix-max
+ *        correction is only applied if below 1
+ * @param numTargets total number of targets in the list
+ * @param numDecoys total number of decoys in the list
+ * @param skipDecoysPlusOne reproduce getQValues without the extra decoy,
+ *        i.e. reuse the counts of the previous decoy for single-decoy groups
+ */
+MixMaxCounter::MixMaxCounter(double pi0, uint64_t numTargets,
+    uint64_t numDecoys, bool skipDecoysPlusOne) :
+    pi0_(pi0), numTargets_(numTargets), numDecoys_(numDecoys),
+    skipDecoysPlusOne_(skipDecoysPlusOne), correction_(0.0), targetsSeen_(0u),
+    decoysSeen_(0u), binDecoysStart_(0u), targetQueue_(0u), decoyQueue_(0u),
+    lastCnt_w_(-1.0), lastCnt_z_(-1.0) {}
+
+void MixMaxCounter::appendPValues(std::vector<double>& p) const {
+  double decoysAbove = (double)(decoysSeen_ - decoyQueue_ + 1u);
+  for (uint64_t ix = 0; ix < targetQueue_; ++ix) {
+    p.push_back(decoysAbove + decoyQueue_ * (ix + 1) / 
+                (double)(targetQueue_ + 1));
+  }
+}
+
+void MixMaxCounter::closeGroup() {
+  if (pi0_ < 1.0 && decoyQueue_ > 0) {
+    double cnt_w = (double)(numTargets_ - (targetsSeen_ - targetQueue_));
+    double cnt_z = (double)(numDecoys_ - (decoysSeen_ - decoyQueue_));
+    // without the extra decoy, getQValues has always looked up the counts of
+    // the previous decoy, which is in an earlier group if this group has 
+    // only one decoy
+    if (skipDecoysPlusOne_ && decoyQueue_ == 1 && lastCnt_z_ >= 0.0) {
+      std::swap(cnt_w, lastCnt_w_);
+      std::swap(cnt_z, lastCnt_z_);
+    } else {
+      lastCnt_w_ = cnt_w;
+      lastCnt_z_ = cnt_z;
+    }
+    double estPx_lt_zj = (cnt_w - pi0_*cnt_z) / ((1.0 - pi0_)*cnt_z);
+    estPx_lt_zj = estPx_lt_zj > 1 ? 1 : estPx_lt_zj;
+    estPx_lt_zj = estPx_lt_zj < 0 ? 0 : estPx_lt_zj;
+    correction_ += decoyQueue_ * estPx_lt_zj * (1.0 - pi0_);
+  }
+  targetQueue_ = 0u;
+  decoyQueue_ = 0u;
+}
+
+/**
+ * @param numPValues number of p-values that will be added
+ * @param numBoot number of bootstrap resamples, drawn here with the same
+ *        random numbers as PosteriorEstimator::estimatePi0 would use
+ */
+Pi0Accumulator::Pi0Accumulator(size_t numPValues, unsigned int numBoot) :
+    numPValues_(numPValues), numAdded_(0u), nextLambda_(0u), nextDraw_(0u),
+    pBoots_(numBoot) {
+  for (unsigned int ix = 0; ix <= numLambda; ++ix) {
+    lambdas_.push_back(((ix + 1) / (double)numLambda) * maxLambda);
+  }
+  numBelowLambda_.resize(lambdas_.size(), numPValues_);
+  
+  double n = numPValues_;
+  size_t numDraw = min(numPValues_, (size_t)1000u);
+  bool parallel = PosteriorEstimator::getParallelBootstrap();
+  uint64_t key = (parallel && numBoot > 0) ? PseudoRandom::lcg_rand() : 0u;
+  for (unsigned int boot = 0; boot < numBoot; ++boot) {
+    for (size_t ix = 0; ix < numDraw; ++ix) {
+      size_t draw;
+      if (parallel) {
+        draw = PosteriorEstimator::bootstrapDraw(key, boot, ix, numPValues_);
+      } else {
+        draw = (size_t)((double)PseudoRandom::lcg_rand() / ((double)PseudoRandom::kRandMax + (double)1) * n);
+      }
+      draws_.push_back(std::make_pair(draw, boot));
+    }
+  }
+  sort(draws_.begin(), draws_.end());
+}
+
+/**
+ * Adds the next p-value, p-values have to be added in ascending order
+ */
+void Pi0Accumulator::add(double p) {
+  assert(numAdded_ < numPValues_);
+  for ( ; nextLambda_ < lambdas_.size() && lambdas_[nextLambda_] <= p; 
+        ++nextLambda_) {
+    numBelowLambda_[nextLambda_] = numAdded_;
+  }
+  for ( ; nextDraw_ < draws_.size() && draws_[nextDraw_].first == numAdded_;
+        ++nextDraw_) {
+    pBoots_[draws_[nextDraw_].second].push_back(p);
+  }
+  ++numAdded_;
+}
+
+// equals PosteriorEstimator::checkSeparation on the added p-values
+bool Pi0Accumulator::checkSeparation() const {
+  assert(numAdded_ == numPValues_);
+  return (numBelowLambda_.front() == numPValues_);
+}
+
+// equals PosteriorEstimator::estimatePi0 on the added p-values
+double Pi0Accumulator::estimatePi0() const {
+  assert(numAdded_ == numPValues_);
+  vector<double> lambdas, pi0s;
+  double n = numPValues_;
+  for (size_t ix = 0; ix < lambdas_.size(); ++ix) {
+    double Wl = (double)(numPValues_ - numBelowLambda_[ix]);
+    double pi0 = Wl / n / (1 - lambdas_[ix]);
+    if (pi0 > 0.0) {
+      lambdas.push_back(lambdas_[ix]);
+      pi0s.push_back(pi0);
+    }
+  }
+  if (pi0s.size() == 0) {
+    cerr << "Error in the input data: too good separation between target "
+        << "and decoy PSMs.\nImpossible to estimate pi0. Terminating.\n";
+    return -1;
+  }
+  return PosteriorEstimator::selectPi0(lambdas, pi0s, pBoots_);
+}
+
+/**
+ * Calculates the q-values and PEPs out of core with StreamingScores: the
+ * scores are sorted in runs that are merged on disk, and only the binned
+ * scores are kept in memory for the PEP estimation. Presorted input files
+ * make the sorting of the runs cheap.
+ */
+int PosteriorEstimator::runStreaming() {
+  StreamingScores streamingScores(usePi0_, streamTempDir);
+  streamingScores.setTargetsOnly(!includeNegativesInResult);
+  // lower scores are better if reversed, so the scores are negated to keep
+  // them sorted best first
+  double scoreSign = (reversed ? -1.0 : 1.0);
+  ifstream target(targetFile.c_str(), ios::in), decoy(decoyFile.c_str(),
+                                                      ios::in);
+  double score;
+  uint64_t ref = 0u;
+  while (target >> score) {
+    streamingScores.addScore(scoreSign * score, false, ref++);
+  }
+  while (decoy >> score) {
+    streamingScores.addScore(scoreSign * score, true, ref++);
+  }
+  if (VERB > 0) {
+    cerr << "Read " << streamingScores.posSize() << " target scores and "
+      << streamingScores.negSize() << " decoy scores" << endl;
+  }
+  if (reversed && VERB > 0) {
+    cerr << "Reversing all scores" << endl;
+  }
+  
+  streamingScores.postMergeStep();
+  if (usePi0_ && VERB > 1) {
+    std::cerr << "Selecting pi_0=" << streamingScores.getPi0() << std::endl;
+  }
+  streamingScores.calcQ(0.0);
+  streamingScores.calcPep();
+  
+  if (resultFileName.empty()) {
+    streamingScores.printScoreTable(includeNegativesInResult, scoreSign);
+  } else {
+    ofstream resultstream(resultFileName.c_str());
+    streamingScores.printScoreTable(includeNegativesInResult, scoreSign,
+                                    resultstream);
+    resultstream.close();
+  }
+  return true;
+}
+
 int PosteriorEstimator::run() {
+  if (streamScores) {
+    return runStreaming();
+  }
   ifstream target(targetFile.c_str(), ios::in), decoy(decoyFile.c_str(),
                                                       ios::in);
   istream_iterator<double> tarIt(target), decIt(decoy);
@@ -691,6 +888,10 @@ bool PosteriorEstimator::parseOptions(int argc, char** argv) {
                    "epsilon-cross-validation",
                    "The relative crossvalidation step size used as treshhold before ending the iterations",
                    "value");
+  cmd.defineOption("b",
+                   "alpha-batch",
+                   "Number of roughness penalties evaluated concurrently in each step of the spline fit. Default is 0, a sequential search.",
+                   "value");
   cmd.defineOption("r",
                    "reverse",
                    "Indicating that the scoring mechanism is reversed, i.e., that low scores are better than higher scores",
@@ -710,6 +911,20 @@ bool PosteriorEstimator::parseOptions(int argc, char** argv) {
                    "Turns off the pi0 correction for search results from a concatenated database.",
                    "",
                    TRUE_IF_SET);
+  cmd.defineOption("S",
+                   "stream",
+                   "Sort the scores on disk and keep only the binned scores in memory, for inputs too large to hold in memory. Presorted inputs are processed fastest. Not available for p-value input or with -g",
+                   "",
+                   TRUE_IF_SET);
+  cmd.defineOption("T",
+                   "stream-temp-dir",
+                   "Directory for the temporary files of -S. Default is $TMPDIR or /tmp",
+                   "directory");
+  cmd.defineOption("P",
+                   "parallel-bootstrap",
+                   "Draw the bootstrap resamples of the pi0 estimate concurrently, from a counter based random number generator. The estimate does not depend on the number of threads, but can differ slightly from the default sequential one",
+                   "",
+                   TRUE_IF_SET);
   cmd.defineOption("d",
                    "include-negative",
                    "Include negative hits (decoy) probabilities in the results",
@@ -729,6 +944,9 @@ bool PosteriorEstimator::parseOptions(int argc, char** argv) {
   if (cmd.optionSet("epsilon-step")) {
     BaseSpline::stepEpsilon = cmd.getDouble("epsilon-step", 0.0, 1.0);
   }
+  if (cmd.optionSet("alpha-batch")) {
+    BaseSpline::alphaBatchSize = cmd.getInt("alpha-batch", 0, 1000);
+  }
   if (cmd.optionSet("output-file")) {
     resultFileName = cmd.options["output-file"];
   }
@@ -744,6 +962,15 @@ bool PosteriorEstimator::parseOptions(int argc, char** argv) {
   if (cmd.optionSet("include-negative")) {
     PosteriorEstimator::setNegative(true);
   }
+  if (cmd.optionSet("parallel-bootstrap")) {
+    PosteriorEstimator::setParallelBootstrap(true);
+  }
+  if (cmd.optionSet("stream")) {
+    streamScores = true;
+  }
+  if (cmd.optionSet("stream-temp-dir")) {
+    streamTempDir = cmd.options["stream-temp-dir"];
+  }
   if (cmd.arguments.size() > 2) {
     cerr << "Too many arguments given" << endl;
     cmd.help();
@@ -759,6 +986,11 @@ bool PosteriorEstimator::parseOptions(int argc, char** argv) {
     PosteriorEstimator::setReversed(true);
     pvalInput = true;
   }
+  if (streamScores && (pvalInput || competition)) {
+    cerr << "Error: -S is not available for p-value input or together with -g."
+         << "\nInvoke with -h option for help\n";
+    return false;
+  }
   return true;
 }
 
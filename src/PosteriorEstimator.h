@@ -20,6 +20,7 @@
 #include <vector>
 #include <string>
 #include <utility>
+#include <algorithm>
 #include <cfloat>
 
 #include "LogisticRegression.h"
@@ -27,7 +28,7 @@
 
 class PosteriorEstimator {
  public:
-  PosteriorEstimator(){};
+  PosteriorEstimator() : streamScores(false) {};
   virtual ~PosteriorEstimator(){};
   bool parseOptions(int argc, char** argv);
   string greeter();
@@ -63,19 +64,30 @@ class PosteriorEstimator {
   static void setUsePi0(bool usePi0) {
     usePi0_ = usePi0;
   }
+  static void setParallelBootstrap(bool parallel) {
+    parallelBootstrap_ = parallel;
+  }
+  static inline bool getParallelBootstrap() { return parallelBootstrap_; }
+  static size_t bootstrapDraw(uint64_t key, unsigned int boot, size_t ix,
+                              size_t numPValues);
+  static unsigned int getNumBins();
+  static double selectPi0(const std::vector<double>& lambdas,
+                          const std::vector<double>& pi0s,
+                          const std::vector<std::vector<double> >& pBoots);
  protected:
   void finishStandalone(std::vector<std::pair<double, bool> >& combined,
                         const std::vector<double>& peps,
                         const std::vector<double>& p, double pi0);
   void finishStandaloneGeneralized(std::vector<std::pair<double, bool> >& combined,
                         const std::vector<double>& peps);
-
-  static void getMixMaxCounts(const std::vector<std::pair<double, bool> >& combined,
-                       std::vector<double>& h_w_le_z,
-                       std::vector<double>& h_z_le_z);
+  int runStreaming();
 
   static void estimate(std::vector<std::pair<double, bool> >& combined,
                        LogisticRegression& lr, bool usePi0, double pi0);
+  static double selectPi0Parallel(const std::vector<double>& p,
+                                  const std::vector<double>& lambdas,
+                                  const std::vector<double>& pi0s,
+                                  unsigned int numBoot);
   static void binData(const std::vector<std::pair<double, bool> >& combined,
                       double pi0, std::vector<double>& medians,
                       std::vector<double>& negatives,
@@ -84,7 +96,96 @@ class PosteriorEstimator {
   // used for standalone execution
   std::string targetFile, decoyFile;
   static bool reversed, pvalInput, competition, includeNegativesInResult, usePi0_;
+  static bool parallelBootstrap_;
   std::string resultFileName;
+  bool streamScores;
+  std::string streamTempDir;
+};
+
+/*
+* MixMaxCounter collects the statistics of the mix-max method over a list of
+* scores in descending order, one group of tied scores at a time, in the
+* single pass that also calculates the FDRs, the PEP bins or the p-values.
+* The counts N_{w<=z} and N_{z<=z} of a group follow from the total number
+* of targets and decoys, so no count vectors have to be built in a separate
+* pass over the list.
+*/
+class MixMaxCounter {
+ public:
+  MixMaxCounter(double pi0, uint64_t numTargets, uint64_t numDecoys,
+                bool skipDecoysPlusOne = false);
+
+  inline void add(bool isTarget) {
+    if (isTarget) {
+      ++targetsSeen_;
+      ++targetQueue_;
+    } else {
+      ++decoysSeen_;
+      ++decoyQueue_;
+    }
+  }
+  // appends the unnormalized p-values of the targets of the current group,
+  // as PosteriorEstimator::getPValues does, to be divided by numDecoys + 1
+  void appendPValues(std::vector<double>& p) const;
+  // ends the current group of tied scores and adds its mix-max correction
+  void closeGroup();
+  // starts a new bin, the decoys and the correction are counted per bin
+  inline void startBin() {
+    binDecoysStart_ = decoysSeen_;
+    correction_ = 0.0;
+  }
+
+  // FDR of all closed groups, as in PosteriorEstimator::getQValues
+  inline double getFdr() const {
+    return (getNumDecoys() * pi0_ + correction_) /
+        (double)((std::max)((uint64_t)1u, targetsSeen_));
+  }
+  // expected number of incorrect PSMs in the current bin
+  inline double getBinNegatives() const {
+    return getBinDecoys() * pi0_ + correction_;
+  }
+  inline double getCorrection() const { return correction_; }
+  // N_{z>=w}, including the extra decoy unless skipDecoysPlusOne is set
+  inline uint64_t getNumDecoys() const {
+    return decoysSeen_ + (skipDecoysPlusOne_ ? 0u : 1u);
+  }
+  inline uint64_t getBinDecoys() const { return decoysSeen_ - binDecoysStart_; }
+  inline uint64_t getGroupTargets() const { return targetQueue_; }
+  inline uint64_t getGroupDecoys() const { return decoyQueue_; }
+
+ protected:
+  double pi0_;
+  uint64_t numTargets_, numDecoys_;
+  bool skipDecoysPlusOne_;
+  double correction_; // E_f1_mod_run_tot
+  uint64_t targetsSeen_, decoysSeen_, binDecoysStart_;
+  uint64_t targetQueue_, decoyQueue_; // handles ties
+  // counts of the last group with decoys, see closeGroup
+  double lastCnt_w_, lastCnt_z_;
+};
+
+/*
+* Pi0Accumulator collects what estimatePi0 and checkSeparation need from a
+* list of p-values that is seen only once, in ascending order, without 
+* storing it: the number of p-values below each lambda and the bootstrap
+* resamples, which are drawn upfront as ranks into the list, with the same
+* random numbers as estimatePi0.
+*/
+class Pi0Accumulator {
+ public:
+  Pi0Accumulator(size_t numPValues, unsigned int numBoot = 100);
+  void add(double p);
+  bool checkSeparation() const;
+  double estimatePi0() const;
+ protected:
+  size_t numPValues_, numAdded_;
+  std::vector<double> lambdas_;
+  std::vector<size_t> numBelowLambda_;
+  size_t nextLambda_;
+  // (rank, resample) of all bootstrap draws, sorted by rank
+  std::vector<std::pair<size_t, unsigned int> > draws_;
+  size_t nextDraw_;
+  std::vector<std::vector<double> > pBoots_;
 };
 
 #endif /*POSTERIORESTIMATOR_H_*/
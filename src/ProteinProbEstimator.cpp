@@ -214,7 +214,7 @@ double ProteinProbEstimator::estimatePi0(const unsigned int numBoot) {
       throw MyException(oss.str() + "Terminating.\n");
     }
   } else if (usePi0_) {
-    pi0 = PosteriorEstimator::estimatePi0(pvalues);
+    pi0 = PosteriorEstimator::estimatePi0(pvalues, numBoot);
   }
   return pi0;
 }
@@ -309,8 +309,8 @@ void ProteinProbEstimator::setTargetandDecoysNames(Scores& peptideScores) {
   std::vector<ScoreHolder>::iterator psm = peptideScores.begin();
   for (; psm!= peptideScores.end(); ++psm) {
     // for each protein
-    std::vector<std::string>::iterator protIt = psm->pPSM->proteinIds.begin();
-    for (; protIt != psm->pPSM->proteinIds.end(); protIt++) {
+    for (size_t protIx = 0; protIx < psm->pPSM->getNumProteins(); ++protIx) {
+      const std::string* protIt = &psm->pPSM->getProteinId(protIx);
       ProteinScoreHolder::Peptide peptide(psm->pPSM->getPeptideSequence(), 
           psm->isDecoy(), psm->p, psm->pep, psm->q, psm->score);
       if (proteinToIdxMap_.find(*protIt) == proteinToIdxMap_.end()) {
@@ -351,9 +351,9 @@ void ProteinProbEstimator::addSpectralCounts(Scores& peptideScores) {
   std::vector<ScoreHolder>::iterator psm = peptideScores.begin();
   for (; psm!= peptideScores.end(); ++psm) {
     // for each protein
-    std::vector<std::string>::const_iterator protIt = psm->pPSM->proteinIds.begin();
     std::set<unsigned int> seenProteinIdxs;
-    for (; protIt != psm->pPSM->proteinIds.end(); protIt++) {
+    for (size_t protIx = 0; protIx < psm->pPSM->getNumProteins(); ++protIx) {
+      const std::string* protIt = &psm->pPSM->getProteinId(protIx);
       if (proteinToIdxMap_.find(*protIt) != proteinToIdxMap_.end()) {
         unsigned int proteinIdx = proteinToIdxMap_[*protIt];
         if (seenProteinIdxs.find(proteinIdx) == seenProteinIdxs.end()) {
@@ -25,3 +25,23 @@ unsigned long PseudoRandom::lcg_rand() {
   seed_ = (seed_ * 279470273u) % 4294967291u;
   return seed_;
 }
+
+namespace {
+
+// finalizer of the SplitMix64 generator
+inline uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * static_cast<uint64_t>(0xBF58476D1CE4E5B9ull);
+  z = (z ^ (z >> 27)) * static_cast<uint64_t>(0x94D049BB133111EBull);
+  return z ^ (z >> 31);
+}
+
+} // namespace
+
+double PseudoRandom::counter_uniform(uint64_t key, uint64_t stream,
+                                     uint64_t counter) {
+  const uint64_t kGolden = static_cast<uint64_t>(0x9E3779B97F4A7C15ull);
+  uint64_t z = mix64(key + mix64(stream * kGolden + kGolden));
+  z = mix64(z + (counter + 1u) * kGolden);
+  // the upper 53 bits fill the mantissa of a double
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -32,6 +32,10 @@ class PseudoRandom {
   inline static void setSeed(unsigned long s) { seed_ = s; }
   static unsigned long lcg_rand();
   const static uint64_t kRandMax = 4294967291u;
+  // counter based generator without state: the counter-th number of a
+  // stream, uniform in [0,1), so that streams can be drawn concurrently
+  static double counter_uniform(uint64_t key, uint64_t stream,
+                                uint64_t counter);
  protected:
   static uint64_t seed_;
 };
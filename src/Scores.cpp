@@ -28,6 +28,7 @@
 #include <string>
 #include <cmath>
 #include <memory>
+#include <cstring>
 
 #include "DataSet.h"
 #include "Normalizer.h"
@@ -42,6 +43,166 @@
 #include "app/PercolatorAdapter.h"
 #endif
 
+namespace {
+
+inline uint64_t descendingScoreKey(double score) {
+  if (score == 0.0) score = 0.0; // -0.0 and 0.0 are equal scores
+  uint64_t bits;
+  memcpy(&bits, &score, sizeof(bits));
+  const uint64_t kSignBit = static_cast<uint64_t>(1u) << 63;
+  // ascending order: flip all bits of negatives, only the sign of positives
+  bits = (bits & kSignBit) ? ~bits : (bits | kSignBit);
+  return ~bits;
+}
+
+const size_t kRadixBits = 8u;
+const size_t kRadixBuckets = 1u << kRadixBits;
+const size_t kRadixChunkSize = 16384u;
+
+/*
+ * Stable LSD radix sort of keys on the 64 bit sort key, one byte per pass.
+ * The histograms and scatters are computed per chunk of keys in parallel,
+ * passes in which all keys share the same byte are skipped.
+ */
+void radixSort(std::vector<RankKey>& keys, std::vector<RankKey>& buffer,
+               std::vector<size_t>& offsets) {
+  const int numKeys = static_cast<int>(keys.size());
+  const int numChunks = static_cast<int>(
+      (keys.size() + kRadixChunkSize - 1u) / kRadixChunkSize);
+  buffer.resize(keys.size());
+  offsets.resize(numChunks * kRadixBuckets);
+  for (size_t shift = 0; shift < 64u; shift += kRadixBits) {
+    std::fill(offsets.begin(), offsets.end(), 0u);
+  #pragma omp parallel for schedule(static) if (numChunks > 1)
+    for (int chunk = 0; chunk < numChunks; ++chunk) {
+      size_t* counts = &offsets[chunk * kRadixBuckets];
+      int end = (std::min)(numKeys, (chunk + 1) * (int)kRadixChunkSize);
+      for (int i = chunk * kRadixChunkSize; i < end; ++i) {
+        ++counts[(keys[i].key >> shift) & (kRadixBuckets - 1u)];
+      }
+    }
+    
+    // exclusive prefix sum in (bucket, chunk) order keeps the sort stable
+    size_t total = 0u;
+    bool singleBucket = false;
+    for (size_t bucket = 0; bucket < kRadixBuckets; ++bucket) {
+      size_t bucketTotal = total;
+      for (int chunk = 0; chunk < numChunks; ++chunk) {
+        size_t count = offsets[chunk * kRadixBuckets + bucket];
+        offsets[chunk * kRadixBuckets + bucket] = total;
+        total += count;
+      }
+      if (total - bucketTotal == keys.size()) singleBucket = true;
+    }
+    if (singleBucket) continue;
+    
+  #pragma omp parallel for schedule(static) if (numChunks > 1)
+    for (int chunk = 0; chunk < numChunks; ++chunk) {
+      size_t* next = &offsets[chunk * kRadixBuckets];
+      int end = (std::min)(numKeys, (chunk + 1) * (int)kRadixChunkSize);
+      for (int i = chunk * kRadixChunkSize; i < end; ++i) {
+        buffer[next[(keys[i].key >> shift) & (kRadixBuckets - 1u)]++] = keys[i];
+      }
+    }
+    keys.swap(buffer);
+  }
+}
+
+/*
+ * FNV-1a hash of the peptide sequence without flanks and the label, the key 
+ * of the peptide groups of weedOutRedundant
+ */
+inline uint64_t peptideHash(const std::string& peptide, int label) {
+  uint64_t h = 14695981039346656037ULL ^ static_cast<uint64_t>(label + 1);
+  h *= 1099511628211ULL;
+  if (peptide.size() < 2u) return h;
+  size_t len = (std::min)(peptide.size() - 4, peptide.size() - 2);
+  std::string::const_iterator it = peptide.begin() + 2;
+  for (std::string::const_iterator end = it + len; it != end; ++it) {
+    h ^= static_cast<unsigned char>(*it);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/*
+ * Hash of the spectrum of a PSM, its scan and experimental mass, and its 
+ * label if it is part of the key, mixed by the SplitMix64 finalizer such 
+ * that the top bits can select a partition
+ */
+inline uint64_t spectrumHash(const ScoreHolder& sh, bool byLabel) {
+  uint64_t massBits = 0u;
+  double expMass = sh.pPSM->expMass;
+  if (expMass != 0.0) memcpy(&massBits, &expMass, sizeof(massBits));
+  uint64_t z = massBits ^ (static_cast<uint64_t>(sh.pPSM->scan) << 1);
+  if (byLabel && sh.label > 0) z ^= 1u;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+struct ScoreIndexGreater {
+  const std::vector<ScoreHolder>& scores;
+  explicit ScoreIndexGreater(const std::vector<ScoreHolder>& s) : scores(s) {}
+  bool operator()(unsigned int a, unsigned int b) const {
+    return scores[a].score > scores[b].score;
+  }
+};
+
+/*
+ * Orders the positions of the PSMs of a cross validation set as 
+ * greater<ScoreHolder> orders ScoreHolders, but with the scores that the 
+ * PSMs have in the set rather than those of the ScoreHolders
+ */
+struct MemberGreater {
+  const std::vector<ScoreHolder>& holders;
+  const std::vector<unsigned int>& members;
+  const std::vector<double>& scores;
+  MemberGreater(const std::vector<ScoreHolder>& h, 
+      const std::vector<unsigned int>& m, const std::vector<double>& s) :
+    holders(h), members(m), scores(s) {}
+  bool operator()(unsigned int a, unsigned int b) const {
+    if (scores[a] != scores[b]) return scores[a] > scores[b];
+    const PSMDescription* one = holders[members[a]].pPSM;
+    const PSMDescription* other = holders[members[b]].pPSM;
+    if (one->scan != other->scan) return one->scan > other->scan;
+    if (one->expMass != other->expMass) return one->expMass > other->expMass;
+    return holders[members[a]].label > holders[members[b]].label;
+  }
+  bool operator()(const RankKey& a, const RankKey& b) const {
+    return (*this)(a.index, b.index);
+  }
+};
+
+/*
+ * Applies a comparison of ScoreHolders, e.g. OrderScanLabel, to the 
+ * positions of the PSMs of a cross validation set
+ */
+template<typename Compare>
+struct MemberCompare {
+  const std::vector<ScoreHolder>& holders;
+  const std::vector<unsigned int>& members;
+  Compare compare;
+  MemberCompare(const std::vector<ScoreHolder>& h, 
+      const std::vector<unsigned int>& m) : holders(h), members(m) {}
+  bool operator()(unsigned int a, unsigned int b) const {
+    return compare(holders[members[a]], holders[members[b]]);
+  }
+};
+
+/*
+ * The reverse order of MemberGreater, i.e. as less<ScoreHolder>
+ */
+struct MemberLess {
+  MemberGreater greater;
+  explicit MemberLess(const MemberGreater& g) : greater(g) {}
+  bool operator()(unsigned int a, unsigned int b) const {
+    return greater(b, a);
+  }
+};
+
+} // namespace
+
 inline bool operator>(const ScoreHolder& one, const ScoreHolder& other) {
   return (one.score > other.score) 
       || (one.score == other.score && one.pPSM->scan > other.pPSM->scan) 
@@ -106,9 +267,8 @@ void ScoreHolder::printPSM(ostream& os, bool printDecoys, bool printExpMass) {
       os << "      <peptide_seq n=\"" << n << "\" c=\"" << c << "\" seq=\"" << centpep << "\"/>" << endl;
     }
     
-    std::vector<std::string>::const_iterator pidIt = pPSM->proteinIds.begin();
-    for ( ; pidIt != pPSM->proteinIds.end() ; ++pidIt) {
-      os << "      <protein_id>" << getRidOfUnprintablesAndUnicode(*pidIt) << "</protein_id>" << endl;
+    for (size_t pidIx = 0; pidIx < pPSM->getNumProteins(); ++pidIx) {
+      os << "      <protein_id>" << getRidOfUnprintablesAndUnicode(pPSM->getProteinId(pidIx)) << "</protein_id>" << endl;
     }
     
     os << "      <p_value>" << scientific << p << "</p_value>" <<endl;
@@ -136,17 +296,17 @@ void ScoreHolder::printPeptide(ostream& os, bool printDecoys, bool printExpMass,
     }
     os << "      <calc_mass>" << fixed << setprecision (3)  << pPSM->calcMass << "</calc_mass>" << endl;
     
-    std::vector<std::string>::const_iterator pidIt = pPSM->proteinIds.begin();
-    for ( ; pidIt != pPSM->proteinIds.end() ; ++pidIt) {
-      os << "      <protein_id>" << getRidOfUnprintablesAndUnicode(*pidIt) << "</protein_id>" << endl;
+    for (size_t pidIx = 0; pidIx < pPSM->getNumProteins(); ++pidIx) {
+      os << "      <protein_id>" << getRidOfUnprintablesAndUnicode(pPSM->getProteinId(pidIx)) << "</protein_id>" << endl;
     }
     
     os << "      <p_value>" << scientific << p << "</p_value>" <<endl;
     os << "      <psm_ids>" << endl;
     
     // output all psms that contain the peptide
-    std::vector<PSMDescription*>::const_iterator psmIt = fullset.getPsms(pPSM).begin();
-    for ( ; psmIt != fullset.getPsms(pPSM).end() ; ++psmIt) {
+    std::vector<PSMDescription*>::const_iterator psmIt, psmEnd;
+    fullset.getPsms(pPSM, psmIt, psmEnd);
+    for ( ; psmIt != psmEnd ; ++psmIt) {
       os << "        <psm_id>" << (*psmIt)->getId() << "</psm_id>" << endl;
     }
     os << "      </psm_ids>" << endl;
@@ -154,15 +314,31 @@ void ScoreHolder::printPeptide(ostream& os, bool printDecoys, bool printExpMass,
   }
 }
 
+/**
+ * Replaces the PSMs of this full set by those of the test sets sv, which 
+ * refer to its ScoreHolders, with the scores and q-values of the test sets 
+ * normalized per set
+ */
 void Scores::merge(std::vector<Scores>& sv, double fdr) {
-  scores_.clear();
+  std::vector<ScoreHolder> merged;
+  merged.reserve(scores_.size());
   for (std::vector<Scores>::iterator a = sv.begin(); a != sv.end(); a++) {
-    sort(a->begin(), a->end(), greater<ScoreHolder> ());
-    a->checkSeparationAndSetPi0();
-    a->calcQ(fdr);
-    a->normalizeScores(fdr);
-    copy(a->begin(), a->end(), back_inserter(scores_));
+    Scores testSet(usePi0_);
+    testSet.scores_.reserve(a->numPsms());
+    for (size_t ix = 0; ix < a->numPsms(); ++ix) {
+      testSet.scores_.push_back(a->holderAt(ix));
+      testSet.scores_.back().score = a->scoreAt(ix);
+      testSet.scores_.back().q = a->qAt(ix);
+    }
+    testSet.recalculateSizes();
+    sort(testSet.begin(), testSet.end(), greater<ScoreHolder> ());
+    testSet.checkSeparationAndSetPi0();
+    testSet.calcQ(fdr);
+    testSet.normalizeScores(fdr);
+    copy(testSet.begin(), testSet.end(), back_inserter(merged));
   }
+  scores_.swap(merged);
+  featureMatrix_.clear();
   postMergeStep();
 }
 
@@ -301,6 +477,15 @@ void Scores::fillFeatures(SetHandler& setHandler) {
  * @param train vector containing the training sets of PSMs
  * @param test vector containing the test sets of PSMs
  * @param xval_fold: number of folds in train and test
+ * @param featurePool: if initialized, the feature rows in the pool are
+ *        reordered by fold
+ *
+ * The sets do not get copies of the ScoreHolders or feature matrices of 
+ * their own: they hold the indices of their PSMs in the full set, and a full
+ * set fills its own feature matrix with the rows of all PSMs ordered by test
+ * fold, of which train and test score their row ranges. The sets created 
+ * from a cross validation set, i.e. nested cross validation, refer to the 
+ * PSMs and rows of that set in the same full set.
  */
 void Scores::createXvalSetsBySpectrum(std::vector<Scores>& train, 
     std::vector<Scores>& test, const unsigned int xval_fold, 
@@ -312,29 +497,48 @@ void Scores::createXvalSetsBySpectrum(std::vector<Scores>& train,
   std::vector<int> remain(xval_fold);
   // set values for remain: initially each fold is assigned (tot number of
   // scores_ / tot number of folds)
-  int fold = xval_fold, ix = scores_.size();
+  const size_t numScores = numPsms();
+  int fold = xval_fold, ix = numScores;
   while (fold--) {
     remain[fold] = ix / (fold + 1);
     ix -= remain[fold];
   }
 
-  // store possible spectra with relative scores_
-  multimap<unsigned int,ScoreHolder> spectraScores;
-  // populate spectraScores
-  std::vector<ScoreHolder>::iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    spectraScores.insert(std::make_pair(scoreIt->pPSM->scan, *scoreIt));
+  Scores* root = (fullset_ != NULL) ? fullset_ : this;
+  for (unsigned int i = 0; i < xval_fold; ++i) {
+    test[i].fullset_ = root;
+    test[i].members_.reserve(remain[i]);
+    test[i].memberScores_.reserve(remain[i]);
+    test[i].memberQ_.reserve(remain[i]);
+    train[i].fullset_ = root;
+    train[i].members_.reserve(numScores - remain[i]);
+    train[i].memberScores_.reserve(numScores - remain[i]);
+    train[i].memberQ_.reserve(numScores - remain[i]);
+  }
+
+  // order the PSMs by spectrum, keeping the order of this set within a 
+  // spectrum, by sorting (scan, index) pairs instead of copying the 
+  // ScoreHolders into an ordered container
+  std::vector<std::pair<unsigned int, unsigned int> > spectraScores;
+  spectraScores.reserve(numScores);
+  for (size_t i = 0; i < numScores; ++i) {
+    spectraScores.push_back(std::make_pair(holderAt(i).pPSM->scan, 
+                                           static_cast<unsigned int>(i)));
   }
+  std::sort(spectraScores.begin(), spectraScores.end());
 
   // put scores into the folds; choose a fold (at random) and change it only
   // when scores from a new spectra are encountered
-  // note: this works because multimap is an ordered container!
   unsigned int previousSpectrum = spectraScores.begin()->first;
   size_t randIndex = PseudoRandom::lcg_rand() % xval_fold;
-  for (multimap<unsigned int, ScoreHolder>::iterator it = spectraScores.begin(); 
-        it != spectraScores.end(); ++it) {
-    const unsigned int curScan = (*it).first;
-    const ScoreHolder sh = (*it).second;
+  std::vector<unsigned int> psmFolds;
+  psmFolds.reserve(spectraScores.size());
+  std::vector<std::pair<unsigned int, unsigned int> >::const_iterator it;
+  for (it = spectraScores.begin(); it != spectraScores.end(); ++it) {
+    const unsigned int curScan = it->first;
+    const unsigned int psmIndex = 
+        (fullset_ != NULL) ? members_[it->second] : it->second;
+    const double score = scoreAt(it->second), q = qAt(it->second);
     // if current score is from a different spectra than the one encountered in
     // the previous iteration, choose new fold
     
@@ -348,11 +552,12 @@ void Scores::createXvalSetsBySpectrum(std::vector<Scores>& train,
     // insert
     for (unsigned int i = 0; i < xval_fold; ++i) {
       if (i == randIndex) {
-        test[i].addScoreHolder(sh);
+        test[i].addMember(psmIndex, score, q);
       } else {
-        train[i].addScoreHolder(sh);
+        train[i].addMember(psmIndex, score, q);
       }
     }
+    psmFolds.push_back(static_cast<unsigned int>(randIndex));
     // update number of free position for used fold
     --remain[randIndex];
     // set previous spectrum to current one for next iteration
@@ -375,14 +580,65 @@ void Scores::createXvalSetsBySpectrum(std::vector<Scores>& train,
       test[i].reorderFeatureRows(featurePool, isTarget, movedAddresses, idx);
     }
   }
+  
+  if (fullset_ == NULL) {
+    buildFoldFeatureMatrix(train, test, psmFolds);
+  } else {
+    for (unsigned int i = 0; i < xval_fold; ++i) {
+      train[i].featureRows_ = featureRows_;
+      test[i].featureRows_ = featureRows_;
+    }
+  }
+}
+
+/**
+ * Fills the feature matrix of this full set with the feature rows of the 
+ * test sets, one block aligned row range per fold, records the row of each
+ * PSM in its ScoreHolder, and lets train and test score from it: test set i
+ * uses the rows of fold i, train set i all other rows.
+ * @param psmFolds test fold of each PSM, in the order they were added
+ */
+void Scores::buildFoldFeatureMatrix(std::vector<Scores>& train, 
+    std::vector<Scores>& test, const std::vector<unsigned int>& psmFolds) {
+  size_t numFolds = test.size();
+  std::vector<size_t> foldStart(numFolds + 1, 0u);
+  for (size_t i = 0; i < numFolds; ++i) {
+    foldStart[i + 1] = foldStart[i] + 
+        FeatureMatrix::roundUpToBlock(test[i].members_.size());
+  }
+  featureMatrix_.reset(foldStart[numFolds], FeatureNames::getNumFeatures());
+  
+  // the PSMs were added to the test sets in the order of psmFolds
+  std::vector<size_t> testPos(numFolds, 0u);
+  for (size_t k = 0; k < psmFolds.size(); ++k) {
+    unsigned int fold = psmFolds[k];
+    unsigned int row = static_cast<unsigned int>(foldStart[fold] + testPos[fold]);
+    ScoreHolder& sh = scores_[test[fold].members_[testPos[fold]++]];
+    sh.featureRow = row;
+    featureMatrix_.setRow(row, sh.pPSM->features);
+  }
+  featureMatrix_.setVersion(featureVersion_);
+  
+  for (size_t i = 0; i < numFolds; ++i) {
+    if (foldStart[i + 1] > foldStart[i]) {
+      test[i].featureRows_.push_back(
+          std::make_pair(foldStart[i], foldStart[i] + test[i].members_.size()));
+    }
+    if (foldStart[i] > 0u) {
+      train[i].featureRows_.push_back(std::make_pair(0u, foldStart[i]));
+    }
+    if (foldStart[numFolds] > foldStart[i + 1]) {
+      train[i].featureRows_.push_back(
+          std::make_pair(foldStart[i + 1], foldStart[numFolds]));
+    }
+  }
 }
 
 void Scores::recalculateSizes() {
   totalNumberOfTargets_ = 0;
   totalNumberOfDecoys_ = 0;
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    if (scoreIt->isTarget()) {
+  for (size_t ix = 0; ix < numPsms(); ++ix) {
+    if (holderAt(ix).isTarget()) {
       ++totalNumberOfTargets_;
     } else {
       ++totalNumberOfDecoys_;
@@ -394,16 +650,16 @@ void Scores::recalculateSizes() {
 void Scores::reorderFeatureRows(FeatureMemoryPool& featurePool, 
     bool isTarget, std::map<double*, double*>& movedAddresses, size_t& idx) {
   size_t numFeatures = FeatureNames::getNumFeatures();
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    if (scoreIt->isTarget() == isTarget) {
+  for (size_t ix = 0; ix < numPsms(); ++ix) {
+    const ScoreHolder& sh = holderAt(ix);
+    if (sh.isTarget() == isTarget) {
       double* newAddress = featurePool.addressFromIdx(idx++);
-      double* oldAddress = scoreIt->pPSM->features;
+      double* oldAddress = sh.pPSM->features;
       while (movedAddresses.find(oldAddress) != movedAddresses.end()) {
         oldAddress = movedAddresses[oldAddress];
       }
       std::swap_ranges(oldAddress, oldAddress + numFeatures, newAddress);
-      scoreIt->pPSM->features = newAddress;
+      sh.pPSM->features = newAddress;
       if (oldAddress != newAddress) {
         movedAddresses[newAddress] = oldAddress;
       }
@@ -444,35 +700,191 @@ void Scores::normalizeScores(double fdr) {
 }
 
 /**
- * Calculates the SVM cost/score of each PSM and sorts them
+ * Calculates the SVM cost/score of each PSM of this cross validation set 
+ * and sorts them
  * @param w normal vector used for SVM cost
  * @param fdr FDR threshold specified by user (default 0.01)
  * @return number of true positives
  */
 int Scores::calcScores(std::vector<double>& w, double fdr, bool skipDecoysPlusOne) {
   unsigned int ix;
-  std::vector<ScoreHolder>::iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    scoreIt->score = calcScore(scoreIt->pPSM->features, w);
+  prepareFeatureMatrix();
+  {
+    std::vector<double> rowScores;
+    size_t firstRow = calcRowScores(w, rowScores);
+    for (ix = 0; ix < members_.size(); ++ix) {
+      memberScores_[ix] = rowScores[holderAt(ix).featureRow - firstRow];
+    }
   }
-  sort(scores_.begin(), scores_.end(), greater<ScoreHolder> ());
+  sortByScore();
   if (VERB > 3) {
-    if (scores_.size() >= 10) {
+    if (members_.size() >= 10) {
       cerr << "10 best scores and labels" << endl;
       for (ix = 0; ix < 10; ix++) {
-        cerr << scores_[ix].score << " " << scores_[ix].label << endl;
+        cerr << memberScores_[ix] << " " << holderAt(ix).label << endl;
       }
       cerr << "10 worst scores and labels" << endl;
-      for (ix = scores_.size() - 10; ix < scores_.size(); ix++) {
-        cerr << scores_[ix].score << " " << scores_[ix].label << endl;
+      for (ix = members_.size() - 10; ix < members_.size(); ix++) {
+        cerr << memberScores_[ix] << " " << holderAt(ix).label << endl;
       }
     } else {
-      cerr << "Too few scores to display top and bottom PSMs (" << scores_.size() << " scores found)." << endl;
+      cerr << "Too few scores to display top and bottom PSMs (" << members_.size() << " scores found)." << endl;
     }
   }
   return calcQ(fdr, skipDecoysPlusOne);
 }
 
+int Scores::estimateTruePositives(const std::vector<double>& w, double fdr,
+                                  bool skipDecoysPlusOne) const {
+  ScoreBuffers buffers;
+  return estimateTruePositives(w, fdr, skipDecoysPlusOne, buffers);
+}
+
+/**
+ * Calculates the number of targets below the FDR threshold that calcScores
+ * would return for the weights w, without modifying the scores, order or
+ * q-values of the PSMs, so that several weight vectors can be evaluated 
+ * concurrently, each with its own buffers. prepareFeatureMatrix has to be 
+ * called beforehand.
+ * @param w normal vector used for SVM cost
+ * @param fdr FDR threshold
+ * @param buffers work space, reused between calls
+ * @return number of true positives
+ */
+int Scores::estimateTruePositives(const std::vector<double>& w, double fdr,
+                                  bool skipDecoysPlusOne, 
+                                  ScoreBuffers& buffers) const {
+  const std::vector<double>& rowScores = buffers.rowScores;
+  size_t firstRow = calcRowScores(w, buffers.rowScores);
+  
+  std::vector<RankKey>& keys = buffers.keys;
+  keys.resize(members_.size());
+  for (size_t ix = 0; ix < members_.size(); ++ix) {
+    keys[ix].key = descendingScoreKey(
+        rowScores[holderAt(ix).featureRow - firstRow]);
+    keys[ix].index = static_cast<unsigned int>(ix);
+  }
+  radixSort(keys, buffers.sortBuffer, buffers.radixOffsets);
+  
+  // all PSMs with tied scores get the same q-value, so the order within ties 
+  // does not affect the count and the tie breaking of sortByScore is skipped.
+  // As the q-value is the minimal FDR of the groups at or below a PSM, the 
+  // targets with q < fdr are those down to the last group with FDR < fdr.
+  MixMaxCounter fdrCounter(pi0_, totalNumberOfTargets_, 
+                           totalNumberOfDecoys_, skipDecoysPlusOne);
+  int numPos = 0, targetsSeen = 0;
+  for (size_t ix = 0; ix < keys.size(); ++ix) {
+    const ScoreHolder& sh = holderAt(keys[ix].index);
+    fdrCounter.add(sh.label > 0);
+    if (sh.isTarget()) ++targetsSeen;
+    if (ix + 1 == keys.size() || keys[ix + 1].key != keys[ix].key) {
+      fdrCounter.closeGroup();
+      if ((std::min)(fdrCounter.getFdr(), 1.0) < fdr) numPos = targetsSeen;
+    }
+  }
+  return numPos;
+}
+
+/**
+ * Sorts the PSMs of this cross validation set in the order of 
+ * greater<ScoreHolder> on their scores in the set, using a radix sort on the
+ * scores and a comparison sort only for runs of tied scores. Both sorts are 
+ * stable, equivalent PSMs keep their previous order. The work space is local
+ * and released on return.
+ */
+void Scores::sortByScore() {
+  std::vector<RankKey> keys(members_.size());
+  for (size_t ix = 0; ix < members_.size(); ++ix) {
+    keys[ix].key = descendingScoreKey(memberScores_[ix]);
+    keys[ix].index = static_cast<unsigned int>(ix);
+  }
+  {
+    std::vector<RankKey> sortBuffer;
+    std::vector<size_t> radixOffsets;
+    radixSort(keys, sortBuffer, radixOffsets);
+  }
+  
+  MemberGreater greater(fullset_->scores_, members_, memberScores_);
+  std::vector<RankKey>::iterator runStart = keys.begin();
+  while (runStart != keys.end()) {
+    std::vector<RankKey>::iterator runEnd = runStart + 1;
+    while (runEnd != keys.end() && runEnd->key == runStart->key) ++runEnd;
+    if (runEnd - runStart > 1) {
+      std::stable_sort(runStart, runEnd, greater);
+    }
+    runStart = runEnd;
+  }
+  
+  std::vector<unsigned int> order;
+  order.reserve(keys.size());
+  std::vector<RankKey>::const_iterator keyIt = keys.begin();
+  for ( ; keyIt != keys.end(); ++keyIt) {
+    order.push_back(keyIt->index);
+  }
+  permuteMembers(order);
+}
+
+/**
+ * Reorders the PSMs of this cross validation set such that the PSM at 
+ * position order[ix] is moved to position ix
+ */
+void Scores::permuteMembers(const std::vector<unsigned int>& order) {
+  std::vector<unsigned int> members;
+  std::vector<double> scores, q;
+  members.reserve(order.size());
+  scores.reserve(order.size());
+  q.reserve(order.size());
+  std::vector<unsigned int>::const_iterator it = order.begin();
+  for ( ; it != order.end(); ++it) {
+    members.push_back(members_[*it]);
+    scores.push_back(memberScores_[*it]);
+    q.push_back(memberQ_[*it]);
+  }
+  members_.swap(members);
+  memberScores_.swap(scores);
+  memberQ_.swap(q);
+}
+
+/**
+ * Refreshes the matrix that holds the rows of this set if the features have 
+ * changed since it was filled. The matrix of a full set is shared by its 
+ * cross validation sets, which may call this concurrently, so the versions 
+ * are only read and updated in the same critical section as in 
+ * featuresChanged.
+ */
+void Scores::prepareFeatureMatrix() {
+#pragma omp critical (scores_feature_matrix)
+  {
+    Scores* owner = (fullset_ != NULL) ? fullset_ : this;
+    if (owner->featureMatrix_.getVersion() != owner->featureVersion_) {
+      owner->featureMatrix_.refresh();
+      owner->featureMatrix_.setVersion(owner->featureVersion_);
+    }
+  }
+}
+
+/**
+ * Scores the feature rows of this cross validation set with the weights w
+ * @param rowScores output, the score of a ScoreHolder sh is found at 
+ *        rowScores[sh.featureRow - firstRow]
+ * @return firstRow
+ */
+size_t Scores::calcRowScores(const std::vector<double>& w, 
+                             std::vector<double>& rowScores) const {
+  assert(fullset_ != NULL);
+  if (featureRows_.empty()) return 0u;
+  size_t firstRow = featureRows_.front().first;
+  rowScores.resize(FeatureMatrix::roundUpToBlock(
+      featureRows_.back().second) - firstRow);
+  std::vector<std::pair<size_t, size_t> >::const_iterator rangeIt;
+  for (rangeIt = featureRows_.begin(); rangeIt != featureRows_.end(); 
+       ++rangeIt) {
+    fullset_->featureMatrix_.calcScores(w, rangeIt->first, rangeIt->second,
+        &rowScores[rangeIt->first - firstRow]);
+  }
+  return firstRow;
+}
+
 void Scores::getScoreLabelPairs(std::vector<pair<double, bool> >& combined) {
   combined.clear();
   transform(scores_.begin(), scores_.end(), back_inserter(combined),
@@ -480,29 +892,36 @@ void Scores::getScoreLabelPairs(std::vector<pair<double, bool> >& combined) {
 }
 
 /**
- * Calculates the q-value for each psm in scores_: the q-value is the minimal
- * FDR of any set that includes the particular psm
+ * Calculates the q-value for each psm in this set: the q-value is the minimal
+ * FDR of any set that includes the particular psm. The FDRs of the groups of
+ * tied scores are calculated as in PosteriorEstimator::getQValues in a 
+ * forward pass, and turned into q-values in a backward pass, both in place.
  * @param fdr FDR threshold specified by user (default 0.01)
  * @return number of true positives
  */
 int Scores::calcQ(double fdr, bool skipDecoysPlusOne) {
   assert(totalNumberOfDecoys_+totalNumberOfTargets_==size());
   
-  std::vector<pair<double, bool> > combined;
-  getScoreLabelPairs(combined);
-  
-  std::vector<double> qvals;
-  PosteriorEstimator::setNegative(true); // also get q-values for decoys
-  PosteriorEstimator::getQValues(pi0_, combined, qvals, skipDecoysPlusOne);
-  
-  // set q-values and count number of positives
-  std::vector<double>::const_iterator qIt = qvals.begin();
-  std::vector<ScoreHolder>::iterator scoreIt = scores_.begin();
+  MixMaxCounter fdrCounter(pi0_, totalNumberOfTargets_, 
+                           totalNumberOfDecoys_, skipDecoysPlusOne);
+  size_t groupStart = 0u, n = numPsms();
+  for (size_t ix = 0; ix < n; ++ix) {
+    fdrCounter.add(holderAt(ix).label > 0);
+    if (ix + 1 == n || scoreAt(ix) != scoreAt(ix + 1)) {
+      fdrCounter.closeGroup();
+      double groupFdr = (std::min)(fdrCounter.getFdr(), 1.0);
+      for ( ; groupStart <= ix; ++groupStart) {
+        qAt(groupStart) = groupFdr;
+      }
+    }
+  }
   
+  // convert the FDRs into q-values and count number of positives
   int numPos = 0;
-  for (; qIt != qvals.end(); ++qIt, ++scoreIt) {
-    scoreIt->q = *qIt;
-    if (scoreIt->q < fdr && scoreIt->isTarget()) ++numPos;
+  for (size_t ix = n; ix-- > 0; ) {
+    double& q = qAt(ix);
+    if (ix + 1 < n) q = (std::min)(q, qAt(ix + 1));
+    if (q < fdr && holderAt(ix).isTarget()) ++numPos;
   }
   
   return numPos;
@@ -510,10 +929,10 @@ int Scores::calcQ(double fdr, bool skipDecoysPlusOne) {
 
 void Scores::generateNegativeTrainingSet(AlgIn& data, const double cneg) {
   unsigned int ix2 = 0;
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    if (scoreIt->isDecoy()) {
-      data.vals[ix2] = scoreIt->pPSM->features;
+  for (size_t ix = 0; ix < members_.size(); ++ix) {
+    const ScoreHolder& sh = holderAt(ix);
+    if (sh.isDecoy()) {
+      data.vals[ix2] = sh.pPSM->features;
       data.Y[ix2] = -1;
       data.C[ix2++] = cneg;
     }
@@ -521,22 +940,36 @@ void Scores::generateNegativeTrainingSet(AlgIn& data, const double cneg) {
   data.negatives = ix2;
 }
 
+/**
+ * Adds the targets of this cross validation set with q <= fdr to the SVM 
+ * input, in the order of the set, or with trainBestPositive only one target
+ * per spectrum, in order of score. The set itself is not reordered, the 
+ * positions of its PSMs are sorted instead.
+ */
 void Scores::generatePositiveTrainingSet(AlgIn& data, const double fdr,
     const double cpos, const bool trainBestPositive) {
   unsigned int ix2 = data.negatives, p = 0;
   
-  std::vector<ScoreHolder>::iterator lastUniqueIt = scores_.end();
+  std::vector<unsigned int> order(members_.size());
+  for (size_t ix = 0; ix < order.size(); ++ix) {
+    order[ix] = static_cast<unsigned int>(ix);
+  }
+  std::vector<unsigned int>::iterator lastUniqueIt = order.end();
   if (trainBestPositive) {
-    std::sort(scores_.begin(), scores_.end(), OrderScanLabel());
-    lastUniqueIt = std::unique(scores_.begin(), scores_.end(), UniqueScanLabel());
-    std::sort(scores_.begin(), lastUniqueIt, greater<ScoreHolder> ());
+    std::sort(order.begin(), order.end(), 
+        MemberCompare<OrderScanLabel>(fullset_->scores_, members_));
+    lastUniqueIt = std::unique(order.begin(), order.end(), 
+        MemberCompare<UniqueScanLabel>(fullset_->scores_, members_));
+    std::sort(order.begin(), lastUniqueIt, 
+              MemberGreater(fullset_->scores_, members_, memberScores_));
   }
   
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != lastUniqueIt; ++scoreIt) {
-    if (scoreIt->isTarget()) {
-      if (scoreIt->q <= fdr) {
-        data.vals[ix2] = scoreIt->pPSM->features;
+  std::vector<unsigned int>::const_iterator orderIt = order.begin();
+  for ( ; orderIt != lastUniqueIt; ++orderIt) {
+    const ScoreHolder& sh = holderAt(*orderIt);
+    if (sh.isTarget()) {
+      if (memberQ_[*orderIt] <= fdr) {
+        data.vals[ix2] = sh.pPSM->features;
         data.Y[ix2] = 1;
         data.C[ix2++] = cpos;
         ++p;
@@ -555,65 +988,127 @@ void Scores::weedOutRedundant() {
 
 /**
  * Routine that sees to that only unique peptides are kept (used for analysis
- * on peptide-fdr rather than psm-fdr)
+ * on peptide-fdr rather than psm-fdr). The PSMs are grouped by peptide 
+ * sequence without flanks and label in a hash table, the best scoring PSM of
+ * each group is kept and the PSMs of each group are stored as flat arrays,
+ * see getPsms.
  */
 void Scores::weedOutRedundant(std::map<std::string, unsigned int>& peptideSpecCounts, double specCountQvalThreshold) {
-  // lexicographically order the scores_ (based on peptides names,labels and scores)
-  std::sort(scores_.begin(), scores_.end(), lexicOrderProb());
-  
-  /*
-  * much simpler version but it does not fill up the peptide-PSM map:
-  * scores_.erase(std::unique(scores_.begin(), scores_.end(), mycmp), scores_.end());
-  */
-  
-  std::string previousPeptide = "";
-  int previousLabel = 0;
-  size_t lastWrittenIdx = 0u;
-  for (size_t idx = 0u; idx < scores_.size(); ++idx){
-    std::string currentPeptide = scores_.at(idx).pPSM->getPeptideSequence();
-    int currentLabel = scores_.at(idx).label;
-    if (currentPeptide != previousPeptide || currentLabel != previousLabel) {
-      // insert as a new score
-      scores_.at(lastWrittenIdx++) = scores_.at(idx);
-      previousPeptide = currentPeptide;
-      previousLabel = currentLabel;
-    }
-    // append the psm
-    peptidePsmMap_[scores_.at(lastWrittenIdx - 1).pPSM].push_back(scores_.at(idx).pPSM);
-    if (specCountQvalThreshold > 0.0 && scores_.at(idx).q < specCountQvalThreshold) {
-      ++peptideSpecCounts[currentPeptide];
-    }
-  }
-  scores_.resize(lastWrittenIdx);
+  size_t n = scores_.size();
+  std::vector<uint64_t> hashes(n);
+#pragma omp parallel for schedule(static)
+  for (int ix = 0; ix < static_cast<int>(n); ++ix) {
+    hashes[ix] = peptideHash(scores_[ix].pPSM->peptide, scores_[ix].label);
+  }
+  
+  // group the PSMs, the groups are numbered in order of first occurrence
+  size_t numSlots = 1024u;
+  while (numSlots < 2u * n) numSlots *= 2u;
+  const unsigned int kEmpty = 0xFFFFFFFFu;
+  std::vector<unsigned int> slots(numSlots, kEmpty);
+  std::vector<unsigned int> groupOf(n), groupFirst, groupBest;
+  for (size_t ix = 0; ix < n; ++ix) {
+    const ScoreHolder& sh = scores_[ix];
+    size_t slot = hashes[ix] & (numSlots - 1u);
+    unsigned int group = kEmpty;
+    while (slots[slot] != kEmpty) {
+      const ScoreHolder& first = scores_[groupFirst[slots[slot]]];
+      if (hashes[groupFirst[slots[slot]]] == hashes[ix] && 
+          first.label == sh.label && 
+          first.pPSM->hasSamePeptideSequence(*sh.pPSM)) {
+        group = slots[slot];
+        break;
+      }
+      slot = (slot + 1u) & (numSlots - 1u);
+    }
+    if (group == kEmpty) {
+      group = static_cast<unsigned int>(groupFirst.size());
+      slots[slot] = group;
+      groupFirst.push_back(static_cast<unsigned int>(ix));
+      groupBest.push_back(static_cast<unsigned int>(ix));
+    } else {
+      // the highest score is kept, ties are broken as in postMergeStep
+      const ScoreHolder& best = scores_[groupBest[group]];
+      if (sh.score > best.score || (sh.score == best.score && sh > best)) {
+        groupBest[group] = static_cast<unsigned int>(ix);
+      }
+    }
+    groupOf[ix] = group;
+  }
+  size_t numGroups = groupFirst.size();
+  
+  // the PSMs of each group in descending score order, as flat arrays
+  std::vector<unsigned int> psmOrder(n);
+  peptidePsmStarts_.assign(numGroups + 1u, 0u);
+  for (size_t ix = 0; ix < n; ++ix) ++peptidePsmStarts_[groupOf[ix] + 1u];
+  for (size_t group = 0; group < numGroups; ++group) {
+    peptidePsmStarts_[group + 1u] += peptidePsmStarts_[group];
+  }
+  std::vector<size_t> next(peptidePsmStarts_.begin(), 
+                           peptidePsmStarts_.end() - 1);
+  for (size_t ix = 0; ix < n; ++ix) {
+    psmOrder[next[groupOf[ix]]++] = static_cast<unsigned int>(ix);
+  }
+  peptidePsms_.resize(n);
+  peptideIndex_.resize(numGroups);
+  std::vector<ScoreHolder> bestScores(numGroups);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (int group = 0; group < static_cast<int>(numGroups); ++group) {
+    std::vector<unsigned int>::iterator begin = psmOrder.begin() + 
+        peptidePsmStarts_[group];
+    std::vector<unsigned int>::iterator end = psmOrder.begin() + 
+        peptidePsmStarts_[group + 1];
+    std::stable_sort(begin, end, ScoreIndexGreater(scores_));
+    for (std::vector<unsigned int>::iterator it = begin; it != end; ++it) {
+      peptidePsms_[it - psmOrder.begin()] = scores_[*it].pPSM;
+    }
+    bestScores[group] = scores_[groupBest[group]];
+    peptideIndex_[group] = std::make_pair(bestScores[group].pPSM, 
+                                          static_cast<unsigned int>(group));
+  }
+  std::sort(peptideIndex_.begin(), peptideIndex_.end());
+  
+  if (specCountQvalThreshold > 0.0) {
+    for (size_t group = 0; group < numGroups; ++group) {
+      unsigned int numConfident = 0u;
+      for (size_t k = peptidePsmStarts_[group]; 
+           k < peptidePsmStarts_[group + 1]; ++k) {
+        if (scores_[psmOrder[k]].q < specCountQvalThreshold) ++numConfident;
+      }
+      if (numConfident > 0u) {
+        peptideSpecCounts[scores_[groupFirst[group]].pPSM->getPeptideSequence()] 
+            += numConfident;
+      }
+    }
+  }
+  
+  scores_.swap(bestScores);
   postMergeStep();
 }
 
+/**
+ * Gives the PSMs of the peptide that pPSM was kept for by weedOutRedundant,
+ * in descending score order, as a range of a flat array
+ */
+void Scores::getPsms(PSMDescription* pPSM,
+    std::vector<PSMDescription*>::const_iterator& begin,
+    std::vector<PSMDescription*>::const_iterator& end) const {
+  std::vector<std::pair<PSMDescription*, unsigned int> >::const_iterator it = 
+      std::lower_bound(peptideIndex_.begin(), peptideIndex_.end(), 
+                       std::make_pair(pPSM, 0u));
+  if (it == peptideIndex_.end() || it->first != pPSM) {
+    begin = end = peptidePsms_.end();
+  } else {
+    begin = peptidePsms_.begin() + peptidePsmStarts_[it->second];
+    end = peptidePsms_.begin() + peptidePsmStarts_[it->second + 1u];
+  }
+}
+
 /**
  * Routine that sees to that only unique spectra are kept for TDC
  */
 void Scores::weedOutRedundantTDC() {
-  // order the scores (based on spectra id and score)
-  std::sort(scores_.begin(), scores_.end(), OrderScanMassCharge());  
-  scores_.erase(std::unique(scores_.begin(), scores_.end(), UniqueScanMassCharge()), scores_.end());
-  
-  /* does not actually release memory because of memory fragmentation
-  double previousExpMass = 0.0;
-  unsigned int previousScan = 0u;
-  size_t lastWrittenIdx = 0u;
-  for (size_t idx = 0u; idx < scores_.size(); ++idx){
-    double currentExpMass = scores_.at(idx).pPSM->expMass;
-    int currentScan = scores_.at(idx).pPSM->scan;
-    if (currentExpMass != previousExpMass || currentScan != previousScan) {
-      // insert as a new score
-      scores_.at(lastWrittenIdx++).swap(scores_.at(idx));
-      previousScan = currentScan;
-      previousExpMass = currentExpMass;
-    } else {
-      PSMDescription::deletePtr(scores_.at(idx).pPSM);
-    }
-  }
-  scores_.resize(lastWrittenIdx);
-  */
+  keepBestPerSpectrum(false);
   postMergeStep();
 }
 
@@ -622,28 +1117,119 @@ void Scores::weedOutRedundantTDC() {
  * mix-max when using multiple hits per spectrum and separate searches
  */
 void Scores::weedOutRedundantMixMax() {
-  // order the scores (based on spectra id and score)
-  std::sort(scores_.begin(), scores_.end(), OrderScanMassLabelCharge());  
-  scores_.erase(std::unique(scores_.begin(), scores_.end(), UniqueScanMassLabelCharge()), scores_.end());
-  
+  keepBestPerSpectrum(true);
   postMergeStep();
 }
 
+/**
+ * Keeps the best scoring PSM of each spectrum, identified by scan and 
+ * experimental mass, and also by label if byLabel is set. Ties in score are
+ * broken as in postMergeStep. The PSMs are divided into partitions by the 
+ * top bits of the hash of their spectrum, and each partition is reduced 
+ * with its own open addressing hash table, in parallel.
+ */
+void Scores::keepBestPerSpectrum(bool byLabel) {
+  const unsigned int kPartitionBits = 6u;
+  const size_t numPartitions = 1u << kPartitionBits;
+  size_t n = scores_.size();
+  std::vector<uint64_t> hashes(n);
+#pragma omp parallel for schedule(static)
+  for (int ix = 0; ix < static_cast<int>(n); ++ix) {
+    hashes[ix] = spectrumHash(scores_[ix], byLabel);
+  }
+  
+  // the PSMs of each partition, in their order in scores_
+  std::vector<size_t> partStarts(numPartitions + 1u, 0u);
+  for (size_t ix = 0; ix < n; ++ix) {
+    ++partStarts[(hashes[ix] >> (64u - kPartitionBits)) + 1u];
+  }
+  for (size_t part = 0; part < numPartitions; ++part) {
+    partStarts[part + 1u] += partStarts[part];
+  }
+  std::vector<unsigned int> partPsms(n);
+  std::vector<size_t> next(partStarts.begin(), partStarts.end() - 1);
+  for (size_t ix = 0; ix < n; ++ix) {
+    partPsms[next[hashes[ix] >> (64u - kPartitionBits)]++] = 
+        static_cast<unsigned int>(ix);
+  }
+  
+  std::vector<std::vector<unsigned int> > partBest(numPartitions);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int part = 0; part < static_cast<int>(numPartitions); ++part) {
+    size_t partSize = partStarts[part + 1] - partStarts[part];
+    size_t numSlots = 16u;
+    while (numSlots < 2u * partSize) numSlots *= 2u;
+    const unsigned int kEmpty = 0xFFFFFFFFu;
+    std::vector<unsigned int> slots(numSlots, kEmpty);
+    std::vector<unsigned int>& best = partBest[part];
+    for (size_t k = partStarts[part]; k < partStarts[part + 1]; ++k) {
+      unsigned int ix = partPsms[k];
+      const ScoreHolder& sh = scores_[ix];
+      size_t slot = hashes[ix] & (numSlots - 1u);
+      for ( ; slots[slot] != kEmpty; slot = (slot + 1u) & (numSlots - 1u)) {
+        const ScoreHolder& other = scores_[best[slots[slot]]];
+        if (hashes[best[slots[slot]]] == hashes[ix] &&
+            other.pPSM->scan == sh.pPSM->scan && 
+            other.pPSM->expMass == sh.pPSM->expMass &&
+            (!byLabel || other.label == sh.label)) {
+          break;
+        }
+      }
+      if (slots[slot] == kEmpty) {
+        slots[slot] = static_cast<unsigned int>(best.size());
+        best.push_back(ix);
+      } else {
+        const ScoreHolder& other = scores_[best[slots[slot]]];
+        if (sh.score > other.score || (sh.score == other.score && sh > other)) {
+          best[slots[slot]] = ix;
+        }
+      }
+    }
+  }
+  
+  size_t numBest = 0u;
+  for (size_t part = 0; part < numPartitions; ++part) {
+    numBest += partBest[part].size();
+  }
+  std::vector<ScoreHolder> bestScores;
+  bestScores.reserve(numBest);
+  for (size_t part = 0; part < numPartitions; ++part) {
+    std::vector<unsigned int>::const_iterator it = partBest[part].begin();
+    for ( ; it != partBest[part].end(); ++it) {
+      bestScores.push_back(scores_[*it]);
+    }
+  }
+  scores_.swap(bestScores);
+}
+
 void Scores::recalculateDescriptionOfCorrect(const double fdr) {
   doc_.clear();
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    if (scoreIt->isTarget() && scoreIt->q <= fdr) {
-      doc_.registerCorrect(scoreIt->pPSM);
+  for (size_t ix = 0; ix < numPsms(); ++ix) {
+    if (holderAt(ix).isTarget() && qAt(ix) <= fdr) {
+      doc_.registerCorrect(holderAt(ix).pPSM);
     }
   }
   doc_.trainCorrect();
 }
 
 void Scores::setDOCFeatures(Normalizer* pNorm) {
-  std::vector<ScoreHolder>::const_iterator scoreIt = scores_.begin();
-  for ( ; scoreIt != scores_.end(); ++scoreIt) {
-    doc_.setFeaturesNormalized(scoreIt->pPSM, pNorm);
+  for (size_t ix = 0; ix < numPsms(); ++ix) {
+    doc_.setFeaturesNormalized(holderAt(ix).pPSM, pNorm);
+  }
+  // the PSMs are shared with other Scores objects, e.g. overlapping folds
+  featuresChanged();
+}
+
+/**
+ * Marks the feature matrix that holds the rows of this set as outdated, i.e.
+ * the one of its full set for a cross validation set. Has to be called 
+ * whenever the features of the PSMs are modified in place.
+ */
+void Scores::featuresChanged() {
+#pragma omp critical (scores_feature_matrix)
+  {
+    Scores* owner = (fullset_ != NULL) ? fullset_ : this;
+    ++owner->featureVersion_;
   }
 }
 
@@ -656,17 +1242,22 @@ int Scores::getInitDirection(const double initialSelectionFdr, std::vector<doubl
   // is too restrictive for small datasets
   bool skipDecoysPlusOne = true; 
   
+  std::vector<unsigned int> order(members_.size());
   for (unsigned int featNo = 0; featNo < FeatureNames::getNumFeatures(); featNo++) {
-    for (std::vector<ScoreHolder>::iterator scoreIt = scores_.begin(); 
-         scoreIt != scores_.end(); ++scoreIt) {
-      scoreIt->score = scoreIt->pPSM->features[featNo];
+    for (size_t ix = 0; ix < members_.size(); ++ix) {
+      memberScores_[ix] = holderAt(ix).pPSM->features[featNo];
+      order[ix] = static_cast<unsigned int>(ix);
     }
-    sort(scores_.begin(), scores_.end());
+    sort(order.begin(), order.end(), 
+         MemberLess(MemberGreater(fullset_->scores_, members_, memberScores_)));
+    permuteMembers(order);
     // check once in forward direction (i = 0, higher scores are better) and 
     // once in backward direction (i = 1, lower scores are better)
     for (int i = 0; i < 2; i++) {
       if (i == 1) {
-        reverse(scores_.begin(), scores_.end());
+        reverse(members_.begin(), members_.end());
+        reverse(memberScores_.begin(), memberScores_.end());
+        reverse(memberQ_.begin(), memberQ_.end());
       }
       int positives = calcQ(initialSelectionFdr, skipDecoysPlusOne);
       if (positives > bestPositives) {
@@ -707,12 +1298,25 @@ int Scores::getInitDirection(const double initialSelectionFdr, std::vector<doubl
   return bestPositives;
 }
 
+/**
+ * Checks the separation and estimates pi0 from the p-values of the targets,
+ * which are calculated as in PosteriorEstimator::getPValues directly from
+ * scores_, assumed to be sorted
+ */
 void Scores::checkSeparationAndSetPi0() {
-  std::vector<pair<double, bool> > combined;
-  getScoreLabelPairs(combined);
-  
   std::vector<double> pvals;
-  PosteriorEstimator::getPValues(combined, pvals);
+  pvals.reserve(scores_.size());
+  MixMaxCounter counter(1.0, 0u, 0u);
+  size_t n = scores_.size();
+  for (size_t ix = 0; ix < n; ++ix) {
+    counter.add(scores_[ix].isTarget());
+    if (ix + 1 == n || scores_[ix].score != scores_[ix + 1].score) {
+      counter.appendPValues(pvals);
+      counter.closeGroup();
+    }
+  }
+  transform(pvals.begin(), pvals.end(), pvals.begin(), 
+            bind2nd(divides<double>(), (double)(counter.getNumDecoys())));
   
   pi0_ = 1.0;
   bool tooGoodSeparation = PosteriorEstimator::checkSeparation(pvals);
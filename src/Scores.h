@@ -34,14 +34,43 @@
 #include "PseudoRandom.h"
 #include "Normalizer.h"
 #include "FeatureMemoryPool.h"
+#include "FeatureMatrix.h"
 
 class Scores;
 
+/*
+ * Sort key of a ScoreHolder for ranking by descending score: the bits of the
+ * score, transformed such that unsigned integer order equals descending
+ * floating point order, and the position of the ScoreHolder in scores_.
+ */
+struct RankKey {
+  uint64_t key;
+  unsigned int index;
+};
+
+/*
+* ScoreBuffers is the work space of the scoring, ranking and q-value passes.
+* It is owned by the caller, e.g. one per thread of the cross validation grid
+* search, so that repeated evaluations of weight vectors do not allocate once
+* the buffers have grown to the size of the set, while the Scores objects
+* themselves do not keep any scratch space between calls.
+*/
+struct ScoreBuffers {
+  std::vector<double> rowScores;
+  std::vector<RankKey> keys, sortBuffer;
+  std::vector<size_t> radixOffsets;
+};
+
 /*
 * ScoreHolder is a class that provides a way to assign score value to a
 * PSMDescription and have a way to compare PSMs based on the assigned
 * score value and output them into the stream.
 *
+* The ScoreHolders are owned by the full set, the cross validation sets only
+* refer to them by index. It is still sorted and copied as a whole by the
+* full set, so it is kept a trivially copyable 48 byte record without a
+* vtable, which the standard algorithms move with memmove.
+*
 * Here are some useful abbreviations:
 * PSM - Peptide Spectrum Match
 *
@@ -51,12 +80,12 @@ class ScoreHolder {
   double score, q, pep, p;
   PSMDescription* pPSM;
   int label;
-  //std::vector<std::string> psms_list;
+  unsigned int featureRow; // row of pPSM in the FeatureMatrix of its full set
   
-  ScoreHolder() : score(0.0), q(0.0), pep(0.0), p(0.0), label(0), pPSM(NULL) {}
+  ScoreHolder() : score(0.0), q(0.0), pep(0.0), p(0.0), pPSM(NULL), label(0),
+    featureRow(0u) {}
   ScoreHolder(const double s, const int l, PSMDescription* psm = NULL) :
-    score(s), q(0.0), pep(0.0), p(0.0), label(l), pPSM(psm) {}
-  virtual ~ScoreHolder() {}
+    score(s), q(0.0), pep(0.0), p(0.0), pPSM(psm), label(l), featureRow(0u) {}
   
   std::pair<double, bool> toPair() const { 
     return pair<double, bool> (score, label > 0); 
@@ -71,49 +100,6 @@ class ScoreHolder {
 inline bool operator>(const ScoreHolder& one, const ScoreHolder& other);
 inline bool operator<(const ScoreHolder& one, const ScoreHolder& other);
   
-struct lexicOrderProb : public binary_function<ScoreHolder, ScoreHolder, bool> {
-  static int compStrIt(std::string::iterator first1, std::string::iterator last1,
-                       std::string::iterator first2, std::string::iterator last2) {
-    for ( ; (first1 != last1) && (first2 != last2); first1++, first2++ ) {
-      if (*first1 < *first2) return 1;
-      if (*first2 < *first1) return -1;
-    }
-    if (first2 != last2) return 1;
-    else if (first1 != last1) return -1;
-    else return 0;
-  }
-  
-  bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
-    int peptCmp = compStrIt(__x.pPSM->getFullPeptideSequence().begin() + 2, 
-                            __x.pPSM->getFullPeptideSequence().end() - 2, 
-                            __y.pPSM->getFullPeptideSequence().begin() + 2, 
-                            __y.pPSM->getFullPeptideSequence().end() - 2);
-    return ( ( peptCmp == 1 ) 
-    || ( (peptCmp == 0) && (__x.label > __y.label) )
-    || ( (peptCmp == 0) && (__x.label == __y.label) && (__x.score > __y.score) ) );
-  }
-};
-
-struct OrderScanMassCharge : public binary_function<ScoreHolder, ScoreHolder, bool> {
-  bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
-    return ( (__x.pPSM->scan < __y.pPSM->scan ) 
-    || ( (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass < __y.pPSM->expMass) )
-    || ( (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass == __y.pPSM->expMass) 
-       && (__x.score > __y.score) ) );
-  }
-};
-
-struct OrderScanMassLabelCharge : public binary_function<ScoreHolder, ScoreHolder, bool> {
-  bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
-    return ( (__x.pPSM->scan < __y.pPSM->scan ) 
-    || ( (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass < __y.pPSM->expMass) )
-    || ( (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass == __y.pPSM->expMass) 
-       && (__x.label > __y.label) )
-    || ( (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass == __y.pPSM->expMass) 
-       && (__x.label == __y.label) && (__x.score > __y.score) ) );
-  }
-};
-
 struct OrderScanLabel : public binary_function<ScoreHolder, ScoreHolder, bool> {
   bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
     return ( (__x.pPSM->scan < __y.pPSM->scan ) 
@@ -121,19 +107,6 @@ struct OrderScanLabel : public binary_function<ScoreHolder, ScoreHolder, bool> {
   }
 };
 
-
-struct UniqueScanMassCharge : public binary_function<ScoreHolder, ScoreHolder, bool> {
-  bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
-    return (__x.pPSM->scan == __y.pPSM->scan) && (__x.pPSM->expMass == __y.pPSM->expMass);
-  }
-};
-
-struct UniqueScanMassLabelCharge : public binary_function<ScoreHolder, ScoreHolder, bool> {
-  bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
-    return (__x.pPSM->scan == __y.pPSM->scan) && (__x.label == __y.label) && (__x.pPSM->expMass == __y.pPSM->expMass);
-  }
-};
-
 struct UniqueScanLabel : public binary_function<ScoreHolder, ScoreHolder, bool> {
   bool operator()(const ScoreHolder& __x, const ScoreHolder& __y) const {
     return (__x.pPSM->scan == __y.pPSM->scan) && (__x.label == __y.label);
@@ -170,7 +143,8 @@ class Scores {
  public:
   Scores(bool usePi0) : usePi0_(usePi0), pi0_(1.0), 
     targetDecoySizeRatio_(1.0), totalNumberOfDecoys_(0),
-    totalNumberOfTargets_(0), decoyPtr_(NULL), targetPtr_(NULL) {}
+    totalNumberOfTargets_(0), decoyPtr_(NULL), targetPtr_(NULL),
+    featureVersion_(0u), fullset_(NULL) {}
   ~Scores() {}
   void merge(vector<Scores>& sv, double fdr);
   void postMergeStep();
@@ -182,6 +156,12 @@ class Scores {
   void scoreAndAddPSM(ScoreHolder& sh, const std::vector<double>& rawWeights,
                       FeatureMemoryPool& featurePool);
   int calcScores(vector<double>& w, double fdr, bool skipDecoysPlusOne = false);
+  int estimateTruePositives(const vector<double>& w, double fdr, 
+                            bool skipDecoysPlusOne = false) const;
+  int estimateTruePositives(const vector<double>& w, double fdr, 
+                            bool skipDecoysPlusOne,
+                            ScoreBuffers& buffers) const;
+  void prepareFeatureMatrix();
   int calcQ(double fdr, bool skipDecoysPlusOne = false);
   void recalculateDescriptionOfCorrect(const double fdr);
   void calcPep();
@@ -210,6 +190,7 @@ class Scores {
   unsigned getQvaluesBelowLevel(double level);
   
   void setDOCFeatures(Normalizer* pNorm);
+  void featuresChanged();
   
   void print(int label, std::ostream& os = std::cout);
   
@@ -225,16 +206,13 @@ class Scores {
   inline unsigned int posSize() const { return totalNumberOfTargets_; }
   inline unsigned int negSize() const { return totalNumberOfDecoys_; }  
   
-  inline void addScoreHolder(const ScoreHolder& sh) {
-    scores_.push_back(sh);
-  }
-  
-  std::vector<PSMDescription*>& getPsms(PSMDescription* pPSM) {
-    return peptidePsmMap_[pPSM];
-  }
+  void getPsms(PSMDescription* pPSM,
+               std::vector<PSMDescription*>::const_iterator& begin,
+               std::vector<PSMDescription*>::const_iterator& end) const;
   
   void reset() { 
     scores_.clear(); 
+    featureMatrix_.clear();
     totalNumberOfTargets_ = 0;
     totalNumberOfDecoys_ = 0;
   }
@@ -247,15 +225,62 @@ class Scores {
   int totalNumberOfDecoys_, totalNumberOfTargets_;
   
   std::vector<ScoreHolder> scores_;
-  std::map<PSMDescription*, std::vector<PSMDescription*> > peptidePsmMap_;
+  // PSMs of the unique peptides found by weedOutRedundant, as flat arrays:
+  // the PSMs of peptide k are peptidePsms_[peptidePsmStarts_[k]] up to
+  // peptidePsms_[peptidePsmStarts_[k+1]], peptideIndex_ holds the
+  // (kept PSM, k) pairs sorted by PSM
+  std::vector<PSMDescription*> peptidePsms_;
+  std::vector<size_t> peptidePsmStarts_;
+  std::vector<std::pair<PSMDescription*, unsigned int> > peptideIndex_;
   DescriptionOfCorrect doc_;
   
   double* decoyPtr_;
   double* targetPtr_;
   
+  // contiguous copy of the feature rows of scores_, ordered by fold, built
+  // by createXvalSetsBySpectrum and refreshed when the features are updated 
+  // in place, see featuresChanged
+  FeatureMatrix featureMatrix_;
+  unsigned int featureVersion_;
+  // for the cross validation sets: the full set that owns their ScoreHolders
+  // and feature matrix, and the row ranges of that matrix that they score
+  Scores* fullset_;
+  std::vector<std::pair<size_t, size_t> > featureRows_;
+  // for the cross validation sets: the indices of their PSMs in the scores_
+  // of the full set, in the order of this set, and the score and q-value
+  // each of them has in this set
+  std::vector<unsigned int> members_;
+  std::vector<double> memberScores_, memberQ_;
+  
+  inline size_t numPsms() const {
+    return (fullset_ != NULL) ? members_.size() : scores_.size();
+  }
+  inline const ScoreHolder& holderAt(size_t ix) const {
+    return (fullset_ != NULL) ? fullset_->scores_[members_[ix]] : scores_[ix];
+  }
+  inline double& scoreAt(size_t ix) {
+    return (fullset_ != NULL) ? memberScores_[ix] : scores_[ix].score;
+  }
+  inline double& qAt(size_t ix) {
+    return (fullset_ != NULL) ? memberQ_[ix] : scores_[ix].q;
+  }
+  inline void addMember(unsigned int psmIndex, double score, double q) {
+    members_.push_back(psmIndex);
+    memberScores_.push_back(score);
+    memberQ_.push_back(q);
+  }
+  void permuteMembers(const std::vector<unsigned int>& order);
+  
+  size_t calcRowScores(const std::vector<double>& w, 
+                       std::vector<double>& rowScores) const;
+  void buildFoldFeatureMatrix(std::vector<Scores>& train, 
+      std::vector<Scores>& test, const std::vector<unsigned int>& psmFolds);
+  
   void reorderFeatureRows(FeatureMemoryPool& featurePool, bool isTarget,
     std::map<double*, double*>& movedAddresses, size_t& idx);
+  void keepBestPerSpectrum(bool byLabel);
   void getScoreLabelPairs(std::vector<pair<double, bool> >& combined);
+  void sortByScore();
   void checkSeparationAndSetPi0();
 };
 
@@ -21,6 +21,10 @@ SetHandler::SetHandler(unsigned int maxPSMs) : maxPSMs_(maxPSMs) {}
 
 SetHandler::~SetHandler() {
   reset();
+  std::vector<BinaryPin*>::iterator it = binInputs_.begin();
+  for ( ; it != binInputs_.end(); ++it) {
+    delete *it;
+  }
 }
 
 void SetHandler::reset() {
@@ -225,9 +229,86 @@ void SetHandler::writeTab(const string& dataFN, SanityCheck * pCheck) {
   }
 }
 
-void SetHandler::readPSMs(istream& dataStream, std::string& psmLine, 
-    bool hasInitialValueRow, bool& concatenatedSearch,
-    std::vector<OptionalField>& optionalFields) {
+void SetHandler::writeBin(const string& dataFN, SanityCheck* pCheck) {
+  std::vector<std::string> featureNames;
+  size_t numFeatures = FeatureNames::getNumFeatures();
+  if (DataSet::getCalcDoc()) {
+    numFeatures -= DescriptionOfCorrect::numDOCFeatures();
+  }
+  for (size_t ix = 0; ix < numFeatures; ++ix) {
+    featureNames.push_back(DataSet::getFeatureNames().getFeatureName(ix));
+  }
+  BinaryPin::write(dataFN, subsets_, featurePool_.getNumFeatures(), 
+                   featureNames, pCheck->getDefaultWeights(),
+                   DataSet::getCalcDoc(), pCheck->concatenatedSearch());
+}
+
+BinaryPin* SetHandler::openBin(const std::string& binFN) {
+  BinaryPin* binPin = new BinaryPin();
+  binInputs_.push_back(binPin);
+  binPin->open(binFN);
+  
+  if (binPin->getCalcDoc() != DataSet::getCalcDoc()) {
+    ostringstream temp;
+    temp << "ERROR: Binary pin file " << binFN << " was written " 
+         << (binPin->getCalcDoc() ? "with" : "without") 
+         << " the -D flag, use the same setting for reading it." << std::endl;
+    throw MyException(temp.str());
+  }
+  
+  // the feature names are set up by the first opening of the input only, 
+  // rescoring the full list opens it again
+  if (DataSet::getNumFeatures() == 0u) {
+    std::vector<std::string> names;
+    binPin->getFeatureNames(names);
+    FeatureNames& featureNames = DataSet::getFeatureNames();
+    std::vector<std::string>::const_iterator it = names.begin();
+    for ( ; it != names.end(); ++it) {
+      featureNames.insertFeature(*it);
+    }
+    featureNames.initFeatures(DataSet::getCalcDoc());
+    checkModelFeatureNames(binFN);
+  }
+  
+  size_t numFeatures = std::max(DataSet::getNumFeatures(), 1u);
+  if (binPin->getRowStride() != numFeatures) {
+    ostringstream temp;
+    temp << "ERROR: Binary pin file " << binFN << " is corrupt, it contains "
+         << binPin->getRowStride() << " values per PSM for " << numFeatures 
+         << " features." << std::endl;
+    throw MyException(temp.str());
+  }
+  return binPin;
+}
+
+/**
+ * Checks that the features of the input are the ones of the model set with
+ * setModelFeatureNames, in the same order. Does nothing if no model is set.
+ */
+void SetHandler::checkModelFeatureNames(const std::string& inputFN) {
+  if (modelFeatureNames_.empty()) return;
+  FeatureNames& featureNames = DataSet::getFeatureNames();
+  size_t numFeatures = DataSet::getNumFeatures();
+  bool match = (numFeatures == modelFeatureNames_.size());
+  for (size_t ix = 0; match && ix < numFeatures; ++ix) {
+    match = (featureNames.getFeatureName(ix) == modelFeatureNames_[ix]);
+  }
+  if (!match) {
+    ostringstream temp;
+    temp << "ERROR: The features of the input" 
+         << (inputFN.empty() ? "" : " " + inputFN) << " (" 
+         << featureNames.getFeatureNames() << ") do not match the features "
+         << "of the model." << std::endl;
+    throw MyException(temp.str());
+  }
+}
+
+int SetHandler::readBin(const std::string& binFN, SanityCheck*& pCheck) {
+  BinaryPin* binPin = openBin(binFN);
+  size_t numPSMs = binPin->getNumPSMs();
+  featurePool_.createPoolFromBuffer(binPin->getRowStride(), 
+                                    binPin->getFeatures(), numPSMs);
+  
   DataSet* targetSet = new DataSet();
   assert(targetSet);
   targetSet->setLabel(1);
@@ -235,79 +316,307 @@ void SetHandler::readPSMs(istream& dataStream, std::string& psmLine,
   assert(decoySet);
   decoySet->setLabel(-1);
   
-  unsigned int lineNr = (hasInitialValueRow ? 3u : 2u);
-  if (maxPSMs_ > 0u) { // reservoir sampling to create subset of size maxPSMs_
+  // the subset is drawn by the reservoir sampling of readPSMs, but over the
+  // rows in file order, i.e. targets first, so it differs from the subset 
+  // drawn from the tab delimited input of the same PSMs
+  if (maxPSMs_ > 0u) {
     std::priority_queue<PSMDescriptionPriority> subsetPSMs;
-    // ScanId -> (priority, isDecoy)
-    std::map<ScanId, std::pair<size_t, bool> > scanIdLookUp;
+    std::map<ScanId, size_t> scanIdLookUp; // ScanId -> priority
     unsigned int upperLimit = UINT_MAX;
-    do {
-      if (lineNr % 1000000 == 0 && VERB > 1) {
-        std::cerr << "Processing line " << lineNr << std::endl;
-      }
-      psmLine = rtrim(psmLine);
-      bool isDecoy = false;
-      ScanId scanId = getScanId(psmLine, isDecoy, optionalFields, lineNr);
+    for (size_t row = 0; row < numPSMs; ++row) {
+      ScanId scanId(static_cast<int>(binPin->getScan(row)), 
+                    binPin->getExpMass(row));
       size_t randIdx;
-      if (scanIdLookUp.find(scanId) != scanIdLookUp.end()) {
-        if (concatenatedSearch && isDecoy != scanIdLookUp[scanId].second) {
-          concatenatedSearch = false;
-        }
-        randIdx = scanIdLookUp[scanId].first;
+      std::map<ScanId, size_t>::iterator lookUpIt = scanIdLookUp.find(scanId);
+      if (lookUpIt != scanIdLookUp.end()) {
+        randIdx = lookUpIt->second;
       } else {
         randIdx = PseudoRandom::lcg_rand();
-        scanIdLookUp[scanId].first = randIdx;
-        scanIdLookUp[scanId].second = isDecoy;
+        scanIdLookUp[scanId] = randIdx;
       }
       
       if (subsetPSMs.size() < maxPSMs_ || randIdx < upperLimit) {
         PSMDescriptionPriority psmPriority;
         bool readProteins = false;
-        psmPriority.label = DataSet::readPsm(psmLine, lineNr, optionalFields, 
-                                 readProteins, psmPriority.psm, featurePool_);
+        psmPriority.label = binPin->readPsm(row, readProteins, psmPriority.psm);
         psmPriority.priority = randIdx;
         subsetPSMs.push(psmPriority);
         if (subsetPSMs.size() > maxPSMs_) {
+          // the feature row belongs to the mapped file, only the PSM is freed
           PSMDescriptionPriority del = subsetPSMs.top();
           upperLimit = del.priority;
-          featurePool_.deallocate(del.psm->features);
           PSMDescription::deletePtr(del.psm);
           subsetPSMs.pop();
         }
       }
-      ++lineNr;
-    } while (getline(dataStream, psmLine));
+    }
+    
+    addQueueToSets(subsetPSMs, targetSet, decoySet);
+  } else {
+    for (size_t row = 0; row < numPSMs; ++row) {
+      PSMDescription* myPsm = NULL;
+      bool readProteins = true;
+      if (binPin->readPsm(row, readProteins, myPsm) == -1) {
+        decoySet->registerPsm(myPsm);
+      } else {
+        targetSet->registerPsm(myPsm);
+      }
+    }
+  }
+  
+  if (VERB > 1) {
+    std::cerr << "Found " << numPSMs << " PSMs" << std::endl;
+  }
+  
+  push_back_dataset(targetSet);
+  push_back_dataset(decoySet);
+  
+  std::vector<double> initValues;
+  binPin->getInitValues(initValues);
+  pCheck = new SanityCheck();
+  pCheck->checkAndSetDefaultDir();
+  if (initValues.size() > 0) pCheck->addDefaultWeights(initValues);
+  pCheck->setConcatenatedSearch(binPin->concatenatedSearch());
+  return 1;
+}
+
+/**
+ * Scores all PSMs of a binary pin file with the given weights. The file is
+ * mapped again, as the rows of the first mapping have been normalized and
+ * reordered in place.
+ */
+int SetHandler::readAndScoreBin(const std::string& binFN, 
+    std::vector<double>& rawWeights, Scores& allScores) {
+  BinaryPin* binPin = openBin(binFN);
+  size_t numPSMs = binPin->getNumPSMs();
+  for (size_t row = 0; row < numPSMs; ++row) {
+    if (row % 1000000 == 0 && row > 0 && VERB > 1) {
+      std::cerr << "Processing PSM " << row << std::endl;
+    }
+    ScoreHolder sh;
+    bool readProteins = true;
+    sh.label = binPin->readPsm(row, readProteins, sh.pPSM);
+    allScores.scoreAndAddPSM(sh, rawWeights, featurePool_);
+  }
+  
+  if (VERB > 1) {
+    std::cerr << "Found " << numPSMs << " PSMs" << std::endl;
+  }
+  return 1;
+}
+
+/**
+ * Scores all PSMs of a binary pin file for StreamingScores, which keeps only
+ * the score, row and strings of each PSM.
+ */
+int SetHandler::readAndStreamBin(const std::string& binFN, 
+    std::vector<double>& rawWeights, StreamingScores& streamScores) {
+  BinaryPin* binPin = openBin(binFN);
+  size_t numPSMs = binPin->getNumPSMs();
+  for (size_t row = 0; row < numPSMs; ++row) {
+    if (row % 1000000 == 0 && row > 0 && VERB > 1) {
+      std::cerr << "Processing PSM " << row << std::endl;
+    }
+    PSMDescription* psm = NULL;
+    bool readProteins = true;
+    int label = binPin->readPsm(row, readProteins, psm);
+    // the feature row belongs to the mapped file, only the PSM is freed
+    streamScores.scoreAndAddPSM(psm, label, row, rawWeights);
+    PSMDescription::deletePtr(psm);
+  }
+  
+  if (VERB > 1) {
+    std::cerr << "Found " << numPSMs << " PSMs" << std::endl;
+  }
+  return 1;
+}
+
+/**
+ * Reads the next chunk of lines into lines, reusing the strings allocated in
+ * previous chunks. The first numLines entries are already filled in.
+ * @return number of lines in the chunk, 0 if the stream is exhausted
+ */
+size_t SetHandler::readChunk(istream& dataStream, 
+    std::vector<std::string>& lines, size_t numLines) {
+  lines.resize(kChunkSize);
+  while (numLines < kChunkSize && getline(dataStream, lines[numLines])) {
+    ++numLines;
+  }
+  return numLines;
+}
+
+/**
+ * Trims the lines of a chunk and extracts their scan ids, in parallel.
+ * Exceptions cannot leave an OpenMP region, so they are collected per line
+ * and the one of the first offending line is rethrown afterwards.
+ */
+void SetHandler::getChunkScanIds(std::vector<std::string>& lines, 
+    size_t numLines, std::vector<OptionalField>& optionalFields, 
+    unsigned int lineNr, std::vector<ScanId>& scanIds, 
+    std::vector<int>& isDecoys) {
+  scanIds.resize(numLines);
+  isDecoys.resize(numLines);
+  std::vector<std::string> errors(numLines);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < static_cast<int>(numLines); ++i) {
+    try {
+      rtrim(lines[i]);
+      bool isDecoy = false;
+      scanIds[i] = getScanId(lines[i], isDecoy, optionalFields, lineNr + i);
+      isDecoys[i] = isDecoy;
+    } catch (const std::exception& e) {
+      errors[i] = e.what();
+    }
+  }
+  throwFirstError(errors);
+}
+
+void SetHandler::throwFirstError(const std::vector<std::string>& errors) {
+  std::vector<std::string>::const_iterator it = errors.begin();
+  for ( ; it != errors.end(); ++it) {
+    if (!it->empty()) throw MyException(*it);
+  }
+}
+
+/**
+ * Parses the lines of a chunk into PSMDescriptions in parallel. The feature
+ * rows are taken from the pool beforehand in line order, so that the pool
+ * layout is the same as for reading line by line. The lines are parsed in 
+ * blocks that intern their protein ids into a pool of their own, which are
+ * merged into the shared pool afterwards.
+ */
+void SetHandler::parseChunk(std::vector<std::string>& lines, size_t numLines,
+    std::vector<OptionalField>& optionalFields, unsigned int lineNr,
+    bool readProteins, std::vector<PSMDescription*>& psms, 
+    std::vector<int>& labels) {
+  std::vector<double*> featureRows(numLines);
+  for (size_t i = 0; i < numLines; ++i) {
+    featureRows[i] = featurePool_.allocate();
+  }
+  psms.assign(numLines, NULL);
+  labels.resize(numLines);
+  std::vector<std::string> errors(numLines);
+  const int numBlocks = static_cast<int>(
+      (numLines + kProteinPoolLines - 1u) / kProteinPoolLines);
+  std::vector<StringPool> proteinPools(numBlocks);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int block = 0; block < numBlocks; ++block) {
+    size_t end = (std::min)(numLines, (block + 1u) * kProteinPoolLines);
+    for (size_t i = block * kProteinPoolLines; i < end; ++i) {
+      try {
+        rtrim(lines[i]);
+        labels[i] = DataSet::readPsm(lines[i], lineNr + i, optionalFields, 
+            readProteins, psms[i], featureRows[i], &proteinPools[block]);
+      } catch (const std::exception& e) {
+        errors[i] = e.what();
+      }
+    }
+  }
+  throwFirstError(errors);
+  
+  if (readProteins) {
+    std::vector<unsigned int> handleMap;
+    for (int block = 0; block < numBlocks; ++block) {
+      PSMDescription::mergeProteinPool(proteinPools[block], handleMap);
+      size_t end = (std::min)(numLines, (block + 1u) * kProteinPoolLines);
+      for (size_t i = block * kProteinPoolLines; i < end; ++i) {
+        psms[i]->remapProteinIds(handleMap);
+      }
+    }
+  }
+}
+
+void SetHandler::readPSMs(istream& dataStream, std::string& psmLine, 
+    bool hasInitialValueRow, bool& concatenatedSearch,
+    std::vector<OptionalField>& optionalFields) {
+  DataSet* targetSet = new DataSet();
+  assert(targetSet);
+  targetSet->setLabel(1);
+  DataSet* decoySet = new DataSet();
+  assert(decoySet);
+  decoySet->setLabel(-1);
+  
+  // lines are processed in chunks: trimming, scan id extraction and parsing
+  // are done in parallel, everything that depends on the order of the PSMs
+  // is done afterwards in a sequential pass over the chunk
+  std::vector<std::string> lines(1, psmLine);
+  std::vector<ScanId> scanIds;
+  std::vector<int> isDecoys;
+  size_t numLines = readChunk(dataStream, lines, 1u);
+  unsigned int lineNr = (hasInitialValueRow ? 3u : 2u);
+  if (maxPSMs_ > 0u) { // reservoir sampling to create subset of size maxPSMs_
+    std::priority_queue<PSMDescriptionPriority> subsetPSMs;
+    // ScanId -> (priority, isDecoy)
+    std::map<ScanId, std::pair<size_t, bool> > scanIdLookUp;
+    unsigned int upperLimit = UINT_MAX;
+    for ( ; numLines > 0; numLines = readChunk(dataStream, lines, 0u)) {
+      if ((lineNr + numLines) / 1000000 > lineNr / 1000000 && VERB > 1) {
+        std::cerr << "Processing line " << lineNr + numLines << std::endl;
+      }
+      getChunkScanIds(lines, numLines, optionalFields, lineNr, scanIds, 
+                      isDecoys);
+      for (size_t i = 0; i < numLines; ++i, ++lineNr) {
+        bool isDecoy = (isDecoys[i] != 0);
+        size_t randIdx;
+        std::map<ScanId, std::pair<size_t, bool> >::iterator lookUpIt = 
+            scanIdLookUp.find(scanIds[i]);
+        if (lookUpIt != scanIdLookUp.end()) {
+          if (concatenatedSearch && isDecoy != lookUpIt->second.second) {
+            concatenatedSearch = false;
+          }
+          randIdx = lookUpIt->second.first;
+        } else {
+          randIdx = PseudoRandom::lcg_rand();
+          scanIdLookUp.insert(lookUpIt, std::make_pair(scanIds[i], 
+              std::make_pair(randIdx, isDecoy)));
+        }
+        
+        // only the few lines that enter the reservoir are parsed completely
+        if (subsetPSMs.size() < maxPSMs_ || randIdx < upperLimit) {
+          PSMDescriptionPriority psmPriority;
+          bool readProteins = false;
+          psmPriority.label = DataSet::readPsm(lines[i], lineNr, optionalFields, 
+                                   readProteins, psmPriority.psm, featurePool_);
+          psmPriority.priority = randIdx;
+          subsetPSMs.push(psmPriority);
+          if (subsetPSMs.size() > maxPSMs_) {
+            PSMDescriptionPriority del = subsetPSMs.top();
+            upperLimit = del.priority;
+            featurePool_.deallocate(del.psm->features);
+            PSMDescription::deletePtr(del.psm);
+            subsetPSMs.pop();
+          }
+        }
+      }
+    }
     
     addQueueToSets(subsetPSMs, targetSet, decoySet);
   } else { // simply read all PSMs
-    unsigned int targetIdx = 0u, decoyIdx = 0u;
     std::map<ScanId, bool> scanIdLookUp; // ScanId -> isDecoy
-    do {
-      psmLine = rtrim(psmLine);
-      int label = 1;
-      bool isDecoy = true;
-      ScanId scanId = getScanId(psmLine, isDecoy, optionalFields, lineNr);
-      if (isDecoy) {
-        label = -1;
-      }
-      if (scanIdLookUp.find(scanId) != scanIdLookUp.end()) {
-        if (concatenatedSearch && isDecoy != scanIdLookUp[scanId]) {
+    std::vector<PSMDescription*> psms;
+    std::vector<int> labels;
+    bool readProteins = true;
+    for ( ; numLines > 0; numLines = readChunk(dataStream, lines, 0u)) {
+      getChunkScanIds(lines, numLines, optionalFields, lineNr, scanIds, 
+                      isDecoys);
+      parseChunk(lines, numLines, optionalFields, lineNr, readProteins, 
+                 psms, labels);
+      for (size_t i = 0; i < numLines; ++i, ++lineNr) {
+        bool isDecoy = (isDecoys[i] != 0);
+        std::pair<std::map<ScanId, bool>::iterator, bool> inserted = 
+            scanIdLookUp.insert(std::make_pair(scanIds[i], isDecoy));
+        if (!inserted.second && concatenatedSearch && 
+              isDecoy != inserted.first->second) {
           concatenatedSearch = false;
         }
-      } else {
-        scanIdLookUp[scanId] = isDecoy;
-      }
-      
-      if (label == 1) {
-        targetSet->readPsm(psmLine, lineNr, optionalFields, featurePool_);
-      } else if (label == -1) {
-        decoySet->readPsm(psmLine, lineNr, optionalFields, featurePool_);
-      } else {
-        std::cerr << "Warning: the PSM on line " << lineNr
-            << " has a label not in {1,-1} and will be ignored." << std::endl;
+        
+        if (isDecoy) {
+          decoySet->registerPsm(psms[i]);
+        } else {
+          targetSet->registerPsm(psms[i]);
+        }
       }
-      ++lineNr;
-    } while (getline(dataStream, psmLine));
+    }
   }
   
   if (VERB > 1) {
@@ -406,7 +715,8 @@ ScanId SetHandler::getScanId(const std::string& psmLine, bool& isDecoy,
 }
 
 int SetHandler::readAndScoreTab(istream& dataStream, 
-    std::vector<double>& rawWeights, Scores& allScores, SanityCheck*& pCheck) {
+    std::vector<double>& rawWeights, Scores& allScores, SanityCheck*& pCheck,
+    StreamingScores* streamScores) {
   if (!dataStream) {
     std::cerr << "ERROR: Cannot open data stream." << std::endl;
     return 0;
@@ -473,8 +783,13 @@ int SetHandler::readAndScoreTab(istream& dataStream,
     }
   }
 
+  checkModelFeatureNames("");
+  
   // read in the data
-  if (rawWeights.size() > 0) {
+  if (streamScores != NULL) {
+    streamPSMs(dataStream, psmLine, hasInitialValueRow, optionalFields, 
+               rawWeights, *streamScores);
+  } else if (rawWeights.size() > 0) {
     readAndScorePSMs(dataStream, psmLine, hasInitialValueRow, optionalFields, rawWeights, allScores);
   } else {
     // detect if the input came from separate target and decoy searches or 
@@ -497,16 +812,56 @@ void SetHandler::readAndScorePSMs(istream& dataStream, std::string& psmLine,
     std::vector<double>& rawWeights, Scores& allScores) {
   unsigned int lineNr = (hasInitialValueRow ? 3u : 2u);
   bool readProteins = true;
-  do {
-    if (lineNr % 1000000 == 0 && VERB > 1) {
-      std::cerr << "Processing line " << lineNr << std::endl;
+  std::vector<std::string> lines(1, psmLine);
+  std::vector<PSMDescription*> psms;
+  std::vector<int> labels;
+  size_t numLines = readChunk(dataStream, lines, 1u);
+  for ( ; numLines > 0; numLines = readChunk(dataStream, lines, 0u)) {
+    if ((lineNr + numLines) / 1000000 > lineNr / 1000000 && VERB > 1) {
+      std::cerr << "Processing line " << lineNr + numLines << std::endl;
     }
-    psmLine = rtrim(psmLine);
-    ScoreHolder sh;
-    sh.label = DataSet::readPsm(psmLine, lineNr, optionalFields, readProteins, sh.pPSM, featurePool_);
-    allScores.scoreAndAddPSM(sh, rawWeights, featurePool_);
-    ++lineNr;
-  } while (getline(dataStream, psmLine));
+    parseChunk(lines, numLines, optionalFields, lineNr, readProteins, 
+               psms, labels);
+    for (size_t i = 0; i < numLines; ++i, ++lineNr) {
+      ScoreHolder sh;
+      sh.label = labels[i];
+      sh.pPSM = psms[i];
+      allScores.scoreAndAddPSM(sh, rawWeights, featurePool_);
+    }
+  }
+  
+  if (VERB > 1) {
+    std::cerr << "Found " << lineNr - (hasInitialValueRow ? 3u : 2u) << " PSMs" << std::endl;
+  }
+}
+
+/**
+ * Scores the PSMs with the given weights for StreamingScores, which keeps only
+ * the score, line number and strings of each PSM. The input is read once, 
+ * sequentially, the lines are trimmed of any trailing whitespace, e.g. the 
+ * carriage return of "\r\n" line endings, before they are parsed.
+ */
+void SetHandler::streamPSMs(istream& dataStream, std::string& psmLine,
+    bool hasInitialValueRow, std::vector<OptionalField>& optionalFields, 
+    std::vector<double>& rawWeights, StreamingScores& streamScores) {
+  unsigned int lineNr = (hasInitialValueRow ? 3u : 2u);
+  bool readProteins = true;
+  std::vector<std::string> lines(1, psmLine);
+  std::vector<PSMDescription*> psms;
+  std::vector<int> labels;
+  size_t numLines = readChunk(dataStream, lines, 1u);
+  for ( ; numLines > 0; numLines = readChunk(dataStream, lines, 0u)) {
+    if ((lineNr + numLines) / 1000000 > lineNr / 1000000 && VERB > 1) {
+      std::cerr << "Processing line " << lineNr + numLines << std::endl;
+    }
+    parseChunk(lines, numLines, optionalFields, lineNr, readProteins, 
+               psms, labels);
+    for (size_t i = 0; i < numLines; ++i, ++lineNr) {
+      streamScores.scoreAndAddPSM(psms[i], labels[i], lineNr, rawWeights);
+      featurePool_.deallocate(psms[i]->features);
+      PSMDescription::deletePtr(psms[i]);
+    }
+  }
   
   if (VERB > 1) {
     std::cerr << "Found " << lineNr - (hasInitialValueRow ? 3u : 2u) << " PSMs" << std::endl;
@@ -40,6 +40,8 @@
 #include "PseudoRandom.h"
 #include "DescriptionOfCorrect.h"
 #include "FeatureMemoryPool.h"
+#include "BinaryPin.h"
+#include "StreamingScores.h"
 
 using namespace std;
 
@@ -73,12 +75,23 @@ class SetHandler {
   // Reads in tab delimited stream and returns a SanityCheck object based on
   // the presence of default weights. Returns 0 on error, 1 on success.
   int readTab(istream& dataStream, SanityCheck*& pCheck);
+  // If streamScores is given, the PSMs are added to it instead of allScores
+  // and are not kept in memory.
   int readAndScoreTab(istream& dataStream, 
-    std::vector<double>& rawWeights, Scores& allScores, SanityCheck*& pCheck);
+    std::vector<double>& rawWeights, Scores& allScores, SanityCheck*& pCheck,
+    StreamingScores* streamScores = NULL);
+  // Reads in a binary pin file, the feature rows are used directly from the
+  // memory mapped file. Returns 0 on error, 1 on success.
+  int readBin(const std::string& binFN, SanityCheck*& pCheck);
+  int readAndScoreBin(const std::string& binFN, 
+    std::vector<double>& rawWeights, Scores& allScores);
+  int readAndStreamBin(const std::string& binFN, 
+    std::vector<double>& rawWeights, StreamingScores& streamScores);
   void addQueueToSets(std::priority_queue<PSMDescriptionPriority>& subsetPSMs,
     DataSet* targetSet, DataSet* decoySet);
   
   void writeTab(const string& dataFN, SanityCheck* pCheck);
+  void writeBin(const string& dataFN, SanityCheck* pCheck);
   void fillFeatures(vector<ScoreHolder> &scores, int label);
   void normalizeFeatures(Normalizer*& pNorm);
   void normalizeDOCFeatures(Normalizer* pNorm);
@@ -98,12 +111,20 @@ class SetHandler {
   
   FeatureMemoryPool& getFeaturePool() { return featurePool_; }
   
+  // the inputs read for scoring have to contain exactly these features
+  void setModelFeatureNames(const std::vector<std::string>& names) {
+    modelFeatureNames_ = names;
+  }
+  
   void reset();
   
  protected:
   size_t maxPSMs_;
   vector<DataSet*> subsets_;
   FeatureMemoryPool featurePool_;
+  // binary pin files stay mapped as long as PSMs might refer to their rows
+  std::vector<BinaryPin*> binInputs_;
+  std::vector<std::string> modelFeatureNames_;
   
   unsigned int getSubsetIndexFromLabel(int label);
   static inline std::string &rtrim(std::string &s);
@@ -116,15 +137,36 @@ class SetHandler {
     int optionalFieldCount, FeatureNames& featureNames);
   bool getInitValues(const std::string& defaultDirectionLine, 
     int optionalFieldCount, std::vector<double>& init_values);
+  BinaryPin* openBin(const std::string& binFN);
+  void checkModelFeatureNames(const std::string& inputFN);
   ScanId getScanId(const std::string& psmLine, bool& isDecoy,
     std::vector<OptionalField>& optionalFields, unsigned int lineNr);
     
+  // number of lines that are parsed in parallel at a time
+  static const size_t kChunkSize = 10000u;
+  // lines of a chunk that share a local protein id pool while parsing
+  static const size_t kProteinPoolLines = 250u;
+  
+  size_t readChunk(istream& dataStream, std::vector<std::string>& lines, 
+    size_t numLines);
+  void getChunkScanIds(std::vector<std::string>& lines, size_t numLines,
+    std::vector<OptionalField>& optionalFields, unsigned int lineNr,
+    std::vector<ScanId>& scanIds, std::vector<int>& isDecoys);
+  void parseChunk(std::vector<std::string>& lines, size_t numLines,
+    std::vector<OptionalField>& optionalFields, unsigned int lineNr,
+    bool readProteins, std::vector<PSMDescription*>& psms, 
+    std::vector<int>& labels);
+  static void throwFirstError(const std::vector<std::string>& errors);
+    
   void readPSMs(istream& dataStream, std::string& psmLine, 
     bool hasInitialValueRow, bool& separateSearches,
     std::vector<OptionalField>& optionalFields);
   void readAndScorePSMs(istream& dataStream, std::string& psmLine, 
     bool hasInitialValueRow, std::vector<OptionalField>& optionalFields, 
     std::vector<double>& rawWeights, Scores& allScores);
+  void streamPSMs(istream& dataStream, std::string& psmLine,
+    bool hasInitialValueRow, std::vector<OptionalField>& optionalFields, 
+    std::vector<double>& rawWeights, StreamingScores& streamScores);
 };
 
 #endif /*SETHANDLER_H_*/
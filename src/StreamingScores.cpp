@@ -0,0 +1,865 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+
+#include "StreamingScores.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <sstream>
+
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+#include "FeatureNames.h"
+#include "PSMDescription.h"
+#include "PosteriorEstimator.h"
+#include "LogisticRegression.h"
+#include "ResultHolder.h"
+#include "Globals.h"
+#include "MyException.h"
+
+namespace {
+
+// descending score order, ties are kept in input order
+struct RecordGreater {
+  bool operator()(const StreamingScores::Record& a,
+                  const StreamingScores::Record& b) const {
+    return (a.score > b.score) || (a.score == b.score && a.ref < b.ref);
+  }
+};
+
+// a record of the merge heap and the run it was taken from
+struct MergeEntry {
+  StreamingScores::Record record;
+  size_t run;
+
+  // inverted, so that the priority queue yields the greatest record first
+  bool operator<(const MergeEntry& other) const {
+    return RecordGreater()(other.record, record);
+  }
+};
+
+// payload entries in the order of their records
+struct PayloadGreater {
+  bool operator()(const StreamingScores::PayloadEntry& a,
+                  const StreamingScores::PayloadEntry& b) const {
+    return RecordGreater()(a.header.record, b.header.record);
+  }
+};
+
+inline double mymin(double a, double b) {
+  return a > b ? b : a;
+}
+
+inline StreamingScores::Record makeRecord(double score, bool isDecoy, 
+                                          uint64_t ref) {
+  StreamingScores::Record record;
+  record.score = score;
+  record.ref = (ref << 1) | (isDecoy ? 1u : 0u);
+  return record;
+}
+
+/*
+ * Reads the payload entries of one spilled run sequentially, in blocks of
+ * blockBytes bytes
+ */
+class PayloadReader {
+ public:
+  PayloadReader(SpillFile& file, size_t start, size_t end, size_t blockBytes) :
+    file_(&file), pos_(start), end_(end), blockBytes_(blockBytes), 
+    bufferPos_(0u) {}
+  
+  // reads the next entry, returns false at the end of the run
+  bool next() {
+    if (pos_ == end_ && bufferPos_ == buffer_.size()) return false;
+    ensure(sizeof(header));
+    memcpy(&header, &buffer_[bufferPos_], sizeof(header));
+    bufferPos_ += sizeof(header);
+    ensure(header.idLength + header.peptideLength + header.proteinsLength);
+    readString(header.idLength, id);
+    readString(header.peptideLength, peptide);
+    readString(header.proteinsLength, proteins);
+    return true;
+  }
+  
+  StreamingScores::PayloadHeader header;
+  std::string id, peptide, proteins;
+  
+ private:
+  SpillFile* file_;
+  size_t pos_, end_, blockBytes_, bufferPos_;
+  std::vector<char> buffer_;
+  
+  // makes sure that n unread bytes are in the buffer
+  void ensure(size_t n) {
+    size_t available = buffer_.size() - bufferPos_;
+    if (available >= n) return;
+    buffer_.erase(buffer_.begin(), buffer_.begin() + bufferPos_);
+    bufferPos_ = 0u;
+    size_t len = (std::min)((std::max)(n - available, blockBytes_), 
+                            end_ - pos_);
+    if (available + len < n) {
+      throw MyException("ERROR: Truncated temporary spill file.\n");
+    }
+    buffer_.resize(available + len);
+    file_->read(pos_, &buffer_[available], len);
+    pos_ += len;
+  }
+  
+  void readString(size_t n, std::string& str) {
+    str.assign(buffer_.begin() + bufferPos_, buffer_.begin() + bufferPos_ + n);
+    bufferPos_ += n;
+  }
+};
+
+} // namespace
+
+SpillFile::SpillFile(const std::string& dir, size_t elementSize) :
+    file_(NULL), elementSize_(elementSize), size_(0u) {
+  std::string tempDir = dir;
+#ifdef _WIN32
+  file_ = tmpfile();
+#else
+  if (tempDir.empty()) {
+    const char* envDir = getenv("TMPDIR");
+    tempDir = (envDir != NULL) ? envDir : "/tmp";
+  }
+  std::string pattern = tempDir + "/percolator-spill-XXXXXX";
+  std::vector<char> fileName(pattern.begin(), pattern.end());
+  fileName.push_back('\0');
+  int fd = mkstemp(&fileName[0]);
+  if (fd >= 0) {
+    // the file is removed from the directory right away and its space is
+    // freed as soon as it is closed
+    unlink(&fileName[0]);
+    file_ = fdopen(fd, "w+b");
+    if (file_ == NULL) close(fd);
+  }
+#endif
+  if (file_ == NULL) {
+    ostringstream temp;
+    temp << "ERROR: Could not create a temporary file in " << tempDir
+         << " to spill scores to disk." << std::endl;
+    throw MyException(temp.str());
+  }
+}
+
+SpillFile::~SpillFile() {
+  fclose(file_);
+}
+
+void SpillFile::seek(size_t pos) {
+  uint64_t offset = static_cast<uint64_t>(pos) * elementSize_;
+#ifdef _WIN32
+  int status = _fseeki64(file_, offset, SEEK_SET);
+#else
+  int status = fseeko(file_, static_cast<off_t>(offset), SEEK_SET);
+#endif
+  if (status != 0) {
+    throw MyException("ERROR: Could not seek in temporary spill file.\n");
+  }
+}
+
+void SpillFile::append(const void* data, size_t n) {
+  write(size_, data, n);
+}
+
+void SpillFile::read(size_t pos, void* data, size_t n) {
+  assert(pos + n <= size_);
+  seek(pos);
+  if (fread(data, elementSize_, n, file_) != n) {
+    throw MyException("ERROR: Could not read from temporary spill file.\n");
+  }
+}
+
+void SpillFile::write(size_t pos, const void* data, size_t n) {
+  assert(pos <= size_);
+  seek(pos);
+  if (fwrite(data, elementSize_, n, file_) != n) {
+    ostringstream temp;
+    temp << "ERROR: Could not write to temporary spill file, check if there "
+         << "is enough disk space available." << std::endl;
+    throw MyException(temp.str());
+  }
+  size_ = (std::max)(size_, pos + n);
+}
+
+const size_t StreamingScores::kRunSize;
+const size_t StreamingScores::kBlockSize;
+const size_t StreamingScores::kPayloadRunBytes;
+
+StreamingScores::StreamingScores(bool usePi0, const std::string& spillDir) :
+    usePi0_(usePi0), pi0_(1.0), targetDecoySizeRatio_(1.0),
+    totalNumberOfDecoys_(0u), totalNumberOfTargets_(0u), targetsOnly_(false),
+    spillDir_(spillDir), runs_(NULL), sorted_(NULL), qvals_(NULL), peps_(NULL),
+    payloadRuns_(NULL), payloadSize_(0u) {}
+
+StreamingScores::~StreamingScores() {
+  delete runs_;
+  delete sorted_;
+  delete qvals_;
+  delete peps_;
+  delete payloadRuns_;
+}
+
+/**
+ * Scores the PSM with the given weights and keeps its score record and its
+ * strings for printing, the PSM itself is not kept and remains owned by the
+ * caller
+ * @param psmRef position of the PSM in the input, ties are ordered by it
+ */
+void StreamingScores::scoreAndAddPSM(PSMDescription* psm, int label,
+    uint64_t psmRef, const std::vector<double>& rawWeights) {
+  if (label != 1 && label != -1) {
+    std::cerr << "Warning: the PSM " << psm->getId()
+        << " has a label not in {1,-1} and will be ignored." << std::endl;
+    return;
+  }
+
+  const unsigned int numFeatures = FeatureNames::getNumFeatures();
+  double score = 0.0;
+  for (unsigned int j = 0; j < numFeatures; j++) {
+    score += psm->features[j] * rawWeights[j];
+  }
+  score += rawWeights[numFeatures];
+  addPayload(makeRecord(score, label == -1, psmRef), *psm);
+  addScore(score, label == -1, psmRef);
+}
+
+/**
+ * Keeps the id, peptide and proteins of the PSM of record, to be sorted along
+ * with the records
+ */
+void StreamingScores::addPayload(const Record& record, PSMDescription& psm) {
+  std::ostringstream out;
+  psm.printProteins(out);
+  std::string proteins = out.str();
+  
+  PayloadEntry entry;
+  memset(&entry.header, 0, sizeof(entry.header));
+  entry.header.record = record;
+  entry.header.idLength = static_cast<uint32_t>(psm.getId().size());
+  entry.header.peptideLength = static_cast<uint32_t>(psm.peptide.size());
+  entry.header.proteinsLength = static_cast<uint32_t>(proteins.size());
+  entry.offset = payloadChars_.size();
+  payloadChars_ += psm.getId();
+  payloadChars_ += psm.peptide;
+  payloadChars_ += proteins;
+  payload_.push_back(entry);
+  ++payloadSize_;
+  
+  if (payloadChars_.size() + payload_.size() * sizeof(PayloadEntry) >= 
+        kPayloadRunBytes) {
+    spillPayloadRun();
+  }
+}
+
+/**
+ * Sorts the payload in memory in the order of the records and appends it to
+ * disk as a new run: the header of each PSM followed by its strings
+ */
+void StreamingScores::spillPayloadRun() {
+  std::sort(payload_.begin(), payload_.end(), PayloadGreater());
+  if (payloadRuns_ == NULL) {
+    payloadRuns_ = new SpillFile(spillDir_, 1u);
+  }
+  payloadRunStarts_.push_back(payloadRuns_->size());
+  
+  std::vector<char> out;
+  out.reserve(kBlockSize);
+  std::vector<PayloadEntry>::const_iterator it = payload_.begin();
+  for ( ; it != payload_.end(); ++it) {
+    const char* header = reinterpret_cast<const char*>(&it->header);
+    out.insert(out.end(), header, header + sizeof(it->header));
+    size_t len = it->header.idLength + it->header.peptideLength + 
+                 it->header.proteinsLength;
+    out.insert(out.end(), payloadChars_.begin() + it->offset, 
+               payloadChars_.begin() + it->offset + len);
+    if (out.size() >= kBlockSize) {
+      payloadRuns_->append(&out[0], out.size());
+      out.clear();
+    }
+  }
+  if (!out.empty()) payloadRuns_->append(&out[0], out.size());
+  
+  std::vector<PayloadEntry>().swap(payload_);
+  std::string().swap(payloadChars_);
+}
+
+/**
+ * Keeps the score record of an already scored target or decoy
+ * @param ref reference that is kept with the score, ties are ordered by it
+ */
+void StreamingScores::addScore(double score, bool isDecoy, uint64_t ref) {
+  Record record = makeRecord(score, isDecoy, ref);
+
+  if (isDecoy) {
+    ++totalNumberOfDecoys_;
+  } else {
+    ++totalNumberOfTargets_;
+  }
+
+  run_.push_back(record);
+  if (run_.size() >= kRunSize) {
+    spillRun();
+  }
+}
+
+// sorts the records in memory and appends them to disk as a new run
+void StreamingScores::spillRun() {
+  std::sort(run_.begin(), run_.end(), RecordGreater());
+  if (runs_ == NULL) {
+    runs_ = new SpillFile(spillDir_, sizeof(Record));
+  }
+  runStarts_.push_back(runs_->size());
+  if (!run_.empty()) runs_->append(&run_[0], run_.size());
+  run_.clear();
+}
+
+/**
+ * Merges all runs into the file of sorted records, reading each run in
+ * blocks. If nothing has been spilled, the records are sorted in memory.
+ */
+void StreamingScores::mergeRuns() {
+  sorted_ = new SpillFile(spillDir_, sizeof(Record));
+  if (runs_ == NULL) {
+    std::sort(run_.begin(), run_.end(), RecordGreater());
+    if (!run_.empty()) sorted_->append(&run_[0], run_.size());
+    std::vector<Record>().swap(run_);
+    return;
+  }
+
+  if (!run_.empty()) spillRun();
+  std::vector<Record>().swap(run_);
+  size_t numRuns = runStarts_.size();
+  runStarts_.push_back(runs_->size());
+  if (VERB > 1) {
+    std::cerr << "Merging " << numRuns << " sorted runs of scores." << std::endl;
+  }
+
+  // each run is read in blocks of mergeBlockSize records
+  size_t mergeBlockSize = (std::max)(kBlockSize / numRuns, (size_t)1024u);
+  std::vector<std::vector<Record> > blocks(numRuns);
+  std::vector<size_t> blockPos(numRuns, 0u), runPos(runStarts_);
+  std::priority_queue<MergeEntry> heap;
+  for (size_t run = 0; run < numRuns; ++run) {
+    size_t len = (std::min)(mergeBlockSize, runStarts_[run + 1] - runPos[run]);
+    blocks[run].resize(len);
+    if (len > 0) {
+      runs_->read(runPos[run], &blocks[run][0], len);
+      runPos[run] += len;
+      MergeEntry entry = { blocks[run][0], run };
+      heap.push(entry);
+    }
+  }
+
+  std::vector<Record> out;
+  out.reserve(kBlockSize);
+  while (!heap.empty()) {
+    MergeEntry entry = heap.top();
+    heap.pop();
+    out.push_back(entry.record);
+    if (out.size() == kBlockSize) {
+      sorted_->append(&out[0], out.size());
+      out.clear();
+    }
+
+    size_t run = entry.run;
+    if (++blockPos[run] == blocks[run].size()) {
+      size_t len = (std::min)(mergeBlockSize, runStarts_[run + 1] - runPos[run]);
+      blocks[run].resize(len);
+      blockPos[run] = 0u;
+      if (len == 0) continue;
+      runs_->read(runPos[run], &blocks[run][0], len);
+      runPos[run] += len;
+    }
+    entry.record = blocks[run][blockPos[run]];
+    heap.push(entry);
+  }
+  if (!out.empty()) sorted_->append(&out[0], out.size());
+
+  delete runs_;
+  runs_ = NULL;
+  runStarts_.clear();
+}
+
+/**
+ * Sorts the records by merging the spilled runs and sets pi0, the
+ * counterpart of Scores::postMergeStep. The payload in memory is spilled, 
+ * its runs are merged when printing.
+ */
+void StreamingScores::postMergeStep() {
+  mergeRuns();
+  if (!payload_.empty()) spillPayloadRun();
+  targetDecoySizeRatio_ = totalNumberOfTargets_ /
+      (std::max)(1.0, (double)totalNumberOfDecoys_);
+  checkSeparationAndSetPi0();
+}
+
+/**
+ * Calculates the p-values of the targets in a pass over the sorted records,
+ * as in PosteriorEstimator::getPValues, and estimates pi0 from them
+ */
+void StreamingScores::checkSeparationAndSetPi0() {
+  // the bootstrap resamples are only drawn if pi0 is estimated, so that the
+  // random numbers used afterwards are the same as for Scores
+  Pi0Accumulator pi0Accumulator(totalNumberOfTargets_, usePi0_ ? 100u : 0u);
+
+  size_t n = sorted_->size();
+  std::vector<Record> block;
+  size_t nDecoys = 1, posSame = 0, negSame = 0;
+  double nDecoysTotal = (double)(totalNumberOfDecoys_ + 1u);
+  double prevScore = 0.0;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    sorted_->read(start, &block[0], block.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      if (start + i > 0 && block[i].score != prevScore) {
+        for (size_t ix = 0; ix < posSame; ++ix) {
+          double p = nDecoys + negSame * (ix + 1) / (double)(posSame + 1);
+          pi0Accumulator.add(p / nDecoysTotal);
+        }
+        nDecoys += negSame;
+        negSame = 0;
+        posSame = 0;
+      }
+      if (block[i].isTarget()) {
+        ++posSame;
+      } else {
+        ++negSame;
+      }
+      prevScore = block[i].score;
+    }
+  }
+  for (size_t ix = 0; ix < posSame; ++ix) {
+    double p = nDecoys + negSame * (ix + 1) / (double)(posSame + 1);
+    pi0Accumulator.add(p / nDecoysTotal);
+  }
+
+  pi0_ = 1.0;
+  bool tooGoodSeparation = pi0Accumulator.checkSeparation();
+  if (tooGoodSeparation) {
+    ostringstream oss;
+    oss << "Error in the input data: too good separation between target "
+        << "and decoy PSMs.\n";
+    if (NO_TERMINATE) {
+      cerr << oss.str();
+      if (usePi0_) {
+        std::cerr << "No-terminate flag set: setting pi0 = 1 and ignoring error." << std::endl;
+      } else {
+        std::cerr << "No-terminate flag set: ignoring error." << std::endl;
+      }
+    } else {
+      throw MyException(oss.str() + "Terminating.\n");
+    }
+  } else if (usePi0_) {
+    pi0_ = pi0Accumulator.estimatePi0();
+  }
+}
+
+/**
+ * Calculates the q-values of all records, targets and decoys, as in
+ * PosteriorEstimator::getQValues: the FDR of each group of tied scores in a
+ * forward pass, the monotone minimum in a backward pass.
+ * @param fdr FDR threshold
+ * @return number of targets with q < fdr
+ */
+int StreamingScores::calcQ(double fdr) {
+  if (qvals_ == NULL) {
+    qvals_ = new SpillFile(spillDir_, sizeof(double));
+  }
+
+  size_t n = sorted_->size();
+  std::vector<Record> block;
+  std::vector<double> qBlock;
+  qBlock.reserve(kBlockSize);
+  size_t qPos = 0u;
+
+  MixMaxCounter counter(pi0_, totalNumberOfTargets_, totalNumberOfDecoys_);
+  double prevScore = 0.0;
+  for (size_t start = 0; start <= n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    if (!block.empty()) sorted_->read(start, &block[0], block.size());
+    for (size_t i = 0; i <= block.size(); ++i) {
+      bool isLast = (start + i == n);
+      if (i == block.size() && !isLast) break;
+      // a group of tied scores ends before a different score or at the end
+      if (start + i > 0 && (isLast || block[i].score != prevScore)) {
+        uint64_t targetQueue = counter.getGroupTargets();
+        uint64_t groupSize = targetQueue + counter.getGroupDecoys();
+        counter.closeGroup();
+        double groupFdr = (std::min)(counter.getFdr(), 1.0);
+        // with targets only, the decoys get the largest possible q-value,
+        // so that they do not lower the q-values of the targets above them
+        for (uint64_t k = 0; k < groupSize; ++k) {
+          bool isDecoy = (k >= targetQueue);
+          qBlock.push_back((targetsOnly_ && isDecoy) ? 1.0 : groupFdr);
+          if (qBlock.size() == kBlockSize) {
+            qvals_->write(qPos, &qBlock[0], qBlock.size());
+            qPos += qBlock.size();
+            qBlock.clear();
+          }
+        }
+      }
+      if (isLast) break;
+      counter.add(block[i].isTarget());
+      prevScore = block[i].score;
+    }
+  }
+  if (!qBlock.empty()) qvals_->write(qPos, &qBlock[0], qBlock.size());
+
+  // convert the FDRs into q-values
+  runningMinFromBack(*qvals_);
+
+  int numPos = 0;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    qBlock.resize(block.size());
+    sorted_->read(start, &block[0], block.size());
+    qvals_->read(start, &qBlock[0], qBlock.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      if (qBlock[i] < fdr && block[i].isTarget()) ++numPos;
+    }
+  }
+  return numPos;
+}
+
+// replaces each value by the minimum of itself and all values after it
+void StreamingScores::runningMinFromBack(SpillFile& values) {
+  size_t n = values.size();
+  std::vector<double> block;
+  size_t end = n;
+  bool first = true;
+  double runningMin = 0.0;
+  while (end > 0) {
+    size_t start = (end > kBlockSize) ? end - kBlockSize : 0u;
+    block.resize(end - start);
+    values.read(start, &block[0], block.size());
+    for (size_t i = block.size(); i-- > 0; ) {
+      if (first) {
+        runningMin = block[i];
+        first = false;
+      } else {
+        runningMin = mymin(runningMin, block[i]);
+      }
+      block[i] = runningMin;
+    }
+    values.write(start, &block[0], block.size());
+    end = start;
+  }
+}
+
+/**
+ * Sets q=fdr to 0 and the median decoy to -1 and linearly transforms the
+ * rest to fit, as in Scores::normalizeScores. Uses the q-values of the last
+ * call to calcQ.
+ */
+void StreamingScores::normalizeScores(double fdr) {
+  size_t n = sorted_->size();
+  if (n == 0) return;
+
+  uint64_t medianIndex = totalNumberOfDecoys_ / 2u, decoys = 0u;
+  double fdrScore = readScore(0u);
+  double medianDecoyScore = fdrScore + 1.0;
+
+  std::vector<Record> block;
+  std::vector<double> qBlock;
+  bool foundMedian = false;
+  for (size_t start = 0; start < n && !foundMedian; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    qBlock.resize(block.size());
+    sorted_->read(start, &block[0], block.size());
+    qvals_->read(start, &qBlock[0], qBlock.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      if (qBlock[i] < fdr)
+        fdrScore = block[i].score;
+      if (block[i].isDecoy()) {
+        if (++decoys == medianIndex) {
+          medianDecoyScore = block[i].score;
+          foundMedian = true;
+          break;
+        }
+      }
+    }
+  }
+
+  double diff = fdrScore - medianDecoyScore;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    sorted_->read(start, &block[0], block.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      block[i].score -= fdrScore;
+      if (diff > 0.0) {
+        block[i].score /= diff;
+      }
+    }
+    sorted_->write(start, &block[0], block.size());
+  }
+}
+
+double StreamingScores::readScore(size_t pos) {
+  Record record;
+  sorted_->read(pos, &record, 1u);
+  return record.score;
+}
+
+/**
+ * Divides the records into bins as in PosteriorEstimator::binData. Without
+ * pi0 the bins are formed from the lowest score upwards, as
+ * PosteriorEstimator::estimate reverses the list in that case. The median of
+ * a bin is read back from disk, once per bin.
+ */
+void StreamingScores::binData(double pi0, std::vector<double>& medians,
+    std::vector<double>& negatives, std::vector<double>& sizes) {
+  bool ascending = !usePi0_;
+  size_t n = sorted_->size();
+  unsigned int numBins = PosteriorEstimator::getNumBins();
+
+  int binsLeft = numBins - 1;
+  double targetedBinSize = (std::max)(n / (double)(numBins), 1.0);
+
+  MixMaxCounter counter(pi0, totalNumberOfTargets_, totalNumberOfDecoys_);
+  uint64_t psmsInBin = 0, binStartIdx = 0;
+  std::vector<Record> block;
+  double prevScore = 0.0;
+  for (size_t k = 0; k <= n; ) {
+    // the k-th record in binning order is found at blockStart + offset
+    size_t len = (std::min)(kBlockSize, n - k);
+    size_t blockStart = ascending ? n - k - len : k;
+    block.resize(len);
+    if (len > 0) sorted_->read(blockStart, &block[0], len);
+    for (size_t i = 0; i <= len; ++i, ++k) {
+      bool isLast = (k == n);
+      if (i == len && !isLast) break;
+      const Record* record = NULL;
+      if (!isLast) record = &block[ascending ? len - 1 - i : i];
+      if (k > 0 && (isLast || record->score != prevScore)) {
+        counter.closeGroup();
+
+        if (n - binStartIdx - psmsInBin <= binsLeft * targetedBinSize) {
+          size_t medianIdx = binStartIdx + psmsInBin / 2;
+          double median = readScore(ascending ? n - 1 - medianIdx : medianIdx);
+          double numNegatives = counter.getBinNegatives();
+          double numPsmsCorrected = psmsInBin - counter.getBinDecoys() +
+                                    numNegatives;
+
+          if (medians.size() > 0 && *(medians.rbegin()) == median) {
+            *(negatives.rbegin()) += numNegatives;
+            *(sizes.rbegin()) += numPsmsCorrected;
+          } else {
+            medians.push_back(median);
+            negatives.push_back(numNegatives);
+            sizes.push_back(numPsmsCorrected);
+          }
+
+          binStartIdx += psmsInBin;
+          --binsLeft;
+
+          psmsInBin = 0;
+          counter.startBin();
+        }
+      }
+      if (isLast) {
+        ++k;
+        break;
+      }
+      counter.add(record->isTarget());
+      ++psmsInBin;
+      prevScore = record->score;
+    }
+  }
+}
+
+/**
+ * Calculates the PEPs of all records, targets and decoys, as in
+ * PosteriorEstimator::estimatePEP: the spline is fitted on the binned
+ * records, then evaluated in a forward pass and made monotone in a
+ * backward pass.
+ */
+void StreamingScores::calcPep() {
+  std::vector<double> medians, negatives, sizes;
+  binData(pi0_, medians, negatives, sizes);
+  if (medians.size() < 2) {
+    ostringstream oss;
+    oss << "ERROR: Only 1 bin available for PEP estimation, "
+        << "no distinguishing feature present." << std::endl;
+    throw MyException(oss.str());
+  }
+
+  // the IRLS implementation requires the medians to be in ascending order
+  if (medians.front() > medians.back()) {
+    reverse(medians.begin(), medians.end());
+    reverse(negatives.begin(), negatives.end());
+    reverse(sizes.begin(), sizes.end());
+  }
+
+  LogisticRegression lr;
+  lr.setData(medians, negatives, sizes);
+  lr.roughnessPenaltyIRLS();
+
+  if (peps_ == NULL) {
+    peps_ = new SpillFile(spillDir_, sizeof(double));
+  }
+  size_t n = sorted_->size();
+  std::vector<Record> block;
+  std::vector<double> xvals, pepBlock;
+  double maxPep = 0.0;
+  bool foundMax = false;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    sorted_->read(start, &block[0], block.size());
+    xvals.resize(block.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      xvals[i] = block[i].score;
+    }
+    lr.predict(xvals, pepBlock);
+    for (size_t i = 0; i < block.size(); ++i) {
+      if (targetsOnly_ && block[i].isDecoy()) continue;
+      if (!foundMax || pepBlock[i] > maxPep) maxPep = pepBlock[i];
+      foundMax = true;
+    }
+    peps_->write(start, &pepBlock[0], pepBlock.size());
+  }
+
+  // as for the q-values, the decoys are set to the largest possible PEP if
+  // the statistics are for the targets only
+  double top = (std::min)(1.0, exp(maxPep));
+  bool crap = false;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    pepBlock.resize((std::min)(kBlockSize, n - start));
+    peps_->read(start, &pepBlock[0], pepBlock.size());
+    if (targetsOnly_) {
+      block.resize(pepBlock.size());
+      sorted_->read(start, &block[0], block.size());
+    }
+    std::vector<double>::iterator pep = pepBlock.begin();
+    for ( ; pep != pepBlock.end(); ++pep) {
+      if (targetsOnly_ && block[pep - pepBlock.begin()].isDecoy()) {
+        *pep = 1.0;
+        continue;
+      }
+      if (crap) {
+        *pep = top;
+        continue;
+      }
+      *pep = exp(*pep);
+      if (*pep >= top) {
+        *pep = top;
+        crap = true;
+      }
+    }
+    peps_->write(start, &pepBlock[0], pepBlock.size());
+  }
+  runningMinFromBack(*peps_);
+}
+
+/**
+ * Prints the target records, and the decoy records if decoyOs is given, in 
+ * the format of Scores::print, in one pass over the sorted records and the 
+ * merged payload runs
+ */
+void StreamingScores::print(std::ostream& targetOs, std::ostream* decoyOs) {
+  const char* header = 
+      "PSMId\tscore\tq-value\tposterior_error_prob\tpeptide\tproteinIds\n";
+  targetOs << header;
+  if (decoyOs != NULL) *decoyOs << header;
+  size_t n = sorted_->size();
+  if (payloadSize_ != n) {
+    throw MyException("ERROR: The PSM strings of the streamed scores are not available.\n");
+  }
+  
+  // each run is read in blocks, of the size of a block of records in total
+  size_t numRuns = payloadRunStarts_.size();
+  size_t blockBytes = (std::max)(
+      kBlockSize * sizeof(Record) / (std::max)(numRuns, (size_t)1u), 
+      (size_t)4096u);
+  std::vector<PayloadReader> readers;
+  readers.reserve(numRuns);
+  std::priority_queue<MergeEntry> heap;
+  for (size_t run = 0; run < numRuns; ++run) {
+    size_t end = (run + 1 < numRuns) ? payloadRunStarts_[run + 1] : 
+                                       payloadRuns_->size();
+    readers.push_back(PayloadReader(*payloadRuns_, payloadRunStarts_[run], 
+                                    end, blockBytes));
+    if (readers.back().next()) {
+      MergeEntry entry = { readers.back().header.record, run };
+      heap.push(entry);
+    }
+  }
+  
+  std::vector<Record> block;
+  std::vector<double> qBlock, pepBlock;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    qBlock.resize(block.size());
+    pepBlock.resize(block.size());
+    sorted_->read(start, &block[0], block.size());
+    qvals_->read(start, &qBlock[0], qBlock.size());
+    peps_->read(start, &pepBlock[0], pepBlock.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      // the payload is merged in the order of the records before their 
+      // scores were normalized, which is the order of sorted_
+      MergeEntry entry = heap.top();
+      heap.pop();
+      assert(entry.record.ref == block[i].ref);
+      PayloadReader& reader = readers[entry.run];
+      std::ostream* os = block[i].isDecoy() ? decoyOs : &targetOs;
+      if (os != NULL) {
+        ResultHolder rh(block[i].score, qBlock[i], pepBlock[i], reader.id,
+                        reader.peptide, reader.proteins);
+        *os << rh << std::endl;
+      }
+      if (reader.next()) {
+        entry.record = reader.header.record;
+        heap.push(entry);
+      }
+    }
+  }
+}
+
+/**
+ * Prints the score, PEP and q-value of the targets, and of the decoys if
+ * includeDecoys is set, in the format of qvality
+ * @param scoreSign factor the scores are multiplied with before printing
+ */
+void StreamingScores::printScoreTable(bool includeDecoys, double scoreSign,
+                                      std::ostream& os) {
+  os << "Score\tPEP\tq-value" << std::endl;
+  size_t n = sorted_->size();
+  std::vector<Record> block;
+  std::vector<double> qBlock, pepBlock;
+  for (size_t start = 0; start < n; start += kBlockSize) {
+    block.resize((std::min)(kBlockSize, n - start));
+    qBlock.resize(block.size());
+    pepBlock.resize(block.size());
+    sorted_->read(start, &block[0], block.size());
+    qvals_->read(start, &qBlock[0], qBlock.size());
+    peps_->read(start, &pepBlock[0], pepBlock.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      if (includeDecoys || block[i].isTarget()) {
+        os << scoreSign * block[i].score << "\t" << pepBlock[i] << "\t"
+           << qBlock[i] << "\n";
+      }
+    }
+  }
+  os.flush();
+}
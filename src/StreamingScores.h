@@ -0,0 +1,161 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+#ifndef STREAMINGSCORES_H_
+#define STREAMINGSCORES_H_
+
+#ifndef WIN32
+  #include <stdint.h>
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+class PSMDescription;
+
+/*
+* SpillFile is an unnamed temporary file of fixed size elements, which is
+* deleted when the object is destroyed.
+*/
+class SpillFile {
+ public:
+  SpillFile(const std::string& dir, size_t elementSize);
+  ~SpillFile();
+
+  inline size_t size() const { return size_; }
+  void append(const void* data, size_t n);
+  void read(size_t pos, void* data, size_t n);
+  void write(size_t pos, const void* data, size_t n);
+
+ protected:
+  FILE* file_;
+  size_t elementSize_, size_;
+
+  void seek(size_t pos);
+
+  SpillFile(const SpillFile&);
+  SpillFile& operator=(const SpillFile&);
+};
+
+/*
+* StreamingScores is the out-of-core counterpart of Scores for the final
+* scoring pass of huge inputs. Each PSM is scored as it is read, and only a
+* compact (score, label, PSM reference) record is kept. Records are sorted in
+* runs of bounded size that are spilled to disk and merged externally, and
+* all statistics (pi0, q-values and PEPs) are calculated in sequential passes
+* over the merged file, so memory use does not grow with the number of PSMs.
+* The PSM ids, peptides and proteins are carried as payload: they are sorted
+* in runs of bounded size in the same order as the records, spilled, and 
+* merged alongside the sorted records when printing, so that the input does
+* not have to be read again.
+*
+* The statistics equal those of Scores for PSM level results without
+* target-decoy competition, up to the order of PSMs with tied scores.
+* qvality uses it with plain scores, added by addScore, for inputs that do
+* not fit in memory.
+*
+*/
+class StreamingScores {
+ public:
+  struct Record {
+    double score;
+    uint64_t ref; // (PSM reference << 1) | isDecoy
+
+    inline bool isDecoy() const { return (ref & 1u) != 0u; }
+    inline bool isTarget() const { return (ref & 1u) == 0u; }
+  };
+  
+  // the record of a PSM and the lengths of its strings, which follow it in 
+  // the spilled payload runs
+  struct PayloadHeader {
+    Record record;
+    uint32_t idLength, peptideLength, proteinsLength;
+  };
+  // a PSM of the payload in memory, with the offset of its strings
+  struct PayloadEntry {
+    PayloadHeader header;
+    size_t offset;
+  };
+
+  StreamingScores(bool usePi0, const std::string& spillDir = "");
+  ~StreamingScores();
+
+  void scoreAndAddPSM(PSMDescription* psm, int label, uint64_t psmRef,
+                      const std::vector<double>& rawWeights);
+  void addScore(double score, bool isDecoy, uint64_t ref);
+  // makes the q-values and PEPs monotone over the targets only, as qvality
+  // does unless decoys are included, the decoys' values are then meaningless
+  inline void setTargetsOnly(bool targetsOnly) { targetsOnly_ = targetsOnly; }
+  void postMergeStep();
+  int calcQ(double fdr);
+  void normalizeScores(double fdr);
+  void calcPep();
+
+  void print(std::ostream& targetOs, std::ostream* decoyOs = NULL);
+  void printScoreTable(bool includeDecoys, double scoreSign,
+                       std::ostream& os = std::cout);
+
+  inline double getPi0() const { return pi0_; }
+  inline double getTargetDecoySizeRatio() const {
+    return targetDecoySizeRatio_;
+  }
+  inline uint64_t size() const {
+    return totalNumberOfTargets_ + totalNumberOfDecoys_;
+  }
+  inline uint64_t posSize() const { return totalNumberOfTargets_; }
+  inline uint64_t negSize() const { return totalNumberOfDecoys_; }
+
+ protected:
+  // number of records sorted in memory before they are spilled as a run
+  static const size_t kRunSize = 1u << 23;
+  // number of records read or written at a time in the sequential passes
+  static const size_t kBlockSize = 1u << 16;
+  // bytes of payload kept in memory before they are spilled as a run
+  static const size_t kPayloadRunBytes = 1u << 26;
+
+  bool usePi0_;
+  double pi0_;
+  double targetDecoySizeRatio_;
+  uint64_t totalNumberOfDecoys_, totalNumberOfTargets_;
+  bool targetsOnly_;
+  std::string spillDir_;
+
+  std::vector<Record> run_;
+  std::vector<size_t> runStarts_;
+  SpillFile* runs_;
+  // records in descending score order with the q-values and PEPs per record
+  SpillFile *sorted_, *qvals_, *peps_;
+  
+  std::vector<PayloadEntry> payload_;
+  std::string payloadChars_;
+  std::vector<size_t> payloadRunStarts_; // byte offsets in payloadRuns_
+  SpillFile* payloadRuns_;
+  uint64_t payloadSize_;
+
+  void addPayload(const Record& record, PSMDescription& psm);
+  void spillPayloadRun();
+  void spillRun();
+  void mergeRuns();
+  void checkSeparationAndSetPi0();
+  void runningMinFromBack(SpillFile& values);
+  void binData(double pi0, std::vector<double>& medians,
+               std::vector<double>& negatives, std::vector<double>& sizes);
+  double readScore(size_t pos);
+};
+
+#endif /*STREAMINGSCORES_H_*/
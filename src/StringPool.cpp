@@ -0,0 +1,78 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+
+#include "StringPool.h"
+
+const unsigned int StringPool::kEmpty;
+
+StringPool::StringPool() : slots_(1024u, kEmpty) {}
+
+// FNV-1a
+size_t StringPool::hash(const std::string& str) {
+  size_t h = 2166136261u;
+  std::string::const_iterator it = str.begin();
+  for ( ; it != str.end(); ++it) {
+    h ^= static_cast<unsigned char>(*it);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+ * Returns the handle of str, adding it to the table if it is new
+ * @param str string to intern
+ * @return handle that get resolves to an equal string
+ */
+unsigned int StringPool::intern(const std::string& str) {
+  size_t mask = slots_.size() - 1u;
+  size_t slot = hash(str) & mask;
+  while (slots_[slot] != kEmpty) {
+    if (strings_[slots_[slot]] == str) return slots_[slot];
+    slot = (slot + 1u) & mask;
+  }
+  unsigned int handle = static_cast<unsigned int>(strings_.size());
+  strings_.push_back(str);
+  slots_[slot] = handle;
+  // keep the load factor below 1/2
+  if (2u * strings_.size() > slots_.size()) grow();
+  return handle;
+}
+
+/**
+ * Interns all strings of other, e.g. a pool that was filled by another 
+ * thread, into this pool
+ * @param other pool to merge
+ * @param handleMap output, the handle in this pool of each handle of other
+ */
+void StringPool::merge(const StringPool& other, 
+                       std::vector<unsigned int>& handleMap) {
+  handleMap.resize(other.size());
+  for (unsigned int handle = 0; handle < other.size(); ++handle) {
+    handleMap[handle] = intern(other.get(handle));
+  }
+}
+
+void StringPool::grow() {
+  std::vector<unsigned int> slots(2u * slots_.size(), kEmpty);
+  size_t mask = slots.size() - 1u;
+  for (unsigned int handle = 0; handle < strings_.size(); ++handle) {
+    size_t slot = hash(strings_[handle]) & mask;
+    while (slots[slot] != kEmpty) slot = (slot + 1u) & mask;
+    slots[slot] = handle;
+  }
+  slots_.swap(slots);
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+#ifndef STRINGPOOL_H_
+#define STRINGPOOL_H_
+
+#include <deque>
+#include <vector>
+#include <string>
+
+/*
+* StringPool interns strings: every distinct string is stored once and is
+* referred to by a 32-bit handle, so that objects that share many long
+* strings, e.g. the protein ids of the PSMs, hold handles instead of copies.
+* The strings are kept in a deque, which allocates in blocks and does not
+* move them, and are found by an open addressing hash table of handles.
+* Strings are never removed. intern is not thread safe.
+*/
+class StringPool {
+ public:
+  StringPool();
+
+  unsigned int intern(const std::string& str);
+  void merge(const StringPool& other, std::vector<unsigned int>& handleMap);
+  inline const std::string& get(unsigned int handle) const {
+    return strings_[handle];
+  }
+  inline size_t size() const { return strings_.size(); }
+
+ protected:
+  static const unsigned int kEmpty = 0xFFFFFFFFu;
+
+  std::deque<std::string> strings_;
+  std::vector<unsigned int> slots_; // handles, size is a power of 2
+
+  static size_t hash(const std::string& str);
+  void grow();
+};
+
+#endif /*STRINGPOOL_H_*/
@@ -0,0 +1,205 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+
+#include "TrainedModel.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include "FeatureNames.h"
+#include "Normalizer.h"
+#include "MyException.h"
+
+const std::string TrainedModel::kMagic = "# Percolator trained model";
+
+TrainedModel::TrainedModel() : postProcessing_("none") {}
+
+void TrainedModel::setFeatureNames(FeatureNames& featureNames) {
+  featureNames_.clear();
+  for (size_t ix = 0; ix < FeatureNames::getNumFeatures(); ++ix) {
+    featureNames_.push_back(featureNames.getFeatureName(ix));
+  }
+}
+
+void TrainedModel::setNormalizer(Normalizer* pNorm) {
+  size_t numFeatures = featureNames_.size();
+  sub_ = pNorm->GetVSub();
+  div_ = pNorm->GetVDiv();
+  sub_.resize(numFeatures, 0.0);
+  div_.resize(numFeatures, 1.0);
+}
+
+void TrainedModel::setFolds(const std::vector< std::vector<double> >& w,
+    const std::vector<double>& cpos, const std::vector<double>& cneg) {
+  w_ = w;
+  cpos_ = cpos;
+  cneg_ = cneg;
+  cpos_.resize(w_.size(), 0.0);
+  cneg_.resize(w_.size(), 0.0);
+}
+
+/**
+ * Writes the model, the doubles with enough digits to be read back exactly
+ * @param modelFN name of the model file
+ */
+void TrainedModel::write(const std::string& modelFN) const {
+  std::ofstream modelStream(modelFN.c_str(), std::ios::out);
+  if (!modelStream.is_open()) {
+    std::ostringstream temp;
+    temp << "ERROR: Could not open model file " << modelFN
+         << " for writing." << std::endl;
+    throw MyException(temp.str());
+  }
+  modelStream << std::setprecision(17);
+  modelStream << kMagic << "\n";
+  modelStream << "version\t" << kVersion << "\n";
+  modelStream << "post-processing\t" << postProcessing_ << "\n";
+  modelStream << "features\t" << featureNames_.size() << "\n";
+  for (size_t ix = 0; ix < featureNames_.size(); ++ix) {
+    modelStream << "feature\t" << featureNames_[ix] << "\t" << sub_[ix]
+                << "\t" << div_[ix] << "\n";
+  }
+  modelStream << "folds\t" << w_.size() << "\n";
+  for (size_t set = 0; set < w_.size(); ++set) {
+    modelStream << "fold\t" << cpos_[set] << "\t" << cneg_[set];
+    std::vector<double>::const_iterator it = w_[set].begin();
+    for ( ; it != w_[set].end(); ++it) {
+      modelStream << "\t" << *it;
+    }
+    modelStream << "\n";
+  }
+}
+
+void TrainedModel::readValues(std::istream& lineStream, size_t numValues,
+    std::vector<double>& values, const std::string& modelFN,
+    unsigned int lineNr) {
+  values.resize(numValues);
+  bool valid = true;
+  for (size_t ix = 0; ix < numValues && valid; ++ix) {
+    valid = static_cast<bool>(lineStream >> values[ix]);
+  }
+  if (!valid || !(lineStream >> std::ws).eof()) {
+    std::ostringstream temp;
+    temp << "ERROR: Reading model file " << modelFN << ", expected "
+         << numValues << " values on line " << lineNr << "." << std::endl;
+    throw MyException(temp.str());
+  }
+}
+
+/**
+ * Reads a model written by write, throws a MyException if the file is
+ * missing, corrupt or of an unsupported version
+ * @param modelFN name of the model file
+ */
+void TrainedModel::read(const std::string& modelFN) {
+  std::ifstream modelStream(modelFN.c_str(), std::ios::in);
+  if (!modelStream.is_open()) {
+    std::ostringstream temp;
+    temp << "ERROR: Could not open model file " << modelFN << "." << std::endl;
+    throw MyException(temp.str());
+  }
+
+  std::string line, key;
+  unsigned int lineNr = 1u;
+  getline(modelStream, line);
+  if (line.substr(0, kMagic.size()) != kMagic) {
+    std::ostringstream temp;
+    temp << "ERROR: " << modelFN << " is not a Percolator model file."
+         << std::endl;
+    throw MyException(temp.str());
+  }
+
+  int version = 0;
+  size_t numFeatures = 0u, numFolds = 0u;
+  featureNames_.clear();
+  sub_.clear();
+  div_.clear();
+  w_.clear();
+  cpos_.clear();
+  cneg_.clear();
+  while (getline(modelStream, line)) {
+    ++lineNr;
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream lineStream(line);
+    getline(lineStream, key, '\t');
+    std::vector<double> values;
+    if (key == "version") {
+      lineStream >> version;
+      if (version != kVersion) {
+        std::ostringstream temp;
+        temp << "ERROR: Model file " << modelFN << " has version " << version
+             << ", only version " << kVersion << " is supported." << std::endl;
+        throw MyException(temp.str());
+      }
+    } else if (key == "post-processing") {
+      lineStream >> postProcessing_;
+    } else if (key == "features") {
+      lineStream >> numFeatures;
+    } else if (key == "feature") {
+      std::string name;
+      getline(lineStream, name, '\t');
+      readValues(lineStream, 2u, values, modelFN, lineNr);
+      featureNames_.push_back(name);
+      sub_.push_back(values[0]);
+      div_.push_back(values[1]);
+    } else if (key == "folds") {
+      lineStream >> numFolds;
+    } else if (key == "fold") {
+      if (numFeatures == 0u || featureNames_.size() != numFeatures) {
+        std::ostringstream temp;
+        temp << "ERROR: Reading model file " << modelFN << ", fold on line "
+             << lineNr << " precedes its feature header." << std::endl;
+        throw MyException(temp.str());
+      }
+      readValues(lineStream, numFeatures + 3u, values, modelFN, lineNr);
+      cpos_.push_back(values[0]);
+      cneg_.push_back(values[1]);
+      w_.push_back(std::vector<double>(values.begin() + 2, values.end()));
+    } else {
+      std::ostringstream temp;
+      temp << "ERROR: Reading model file " << modelFN << ", unknown entry \""
+           << key << "\" on line " << lineNr << "." << std::endl;
+      throw MyException(temp.str());
+    }
+  }
+
+  if (version != kVersion || featureNames_.size() != numFeatures ||
+      numFeatures == 0u || w_.size() != numFolds || numFolds == 0u) {
+    std::ostringstream temp;
+    temp << "ERROR: Model file " << modelFN << " is incomplete." << std::endl;
+    throw MyException(temp.str());
+  }
+}
+
+void TrainedModel::initNormalizer(Normalizer* pNorm) const {
+  pNorm->SetSubDiv(sub_, div_);
+  pNorm->setNumFeatures(featureNames_.size());
+}
+
+void TrainedModel::getAvgWeights(std::vector<double>& weights,
+                                 Normalizer* pNorm) const {
+  size_t numFeatures = featureNames_.size();
+  std::vector<double> ww(numFeatures + 1);
+  weights.assign(numFeatures + 1, 0.0);
+  for (size_t set = 0; set < w_.size(); ++set) {
+    pNorm->unnormalizeweight(w_[set], ww);
+    for (size_t ix = 0; ix < numFeatures + 1; ix++) {
+      weights[ix] += ww[ix] / w_.size();
+    }
+  }
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+ Copyright 2006-2012 Lukas Käll <lukas.kall@scilifelab.se>
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ *******************************************************************************/
+#ifndef TRAINEDMODEL_H_
+#define TRAINEDMODEL_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+class FeatureNames;
+class Normalizer;
+
+/*
+* TrainedModel holds everything needed to score PSMs with the SVMs of an
+* earlier run without training again: the feature names, the sub and div
+* vectors of the normalizer, the normalized weights and selected soft margin
+* parameters of each cross validation bin and the post-processing method.
+* It is stored as a versioned, tab delimited text file.
+*
+*/
+class TrainedModel {
+ public:
+  TrainedModel();
+
+  void setFeatureNames(FeatureNames& featureNames);
+  void setNormalizer(Normalizer* pNorm);
+  void setFolds(const std::vector< std::vector<double> >& w,
+                const std::vector<double>& cpos,
+                const std::vector<double>& cneg);
+  void setPostProcessing(const std::string& method) { postProcessing_ = method; }
+
+  void write(const std::string& modelFN) const;
+  void read(const std::string& modelFN);
+
+  inline const std::vector<std::string>& getFeatureNames() const {
+    return featureNames_;
+  }
+  inline const std::string& getPostProcessing() const {
+    return postProcessing_;
+  }
+  inline size_t getNumFolds() const { return w_.size(); }
+
+  // Sets the normalizer to the stored sub and div vectors
+  void initNormalizer(Normalizer* pNorm) const;
+  // Averages the unnormalized weights of the bins, as
+  // CrossValidation::getAvgWeights does
+  void getAvgWeights(std::vector<double>& weights, Normalizer* pNorm) const;
+
+ protected:
+  const static int kVersion = 1;
+  const static std::string kMagic;
+
+  std::vector<std::string> featureNames_;
+  std::vector<double> sub_, div_;
+  std::vector< std::vector<double> > w_; // normalized weights of each bin
+  std::vector<double> cpos_, cneg_; // soft margin parameters of each bin
+  std::string postProcessing_; // "mix-max", "tdc" or "none"
+
+  static void readValues(std::istream& lineStream, size_t numValues,
+                         std::vector<double>& values,
+                         const std::string& modelFN, unsigned int lineNr);
+};
+
+#endif /*TRAINEDMODEL_H_*/
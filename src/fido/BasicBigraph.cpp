@@ -14,19 +14,22 @@ BasicBigraph::BasicBigraph(double __psmthreshold, double __peptidethreshold,
 BasicBigraph::~BasicBigraph() {}
 
 void BasicBigraph::read(Scores* fullset, bool multiple_labeled_peptides) {
-  string pepName, protName;
-  double value =  -10;
-  int pepIndex = -1;
-  StringTable PSMNames, proteinNames;
+  string pepName;
+  StringPool PSMNames, proteinNames;
+  // (PSM, protein) index pairs, the adjacency is built from them at the end
+  std::vector<std::pair<int, int> > edges;
+  std::vector<double> psmWeights;
 
   vector<ScoreHolder>::iterator psm = fullset->begin();
   for (; psm!= fullset->end(); ++psm) {
     // e peptide_string
-    pepName = psm->pPSM->peptide;
+    const string& peptide = psm->pPSM->peptide;
     
-    if ( pepName[1] == '.' ) {
+    if ( peptide[1] == '.' ) {
       // trim off the cleavage events
-      pepName = pepName.substr(2, pepName.size() - 4);
+      pepName.assign(peptide, 2, peptide.size() - 4);
+    } else {
+      pepName = peptide;
     }
     //NOTE fido will keep only one peptide in the case that a target and a decoy peptide
     //      contain the same sequence
@@ -40,32 +43,94 @@ void BasicBigraph::read(Scores* fullset, bool multiple_labeled_peptides) {
       pepName += "*";
     }
     
-    if ( PSMNames.lookup(pepName) == -1 ){
-      add(PSMsToProteins, PSMNames, pepName);
+    // the pools number the names in order of first appearance
+    int pepIndex = PSMNames.intern(pepName);
+    if (pepIndex == static_cast<int>(psmWeights.size())) {
+      psmWeights.push_back(-1.0);
     }
-    pepIndex = PSMNames.lookup(pepName);
 
     // r proteins
-    std::vector<string>::const_iterator pid = psm->pPSM->proteinIds.begin();
-    for (; pid!= psm->pPSM->proteinIds.end(); ++pid) {
-      protName = getRidOfUnprintablesAndUnicode(*pid);
-      if (proteinNames.lookup(protName) == -1) {
-        add(proteinsToPSMs, proteinNames, protName);
-      }
-      connect(PSMNames, pepName, proteinNames, protName);
+    for (size_t pid = 0; pid < psm->pPSM->getNumProteins(); ++pid) {
+      int protIndex = proteinNames.intern(
+          getRidOfUnprintablesAndUnicode(psm->pPSM->getProteinId(pid)));
+      edges.push_back(std::make_pair(pepIndex, protIndex));
     }
     // p probability of the peptide match to the spectrum
-    value = 1 - psm->pep;
-    PSMsToProteins.weights[ pepIndex ] = max(PSMsToProteins.weights[pepIndex], value);
- }
+    double value = 1 - psm->pep;
+    psmWeights[pepIndex] = max(psmWeights[pepIndex], value);
+  }
 
-  PSMsToProteins.names = PSMNames.getItemsByNumber();
-  proteinsToPSMs.names = proteinNames.getItemsByNumber();
+  PSMsToProteins.names = Array<string>(PSMNames.size());
+  for (int k = 0; k < PSMsToProteins.names.size(); k++) {
+    PSMsToProteins.names[k] = PSMNames.get(k);
+  }
+  PSMsToProteins.weights = Array<double>(psmWeights);
+  PSMsToProteins.sections = Array<int>(PSMsToProteins.names.size(), -1);
+  
+  proteinsToPSMs.names = Array<string>(proteinNames.size());
+  for (int k = 0; k < proteinsToPSMs.names.size(); k++) {
+    proteinsToPSMs.names[k] = proteinNames.get(k);
+  }
+  proteinsToPSMs.weights = Array<double>(proteinsToPSMs.names.size(), -1.0);
+  proteinsToPSMs.sections = Array<int>(proteinsToPSMs.names.size(), -1);
+  
+  connectAll(edges);
   
   //NOTE this function is assigning PeptideThreshold probablity to all the PSMs with a prob below PeptideThreshold
   /**pseudoCountPSMs();**/
 }
 
+// builds the sorted associations of both layers from a list of (PSM, protein)
+// pairs, which may contain duplicates, with two counting sorts instead of 
+// merging singleton sets edge by edge
+void BasicBigraph::connectAll(const std::vector<std::pair<int, int> > & edges) {
+  int numPSMs = PSMsToProteins.names.size();
+  int numProteins = proteinsToPSMs.names.size();
+  
+  // the PSMs of each protein, in compressed sparse row format
+  std::vector<int> proteinStarts(numProteins + 1, 0);
+  std::vector<int> psmStarts(numPSMs + 1, 0);
+  std::vector<std::pair<int, int> >::const_iterator edge = edges.begin();
+  for (; edge != edges.end(); ++edge) {
+    proteinStarts[edge->second + 1]++;
+    psmStarts[edge->first + 1]++;
+  }
+  for (int k = 0; k < numProteins; k++) {
+    proteinStarts[k + 1] += proteinStarts[k];
+  }
+  for (int k = 0; k < numPSMs; k++) {
+    psmStarts[k + 1] += psmStarts[k];
+  }
+  
+  std::vector<int> psmsByProtein(edges.size());
+  std::vector<int> next(proteinStarts.begin(), proteinStarts.end() - 1);
+  for (edge = edges.begin(); edge != edges.end(); ++edge) {
+    psmsByProtein[ next[edge->second]++ ] = edge->first;
+  }
+  
+  // visiting the proteins in order leaves the proteins of each PSM sorted
+  std::vector<int> proteinsByPSM(edges.size());
+  next.assign(psmStarts.begin(), psmStarts.end() - 1);
+  for (int prot = 0; prot < numProteins; prot++) {
+    for (int e = proteinStarts[prot]; e < proteinStarts[prot + 1]; e++) {
+      proteinsByPSM[ next[ psmsByProtein[e] ]++ ] = prot;
+    }
+  }
+  
+  // and visiting the PSMs in order leaves the PSMs of each protein sorted
+  PSMsToProteins.associations = Array<Set>(numPSMs);
+  proteinsToPSMs.associations = Array<Set>(numProteins);
+  for (int pep = 0; pep < numPSMs; pep++) {
+    Set & proteins = PSMsToProteins.associations[pep];
+    for (int e = psmStarts[pep]; e < psmStarts[pep + 1]; e++) {
+      int prot = proteinsByPSM[e];
+      if (proteins.isEmpty() || proteins.back() != prot) {
+        proteins.add(prot);
+        proteinsToPSMs.associations[prot].add(pep);
+      }
+    }
+  }
+}
 
 void BasicBigraph::read(istream & is, bool multiple_labeled_peptides) {
   char instr;
@@ -255,61 +320,100 @@ void BasicBigraph::reindex() {
 }
 
 BasicBigraph BasicBigraph::buildSubgraph(const Set & connectedProteins, const Set & connectedPSMs) {
+  Array<int> proteinIndex(proteinsToPSMs.size(), -1);
+  for (int k = 0; k < connectedProteins.size(); k++) {
+    proteinIndex[ connectedProteins[k] ] = k;
+  }
+  Array<int> PSMIndex(PSMsToProteins.size(), -1);
+  for (int k = 0; k < connectedPSMs.size(); k++) {
+    PSMIndex[ connectedPSMs[k] ] = k;
+  }
+  return buildSubgraph(connectedProteins, connectedPSMs, proteinIndex, PSMIndex);
+}
+
+// proteinIndex and PSMIndex map the nodes of this graph to their position in
+// connectedProteins and connectedPSMs; since the positions increase with the
+// original indices, the reindexed associations remain sorted
+BasicBigraph BasicBigraph::buildSubgraph(const Set & connectedProteins, const Set & connectedPSMs,
+    const Array<int> & proteinIndex, const Array<int> & PSMIndex) {
   BasicBigraph result;
 
   result.PSMsToProteins.names = PSMsToProteins.names[ connectedPSMs ];
-  result.PSMsToProteins.associations = PSMsToProteins.associations[ connectedPSMs ];
+  result.PSMsToProteins.associations = Array<Set>(connectedPSMs.size());
   result.PSMsToProteins.weights = PSMsToProteins.weights[ connectedPSMs ];
   result.PSMsToProteins.sections = PSMsToProteins.sections[ connectedPSMs ];
 
-  for (int k = 0; k < result.PSMsToProteins.associations.size(); k++) {
-    result.PSMsToProteins.associations[k] = result.PSMsToProteins.associations[k].reindexToFind( connectedProteins );
+  for (int k = 0; k < connectedPSMs.size(); k++) {
+    const Set & as = PSMsToProteins.associations[ connectedPSMs[k] ];
+    Set & reindexed = result.PSMsToProteins.associations[k];
+    for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
+      if (proteinIndex[*iter] == -1) throw Set::InvalidBaseException();
+      reindexed.add( proteinIndex[*iter] );
+    }
   }
 
   result.proteinsToPSMs.names = proteinsToPSMs.names[ connectedProteins ];
-  result.proteinsToPSMs.associations = proteinsToPSMs.associations[ connectedProteins ];
+  result.proteinsToPSMs.associations = Array<Set>(connectedProteins.size());
   result.proteinsToPSMs.weights = proteinsToPSMs.weights[ connectedProteins ];
   result.proteinsToPSMs.sections = proteinsToPSMs.sections[ connectedProteins ];
 
-  for (int k = 0; k < result.proteinsToPSMs.associations.size(); k++) {
-    result.proteinsToPSMs.associations[k] = result.proteinsToPSMs.associations[k].reindexToFind( connectedPSMs );
+  for (int k = 0; k < connectedProteins.size(); k++) {
+    const Set & as = proteinsToPSMs.associations[ connectedProteins[k] ];
+    Set & reindexed = result.proteinsToPSMs.associations[k];
+    for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
+      if (PSMIndex[*iter] == -1) throw Set::InvalidBaseException();
+      reindexed.add( PSMIndex[*iter] );
+    }
   }
 
   return result;
 }
 
 void BasicBigraph::removePoorPSMs() {
+  std::vector<bool> poor(PSMsToProteins.size(), false);
   for (int k = 0; k < PSMsToProteins.size(); k++) {
-    if (PSMsToProteins.weights[k] < PsmThreshold) {
-      disconnectPSM(k);
-    }
+    poor[k] = (PSMsToProteins.weights[k] < PsmThreshold);
   }
+  disconnectMarked(PSMsToProteins, proteinsToPSMs, poor);
 }
 
 void BasicBigraph::removePoorProteins() {
+  std::vector<bool> poor(proteinsToPSMs.size(), false);
   for (int k = 0; k < proteinsToPSMs.size(); k++) {
-    if (Vector(PSMsToProteins.weights[ proteinsToPSMs.associations[k] ]).max() < ProteinThreshold) {
-      disconnectProtein(k);
+    double best = -Numerical::inf();
+    const Set & as = proteinsToPSMs.associations[k];
+    for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
+      best = max(best, PSMsToProteins.weights[*iter]);
     }
+    poor[k] = (best < ProteinThreshold);
   }
+  disconnectMarked(proteinsToPSMs, PSMsToProteins, poor);
 }
 
-void BasicBigraph::disconnectPSM(int k) {
-  Set& as = PSMsToProteins.associations[k];
-  for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
-    Set& setRef = proteinsToPSMs.associations[ *iter ];
-    setRef = setRef.without( Set::SingletonSet( k ) );
+// disconnects all marked nodes of layer gl with one pass over their edges,
+// rather than removing them from the sets of layer other one by one
+void BasicBigraph::disconnectMarked(GraphLayer & gl, GraphLayer & other, 
+    const std::vector<bool> & marked) {
+  std::vector<bool> touched(other.size(), false);
+  for (int k = 0; k < gl.size(); k++) {
+    if (!marked[k]) continue;
+    Set & as = gl.associations[k];
+    for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
+      touched[*iter] = true;
+    }
+    as = Set();
   }
-  as = Set();
-}
-
-void BasicBigraph::disconnectProtein(int k) {
-  Set & as = proteinsToPSMs.associations[k];
-  for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
-    Set & setRef = PSMsToProteins.associations[ *iter ];
-    setRef = setRef.without( Set::SingletonSet( k ) );
+  
+  // the unmarked elements are compacted in place, which keeps them sorted
+  for (int k = 0; k < other.size(); k++) {
+    if (!touched[k]) continue;
+    Array<int> & elements = other.associations[k];
+    int numKept = 0;
+    for (int e = 0; e < elements.size(); e++) {
+      if (!marked[ elements[e] ]) elements[numKept++] = elements[e];
+    }
+    elements.resize(numKept);
   }
-  as = Set();
 }
 
 void BasicBigraph::add(GraphLayer & gl, StringTable & st, const string & item) {
@@ -346,59 +450,84 @@ void BasicBigraph::printProteinWeights() const
     }
 }
 
-void BasicBigraph::traceConnected(int index, GraphLayer & gl, int sectionNumber) {
-  if ( gl.sections[index] == sectionNumber )
-    return;
-  
-  // if it has not already been marked by this section, do so
-  gl.sections[index] = sectionNumber;
-  // add mark to set of marks for this node, set can only be larger than 1 for 
-  // peptides below PeptideThreshold
-  gl.sectionMarks[index] |= Set::SingletonSet(sectionNumber);
-  
-  // do not follow edges with PSM probability below PeptideThreshold
-  if (&gl == &PSMsToProteins && gl.weights[index] <= PeptideThreshold)
-    return;
+namespace {
 
-  const Set& as = gl.associations[index];
-  for (Set::Iterator iter = as.begin(); iter != as.end(); iter++) {
-    if ( &gl == &proteinsToPSMs )
-      traceConnected(*iter, PSMsToProteins, sectionNumber);
-    else
-      traceConnected(*iter, proteinsToPSMs, sectionNumber);
+int findRoot(std::vector<int> & parent, int k) {
+  while (parent[k] != k) {
+    parent[k] = parent[parent[k]];
+    k = parent[k];
   }
+  return k;
+}
+
+void join(std::vector<int> & parent, int a, int b) {
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+  // keep the lowest index as the root
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
 }
 
 int BasicBigraph::markSectionPartitions() {
   // returns the number of sections that are found
-  proteinsToPSMs.sectionMarks = Array<Set>(proteinsToPSMs.size());
-  PSMsToProteins.sectionMarks = Array<Set>(PSMsToProteins.size());
+  int numProteins = proteinsToPSMs.size();
+  int numPSMs = PSMsToProteins.size();
+  
+  proteinsToPSMs.sectionMarks = Array<Set>(numProteins);
+  PSMsToProteins.sectionMarks = Array<Set>(numPSMs);
 
-  PSMsToProteins.sections = Array<int>(PSMsToProteins.size(), -1);
-  proteinsToPSMs.sections = Array<int>(proteinsToPSMs.size(), -1);
+  PSMsToProteins.sections = Array<int>(numPSMs, -1);
+  proteinsToPSMs.sections = Array<int>(numProteins, -1);
+  
+  // the sections are the connected components of the proteins, found by 
+  // union-find; edges through PSMs with a probability at or below 
+  // PeptideThreshold do not connect proteins
+  std::vector<int> parent(numProteins);
+  for (int k = 0; k < numProteins; k++) {
+    parent[k] = k;
+  }
+  for (int k = 0; k < numPSMs; k++) {
+    const Set & as = PSMsToProteins.associations[k];
+    if (PSMsToProteins.weights[k] <= PeptideThreshold || as.isEmpty()) continue;
+    for (int j = 1; j < as.size(); j++) {
+      join(parent, as[0], as[j]);
+    }
+  }
   
   // MT: make sure proteins with equal peptide evidence end up in the same section
   Array<Set> groups = ReplicateIndexer<Set>::replicates(Set::sumSetElements, proteinsToPSMs.associations );
-  std::map<int, int> mapToFirstInGroup;
-  
   for (int k = 0; k < groups.size(); k++) {
-    Set reps = groups[k].without( Set::SingletonSet(groups[k][0]) );
-    for (Set::Iterator iter = reps.begin(); iter != reps.end(); iter++) {
-      mapToFirstInGroup[*iter] = groups[k][0];
+    for (int j = 1; j < groups[k].size(); j++) {
+      join(parent, groups[k][0], groups[k][j]);
     }
   }
   
+  // sections are numbered in order of their first protein
   int section = 0;
-  for (int k = 0; k < proteinsToPSMs.size(); k++) {
-    if (mapToFirstInGroup.find(k) != mapToFirstInGroup.end()) {
-      int sectionNumber = proteinsToPSMs.sections[mapToFirstInGroup[k]];
-      proteinsToPSMs.sections[k] = sectionNumber;
-      // add mark to set of marks for this node, set can only be larger than 1 for 
-      // peptides below PeptideThreshold
-      proteinsToPSMs.sectionMarks[k] |= Set::SingletonSet(sectionNumber);
-    } else if (proteinsToPSMs[k].section == -1) {
-      traceConnected(k, proteinsToPSMs, section);
-      section++;
+  std::vector<int> rootSection(numProteins, -1);
+  for (int k = 0; k < numProteins; k++) {
+    int root = findRoot(parent, k);
+    if (rootSection[root] == -1) {
+      rootSection[root] = section++;
+    }
+    proteinsToPSMs.sections[k] = rootSection[root];
+    proteinsToPSMs.sectionMarks[k] = Set::SingletonSet(rootSection[root]);
+  }
+  
+  // a PSM is marked by the sections of all its proteins, which can only be 
+  // more than one for PSMs at or below PeptideThreshold, and is assigned to
+  // the last of them
+  for (int k = 0; k < numPSMs; k++) {
+    const Set & as = PSMsToProteins.associations[k];
+    Set & marks = PSMsToProteins.sectionMarks[k];
+    for (int j = 0; j < as.size(); j++) {
+      int sect = proteinsToPSMs.sections[ as[j] ];
+      if (marks.find(sect) == -1) marks |= Set::SingletonSet(sect);
+    }
+    if (!marks.isEmpty()) {
+      PSMsToProteins.sections[k] = marks.back();
     }
   }
 
@@ -408,20 +537,26 @@ int BasicBigraph::markSectionPartitions() {
 Array<BasicBigraph> BasicBigraph::partitionSections() {
   int numSections = markSectionPartitions();
 
+  // the position of each node within its section
   Array<Set> proteinSubsets(numSections), PSMSubsets(numSections);
+  Array<int> proteinIndex(proteinsToPSMs.size()), PSMIndex(PSMsToProteins.size());
   for (int k = 0; k < proteinsToPSMs.size(); k++) {
-    proteinSubsets[ proteinsToPSMs[k].section ].add(k);
+    Set & subset = proteinSubsets[ proteinsToPSMs[k].section ];
+    proteinIndex[k] = subset.size();
+    subset.add(k);
   }
 
   for (int k = 0; k < PSMsToProteins.size(); k++) {
-    PSMSubsets[ PSMsToProteins[k].section ].add(k);
+    Set & subset = PSMSubsets[ PSMsToProteins[k].section ];
+    PSMIndex[k] = subset.size();
+    subset.add(k);
   }
 
   // now reindex them to their proper sets
 
   Array<BasicBigraph> result;
   for (int k = 0; k < numSections; k++) {
-    result.add( buildSubgraph( proteinSubsets[k], PSMSubsets[k] ) );
+    result.add( buildSubgraph( proteinSubsets[k], PSMSubsets[k], proteinIndex, PSMIndex ) );
   }
 
   return result;
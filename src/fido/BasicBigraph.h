@@ -2,7 +2,10 @@
 #define _BasicBigraph_H
 
 #include <fstream>
+#include <vector>
+#include <utility>
 #include "Scores.h"
+#include "StringPool.h"
 #include "StringTable.h"
 #include "Array.h"
 #include "Vector.h"
@@ -91,8 +94,9 @@ protected:
   void add(GraphLayer & gl, StringTable & st, const string & item);
   void connect(const StringTable & PSMNames, const string & pepStr, 
 	       const StringTable & proteinNames, const string & protStr);
-  void disconnectProtein(int k);
-  void disconnectPSM(int k);
+  void connectAll(const std::vector<std::pair<int, int> > & edges);
+  void disconnectMarked(GraphLayer & gl, GraphLayer & other, 
+                        const std::vector<bool> & marked);
   void pseudoCountPSMs();
   void floorLowPSMs();
   int markSectionPartitions();
@@ -106,7 +110,8 @@ protected:
   void saveSeveredProteins();
   
   BasicBigraph buildSubgraph(const Set & connectedProteins, const Set & connectedPSMs);
-  void traceConnected(int index, GraphLayer & gl, int sectionNumber);
+  BasicBigraph buildSubgraph(const Set & connectedProteins, const Set & connectedPSMs,
+                             const Array<int> & proteinIndex, const Array<int> & PSMIndex);
 
   double PsmThreshold;
   double PeptideThreshold;
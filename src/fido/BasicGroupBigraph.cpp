@@ -3,6 +3,8 @@
 
 #include "BasicGroupBigraph.h"
 
+#include <algorithm>
+
 BasicGroupBigraph::BasicGroupBigraph(double peptidePrior, bool noClustering, bool trivialGrouping) :
     logLikelihoodConstantCachedFunctor(
       &BasicGroupBigraph::logLikelihoodConstant, "logLikelihoodConstant"),
@@ -55,12 +57,13 @@ void BasicGroupBigraph::groupProteinsBy(const Array<Set> & groups) {
   }
 
   // remove all but the first of each group from the graph
+  std::vector<bool> reps(proteinsToPSMs.size(), false);
   for (int k = 0; k < groups.size(); k++) {
-    Set reps = groups[k].without( Set::SingletonSet(groups[k][0]) );
-    for (Set::Iterator iter = reps.begin(); iter != reps.end(); iter++) {
-      disconnectProtein(*iter);
+    for (int j = 1; j < groups[k].size(); j++) {
+      reps[ groups[k][j] ] = true;
     }
   }
+  disconnectMarked(proteinsToPSMs, PSMsToProteins, reps);
 
   reindex();
 }
@@ -83,6 +86,14 @@ int BasicGroupBigraph::numberAssociatedProteins(int indexEpsilon) const {
   return tot;
 }
 
+int BasicGroupBigraph::maxAssociatedProteins() const {
+  int result = 0;
+  for (int k = 0; k < PSMsToProteins.size(); k++) {
+    result = std::max(result, numberAssociatedProteins(k));
+  }
+  return result;
+}
+
 int BasicGroupBigraph::numberActiveAssociatedProteins(int indexEpsilon, const Array<Counter> & n) const {
   int tot = 0;
 
@@ -193,15 +204,17 @@ double BasicGroupBigraph::probabilityNGivenD(const Model & m, const Array<Counte
 }
 
 double BasicGroupBigraph::logLikelihoodConstant(const Model & m) const {
+  Array<Array<double> > psmTerms, groupProbs;
+  logLikelihoodTables(m, psmTerms, groupProbs);
+  
   double result = 0.0;
   bool starting = true;
 
   Array<Counter> n = originalN;
+  Array<int> active(PSMsToProteins.size(), 0);
 
-  for (Counter::start(n); Counter::inRange(n); Counter::advance(n)) {
-    double L = logLikelihoodNGivenD(m, n);
-    double p = log2(probabilityN(m, n));
-    double logLikeTerm = L+p;
+  for (Counter::start(n); Counter::inRange(n); advanceConfiguration(n, active)) {
+    double logLikeTerm = logLikelihoodTerm(n, active, psmTerms, groupProbs);
 
     if ( starting ) {
       starting = false;
@@ -214,6 +227,72 @@ double BasicGroupBigraph::logLikelihoodConstant(const Model & m) const {
   return result;
 }
 
+// log2 of the likelihood term of each PSM, indexed by the number of active
+// associated proteins, and the prior of each group, indexed by state
+void BasicGroupBigraph::logLikelihoodTables(const Model & m, 
+    Array<Array<double> > & psmTerms, Array<Array<double> > & groupProbs) const {
+  psmTerms = Array<Array<double> >(PSMsToProteins.size());
+  for (int k = 0; k < PSMsToProteins.size(); k++) {
+    int a = numberAssociatedProteins(k);
+    psmTerms[k] = Array<double>(a + 1);
+    for (int active = 0; active <= a; active++) {
+      double probEGivenD = PSMsToProteins.weights[k];
+      double probEGivenN = probabilityEEpsilonGivenActiveAssociatedProteins(m, active);
+      double probE = PeptidePrior;
+      double termE = probEGivenD / probE * probEGivenN;
+      double termNotE = (1-probEGivenD) / (1-probE) * (1-probEGivenN);
+      psmTerms[k][active] = log2(termE + termNotE);
+    }
+  }
+  
+  groupProbs = Array<Array<double> >(originalN.size());
+  for (int k = 0; k < originalN.size(); k++) {
+    groupProbs[k] = Array<double>(originalN[k].size + 1);
+    for (int state = 0; state <= originalN[k].size; state++) {
+      groupProbs[k][state] = m.probabilityProteins(originalN[k].size, state);
+    }
+  }
+}
+
+// logLikelihoodNGivenD + log2(probabilityN) from the tables, summed in the 
+// same order, given the number of active associated proteins of each PSM
+double BasicGroupBigraph::logLikelihoodTerm(const Array<Counter> & n, 
+    const Array<int> & active, const Array<Array<double> > & psmTerms, 
+    const Array<Array<double> > & groupProbs) const {
+  double logProd = 0.0;
+  for (int k = 0; k < psmTerms.size(); k++) {
+    logProd += psmTerms[k][ active[k] ];
+  }
+  
+  double prod = 1.0;
+  for (int k = 0; k < n.size(); k++) {
+    prod *= groupProbs[k][ n[k].state ];
+  }
+  
+  return logProd + log2(prod);
+}
+
+// Counter::advance, which also keeps the number of active associated 
+// proteins of each PSM up to date
+void BasicGroupBigraph::advanceConfiguration(Array<Counter> & n, 
+    Array<int> & active) const {
+  for (int k = 0; k < n.size(); k++) {
+    n[k].advance();
+    int change = 1;
+    if ( ! n[k].inRange() ) {
+      if (k == n.size() - 1) break;
+      change = -n[k].size;
+      n[k].start();
+    }
+    
+    const Set & psms = proteinsToPSMs.associations[k];
+    for (int j = 0; j < psms.size(); j++) {
+      active[ psms[j] ] += change;
+    }
+    if (change > 0) break;
+  }
+}
+
 double BasicGroupBigraph::likelihoodConstant(const Model & m) const {
   double result = 0.0;
 
@@ -267,20 +346,22 @@ double BasicGroupBigraph::eCorrectionEpsilon(int indexEpsilon, const Model & m,
 }
 
 Array<double> BasicGroupBigraph::probabilityRGivenD(const Model & m) {
+  Array<Array<double> > psmTerms, groupProbs;
+  logLikelihoodTables(m, psmTerms, groupProbs);
+  double logConstant = logLikelihoodConstantCachedFunctor(m, this);
+  
   Array<Counter> n = originalN;
-  Vector result;
-
-  for (Counter::start(n); Counter::inRange(n); Counter::advance(n)) {
-    Vector term = probabilityNGivenD(m, n) * Vector( probabilityRGivenN(n) );
+  Array<int> active(PSMsToProteins.size(), 0);
+  Array<double> result(originalN.size(), 0.0);
 
-    if ( result.size() == 0 ) {
-      result = term;
-    } else {
-      result += term;
+  for (Counter::start(n); Counter::inRange(n); advanceConfiguration(n, active)) {
+    double prob = pow(2.0, logLikelihoodTerm(n, active, psmTerms, groupProbs) - logConstant);
+    for (int k = 0; k < result.size(); k++) {
+      result[k] += prob * probabilityRRhoGivenN(k, n);
     }
   }
 
-  return result.unpack();
+  return result;
 }
 
 Array<double> BasicGroupBigraph::probabilityRGivenN(const Array<Counter> & n) {
@@ -95,6 +95,7 @@ class BasicGroupBigraph : public BasicBigraph {
   }
   
   double logNumberOfConfigurations() const;
+  int maxAssociatedProteins() const;
   void getProteinProbs(const Model& m);
   void printProteinWeights() const;
 
@@ -147,6 +148,14 @@ class BasicGroupBigraph : public BasicBigraph {
   double probabilityNGivenD(const Model& m, const Array<Counter> & n) const;
 
   double logLikelihoodConstant(const Model& m) const;
+
+  // table lookups for enumerating the configurations
+  void logLikelihoodTables(const Model& m, Array<Array<double> > & psmTerms, 
+                           Array<Array<double> > & groupProbs) const;
+  double logLikelihoodTerm(const Array<Counter> & n, const Array<int> & active,
+                           const Array<Array<double> > & psmTerms, 
+                           const Array<Array<double> > & groupProbs) const;
+  void advanceConfiguration(Array<Counter> & n, Array<int> & active) const;
   double likelihoodConstant(const Model& m) const;
 
   Array<double> probabilityRGivenD(const Model& m);
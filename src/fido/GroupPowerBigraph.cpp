@@ -3,12 +3,31 @@
 
 #include "GroupPowerBigraph.h"
 
+#include <algorithm>
+
 GroupPowerBigraph::~GroupPowerBigraph() { }
 
 Array<double> GroupPowerBigraph::proteinProbs() {
+  // the subgraphs are independent and their sizes are very skewed; hand them 
+  // out to the threads largest first, so that the wall time is determined by
+  // the largest subgraph rather than by whichever one happens to come last
+  int numSubgraphs = subgraphs_.size();
+  std::vector<std::pair<double, int> > bySize(numSubgraphs);
+  for (int k = 0; k < numSubgraphs; k++) {
+    bySize[k] = std::make_pair(-subgraphs_[k].logNumberOfConfigurations(), k);
+  }
+  std::sort(bySize.begin(), bySize.end());
+  
+  // tabulate the model probabilities once, the subgraphs only read them
+  params_.tabulate(maxAssociatedProteins_);
+  
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int k = 0; k < numSubgraphs; k++) {
+    subgraphs_[bySize[k].second].getProteinProbs(params_);
+  }
+  
   Array<double> result;
-  for (int k = 0; k < subgraphs_.size(); k++) {
-    subgraphs_[k].getProteinProbs(params_);
+  for (int k = 0; k < numSubgraphs; k++) {
     result.append( subgraphs_[k].proteinProbabilities() );
   }
   return result;
@@ -189,6 +208,12 @@ void GroupPowerBigraph::initialize(BasicBigraph& basicBigraph) {
       subgraphs_[k] = BasicGroupBigraph(peptidePrior_, subBasic[k], noClustering_, trivialGrouping_);
     }
   }
+  
+  maxAssociatedProteins_ = 0;
+  for (int k = 0; k < subgraphs_.size(); k++) {
+    maxAssociatedProteins_ = std::max(maxAssociatedProteins_, 
+                                      subgraphs_[k].maxAssociatedProteins());
+  }
   getGroupProtNames();
 }
 
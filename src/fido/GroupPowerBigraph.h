@@ -34,7 +34,7 @@ class GroupPowerBigraph {
         LOG_MAX_ALLOWED_CONFIGURATIONS(18),
         psmThreshold_(0.0), peptideThreshold_(1e-3),
         proteinThreshold_(1e-3), peptidePrior_(0.1),
-        trivialGrouping_(trivialGrouping) {}
+        trivialGrouping_(trivialGrouping), maxAssociatedProteins_(0) {}
   ~GroupPowerBigraph();
   
   Array<double> proteinProbs();
@@ -125,6 +125,8 @@ private:
   Array<Array<std::string> > groupProtNames_;
   /* subgraphs resulting from the partitioning and pruning steps */
   Array<BasicGroupBigraph> subgraphs_;
+  /* largest number of proteins a PSM is associated with, over all subgraphs */
+  int maxAssociatedProteins_;
 };
 
 ostream & operator <<(ostream & os, pair<double,double> rhs);
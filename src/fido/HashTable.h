@@ -1,8 +1,8 @@
 // Written by Oliver Serang 2009
 // see license for more information
 
-#ifndef _HASHTABLE_H
-#define _HASHTABLE_H
+#ifndef _FIDO_HASHTABLE_H
+#define _FIDO_HASHTABLE_H
 
 #include "Array.h"
 #include <list>
@@ -7,6 +7,7 @@
 using namespace std;
 
 #include <cmath>
+#include <vector>
 #include "Combinatorics.h"
 
 #include <iostream>
@@ -35,33 +36,89 @@ class Model {
   void setAlphaBeta(double a, double b) {
     alpha = a;
     beta = b;
+    clearTables();
   }
   
   void setAlphaBetaGamma(double a, double b, double g) {
     alpha = a;
     beta = b;
     gamma = g;
+    clearTables();
   }
 
   double associatedEmission() const { return alpha; }
   double spontaneousEmission() const { return beta; }
   
+  // precomputes the probabilities below for up to @maxProts proteins, so that
+  // the configuration loops only need table lookups; the tables are shared
+  // by all subgraphs and cleared whenever a parameter changes
+  void tabulate(int maxProts) {
+    if (static_cast<int>(noEmissionTable_.size()) > maxProts) return;
+    
+    noEmissionTable_.resize(maxProts + 1);
+    for (int n = 0; n <= maxProts; n++) {
+      noEmissionTable_[n] = computeProbabilityNoEmissionFrom(n);
+    }
+    
+    logProteinsTable_.resize((maxProts + 1) * (maxProts + 2) / 2);
+    for (int total = 0; total <= maxProts; total++) {
+      for (int active = 0; active <= total; active++) {
+        logProteinsTable_[proteinsTableIndex(total, active)] = 
+            computeLogProbabilityProteins(total, active);
+      }
+    }
+  }
+  
   // probability that a peptide is not emitted, given @numActivProts
   double probabilityNoEmissionFrom(int numActiveProts) const {
-    // using log for greater precision
-    return pow(2.0, log2( 1-beta )+numActiveProts * log2(1-alpha) );
+    if (numActiveProts < static_cast<int>(noEmissionTable_.size())) {
+      return noEmissionTable_[numActiveProts];
+    }
+    return computeProbabilityNoEmissionFrom(numActiveProts);
+  }
+  
+  // log2 of the probability that @activeProts are present, given @totalProts
+  double logProbabilityProteins(int totalProts, int activeProts) const {
+    if (totalProts < static_cast<int>(noEmissionTable_.size())) {
+      return logProteinsTable_[proteinsTableIndex(totalProts, activeProts)];
+    }
+    return computeLogProbabilityProteins(totalProts, activeProts);
   }
   
   // probability that @activeProts are present, given @totalProts
   double probabilityProteins(int totalProts, int activeProts) const {
-    // using log for greater precision
-    return pow(2.0, Combinatorics::logBinomial(totalProts, activeProts) + activeProts*log2(gamma) + (totalProts-activeProts) * log2(1-gamma) );
+    return pow(2.0, logProbabilityProteins(totalProts, activeProts));
   }
 
   friend ostream & operator <<(ostream & os, const Model & m) {
     os << "alpha = " << m.alpha << ", \t beta = " << m.beta << ", \t gamma = " << m.gamma << endl;
     return os;
   }
+  
+ protected:
+  void clearTables() {
+    noEmissionTable_.clear();
+    logProteinsTable_.clear();
+  }
+  
+ private:
+  /* probabilityNoEmissionFrom by number of active proteins */
+  std::vector<double> noEmissionTable_;
+  /* logProbabilityProteins as a lower triangular matrix by total, then active proteins */
+  std::vector<double> logProteinsTable_;
+  
+  static int proteinsTableIndex(int totalProts, int activeProts) {
+    return totalProts * (totalProts + 1) / 2 + activeProts;
+  }
+  
+  double computeProbabilityNoEmissionFrom(int numActiveProts) const {
+    // using log for greater precision
+    return pow(2.0, log2( 1-beta )+numActiveProts * log2(1-alpha) );
+  }
+  
+  double computeLogProbabilityProteins(int totalProts, int activeProts) const {
+    return Combinatorics::logBinomial(totalProts, activeProts) + activeProts*log2(gamma) + (totalProts-activeProts) * log2(1-gamma);
+  }
 };
 
 /*
@@ -150,7 +207,7 @@ class GridModel : public Model {
   bool inRange() const { return alphaRange.inRange() && betaRange.inRange(); }
   void setalphaRange(RealRange __alphaRange) { alphaRange = __alphaRange; }  
   void setbetaRange(RealRange __betaRange) { betaRange = __betaRange; }  
-  void setGamma(double __gamma) { gamma = __gamma; }
+  void setGamma(double __gamma) { gamma = __gamma; clearTables(); }
 };
 
 #endif
@@ -21,14 +21,258 @@ using namespace std;
 #define LOG2(x) 1.4426950408889634*log(x)
 // for compatibility issues, not using log2
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+  #define SSL_X86_KERNELS
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+const size_t kAlignment = 64u; // in bytes
+const int kRowBlockSize = 64; // examples kept in cache by addScaledRows
+
+/*
+ * The feature rows of the active examples of a CGLS call, copied into one
+ * aligned buffer with a row stride that is a multiple of 8 and zero padding
+ */
+class PackedRows {
+ public:
+  PackedRows(const double** set, const int* subset, int numRows, 
+             int numFeatures) : numRows_(numRows), numFeatures_(numFeatures),
+      stride_((numFeatures + 7) & ~7), buffer_(NULL), data_(NULL) {
+    const size_t kPadding = kAlignment / sizeof(double) - 1u;
+    buffer_ = new double[static_cast<size_t>(numRows) * stride_ + kPadding];
+    size_t offset = reinterpret_cast<size_t>(buffer_) % kAlignment;
+    data_ = buffer_ + (offset ? (kAlignment - offset) / sizeof(double) : 0u);
+    for (int i = 0; i < numRows; ++i) {
+      double* row = data_ + static_cast<size_t>(i) * stride_;
+      std::copy(set[subset[i]], set[subset[i]] + numFeatures, row);
+      std::fill(row + numFeatures, row + stride_, 0.0);
+    }
+  }
+  ~PackedRows() { delete[] buffer_; }
+  inline int getNumRows() const { return numRows_; }
+  inline int getNumFeatures() const { return numFeatures_; }
+  inline int getStride() const { return stride_; }
+  inline const double* getRow(int i) const {
+    return data_ + static_cast<size_t>(i) * stride_;
+  }
+ private:
+  int numRows_, numFeatures_, stride_;
+  double *buffer_, *data_;
+  PackedRows(const PackedRows&);
+  PackedRows& operator=(const PackedRows&);
+};
+
+/*
+ * q[i] = x_i' p + p[numFeatures], adding the feature terms in increasing 
+ * order with separate multiplications and additions
+ */
+typedef void (*MultiplyRowsFunction)(const double* rows, int numRows, 
+    int stride, int numFeatures, const double* p, double* q);
+
+/*
+ * r += sum_i z[i] x_i over the full stride, adding the examples in 
+ * increasing order
+ */
+typedef void (*AddScaledRowsFunction)(const double* rows, int numRows, 
+    int stride, const double* z, double* r);
+
+void multiplyRowsPortable(const double* rows, int numRows, int stride, 
+    int numFeatures, const double* p, double* q) {
+  for (int i = 0; i < numRows; ++i) {
+    const double* val = rows + static_cast<size_t>(i) * stride;
+    double t = 0.0;
+    for (int j = 0; j < numFeatures; ++j) {
+      t += val[j] * p[j];
+    }
+    t += p[numFeatures];
+    q[i] = t;
+  }
+}
+
+void addScaledRowsPortable(const double* rows, int numRows, int stride, 
+    const double* z, double* r) {
+  for (int i = 0; i < numRows; ++i) {
+    const double* val = rows + static_cast<size_t>(i) * stride;
+    const double t = z[i];
+    for (int j = 0; j < stride; ++j) {
+      r[j] += val[j] * t;
+    }
+  }
+}
+
+#ifdef SSL_X86_KERNELS
+// the products of 4 examples are formed in parallel, one per lane
+__attribute__((target("avx2")))
+void multiplyRowsAvx2(const double* rows, int numRows, int stride, 
+    int numFeatures, const double* p, double* q) {
+  const long long s = stride;
+  const __m256i offsets = _mm256_set_epi64x(3 * s, 2 * s, s, 0);
+  int i = 0;
+  for ( ; i + 4 <= numRows; i += 4) {
+    const double* block = rows + static_cast<size_t>(i) * stride;
+    __m256d acc = _mm256_setzero_pd();
+    for (int j = 0; j < numFeatures; ++j) {
+      acc = _mm256_add_pd(acc, _mm256_mul_pd(
+          _mm256_i64gather_pd(block + j, offsets, 8), _mm256_set1_pd(p[j])));
+    }
+    acc = _mm256_add_pd(acc, _mm256_set1_pd(p[numFeatures]));
+    _mm256_storeu_pd(q + i, acc);
+  }
+  multiplyRowsPortable(rows + static_cast<size_t>(i) * stride, numRows - i, 
+                       stride, numFeatures, p, q + i);
+}
+
+__attribute__((target("avx2")))
+void addScaledRowsAvx2(const double* rows, int numRows, int stride, 
+    const double* z, double* r) {
+  for (int first = 0; first < numRows; first += kRowBlockSize) {
+    const int last = std::min(first + kRowBlockSize, numRows);
+    for (int j = 0; j < stride; j += 4) {
+      __m256d acc = _mm256_loadu_pd(r + j);
+      for (int i = first; i < last; ++i) {
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_load_pd(
+            rows + static_cast<size_t>(i) * stride + j), _mm256_set1_pd(z[i])));
+      }
+      _mm256_storeu_pd(r + j, acc);
+    }
+  }
+}
+
+// AVX-512F implies FMA, the explicitly rounded operations keep the compiler
+// from contracting the multiplication and addition into one instruction
+__attribute__((target("avx512f")))
+void multiplyRowsAvx512(const double* rows, int numRows, int stride, 
+    int numFeatures, const double* p, double* q) {
+  const long long s = stride;
+  const __m512i offsets = _mm512_set_epi64(7 * s, 6 * s, 5 * s, 4 * s, 
+                                           3 * s, 2 * s, s, 0);
+  // the last examples are handled by masking, as scalar code inlined here 
+  // could be contracted as well
+  for (int i = 0; i < numRows; i += 8) {
+    const __mmask8 mask = static_cast<__mmask8>(
+        numRows - i >= 8 ? 0xFF : (1u << (numRows - i)) - 1u);
+    const double* block = rows + static_cast<size_t>(i) * stride;
+    __m512d acc = _mm512_setzero_pd();
+    for (int j = 0; j < numFeatures; ++j) {
+      __m512d x = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), mask, 
+                                           offsets, block + j, 8);
+      __m512d product = _mm512_mul_round_pd(x, _mm512_set1_pd(p[j]),
+                                            _MM_FROUND_CUR_DIRECTION);
+      acc = _mm512_add_round_pd(acc, product, _MM_FROUND_CUR_DIRECTION);
+    }
+    acc = _mm512_add_round_pd(acc, _mm512_set1_pd(p[numFeatures]), 
+                              _MM_FROUND_CUR_DIRECTION);
+    _mm512_mask_storeu_pd(q + i, mask, acc);
+  }
+}
+
+__attribute__((target("avx512f")))
+void addScaledRowsAvx512(const double* rows, int numRows, int stride, 
+    const double* z, double* r) {
+  for (int first = 0; first < numRows; first += kRowBlockSize) {
+    const int last = std::min(first + kRowBlockSize, numRows);
+    for (int j = 0; j < stride; j += 8) {
+      __m512d acc = _mm512_loadu_pd(r + j);
+      for (int i = first; i < last; ++i) {
+        __m512d product = _mm512_mul_round_pd(_mm512_load_pd(
+            rows + static_cast<size_t>(i) * stride + j), _mm512_set1_pd(z[i]),
+            _MM_FROUND_CUR_DIRECTION);
+        acc = _mm512_add_round_pd(acc, product, _MM_FROUND_CUR_DIRECTION);
+      }
+      _mm512_storeu_pd(r + j, acc);
+    }
+  }
+}
+#endif
+
+MultiplyRowsFunction selectMultiplyRowsFunction() {
+#ifdef SSL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return multiplyRowsAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return multiplyRowsAvx2;
+  }
+#endif
+  return multiplyRowsPortable;
+}
+
+AddScaledRowsFunction selectAddScaledRowsFunction() {
+#ifdef SSL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return addScaledRowsAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return addScaledRowsAvx2;
+  }
+#endif
+  return addScaledRowsPortable;
+}
+
+const MultiplyRowsFunction multiplyRows = selectMultiplyRowsFunction();
+const AddScaledRowsFunction addScaledRows = selectAddScaledRowsFunction();
+
+/*
+ * q = X p for the packed examples, returns sum_i c[i] q[i]^2
+ */
+double multiplyPacked(const PackedRows& rows, const double* p, 
+                      const double* c, double* q) {
+  const int numRows = rows.getNumRows();
+  multiplyRows(rows.getRow(0), numRows, rows.getStride(), 
+               rows.getNumFeatures(), p, q);
+  double sum = 0.0;
+  for (int i = 0; i < numRows; ++i) {
+    sum += c[i] * q[i] * q[i];
+  }
+  return sum;
+}
+
+/*
+ * r = X' z for the packed examples, including the bias term r[numFeatures];
+ * partial is scratch space of the width of a packed row
+ */
+void multiplyPackedTransposed(const PackedRows& rows, const double* z, 
+    double* r, std::vector<double>& partial) {
+  const int numRows = rows.getNumRows();
+  const int numFeatures = rows.getNumFeatures();
+  partial.assign(rows.getStride(), 0.0);
+  addScaledRows(rows.getRow(0), numRows, rows.getStride(), z, &partial[0]);
+  double bias = 0.0;
+  for (int i = 0; i < numRows; ++i) {
+    bias += z[i];
+  }
+  std::copy(partial.begin(), partial.begin() + numFeatures, r);
+  r[numFeatures] = bias;
+}
+
+} // namespace
+
 AlgIn::AlgIn(const int size, const int numFeat) {
   vals = new const double*[size];
   Y = new double[size];
   C = new double[size];
+  m = 0;
   n = numFeat;
   positives = 0;
   negatives = 0;
 }
+AlgIn::AlgIn(const AlgIn& other) {
+  m = other.m;
+  n = other.n;
+  positives = other.positives;
+  negatives = other.negatives;
+  vals = new const double*[m];
+  Y = new double[m];
+  C = new double[m];
+  std::copy(other.vals, other.vals + m, vals);
+  std::copy(other.Y, other.Y + m, Y);
+  std::copy(other.C, other.C + m, C);
+}
 AlgIn::~AlgIn() {
   delete[] vals;
   delete[] Y;
@@ -37,7 +281,8 @@ AlgIn::~AlgIn() {
 
 int CGLS(const AlgIn& data, const double lambda, const int cgitermax,
          const double epsilon, const struct vector_int* Subset,
-         struct vector_double* Weights, struct vector_double* Outputs) {
+         struct vector_double* Weights, struct vector_double* Outputs,
+         int* Iterations) {
   if (VERBOSE_CGLS) {
     cout << "CGLS starting..." << endl;
   }
@@ -53,26 +298,22 @@ int CGLS(const AlgIn& data, const double lambda, const int cgitermax,
   //  int m  = pSet->size();
   double* beta = Weights->vec;
   double* o = Outputs->vec;
+  // pack the active examples once, the products below only touch them
+  PackedRows rows(set, J, active, n - 1);
+  std::vector<double> partial;
   // initialize z
   double* z = new double[active];
   double* q = new double[active];
+  double* c = new double[active];
   int ii = 0;
-  register int i, j;
+  int i;
   for (i = active; i--;) {
     ii = J[i];
+    c[i] = C[ii];
     z[i] = C[ii] * (Y[ii] - o[ii]);
   }
   double* r = new double[n];
-  for (i = n; i--;) {
-    r[i] = 0.0;
-  }
-  for (j = 0; j < active; j++) {
-    const double* val = set[J[j]];
-    for (i = n - 1; i--;) {
-      r[i] += val[i] * z[j];
-    }
-    r[n - 1] += z[j];
-  }
+  multiplyPackedTransposed(rows, z, r, partial);
   double* p = new double[n];
   double omega1 = 0.0;
   for (i = n; i--;) {
@@ -92,43 +333,20 @@ int CGLS(const AlgIn& data, const double lambda, const int cgitermax,
   // iterate
   while (cgiter < cgitermax) {
     cgiter++;
-    omega_q = 0.0;
-    double t = 0.0;
-    //    register int i,j;
-    // #pragma omp parallel for private(i,j)
-    for (i = 0; i < active; i++) {
-      ii = J[i];
-      t = 0.0;
-      const double* val = set[ii];
-      for (j = 0; j < n - 1; j++) {
-        t += val[j] * p[j];
-      }
-      t += p[n - 1];
-      q[i] = t;
-      omega_q += C[ii] * t * t;
-    }
+    omega_q = multiplyPacked(rows, p, c, q);
     gamma = omega1 / (lambda * omega_p + omega_q);
     inv_omega2 = 1 / omega1;
     for (int i = n; i--;) {
-      r[i] = 0.0;
       beta[i] += gamma * p[i];
     }
     omega_z = 0.0;
     for (int i = active; i--;) {
       ii = J[i];
       o[ii] += gamma * q[i];
-      z[i] -= gamma * C[ii] * q[i];
+      z[i] -= gamma * c[i] * q[i];
       omega_z += z[i] * z[i];
     }
-    for (register int j = 0; j < active; j++) {
-      ii = J[j];
-      t = z[j];
-      const double* val = set[ii];
-      for (register int i = 0; i < n - 1; i++) {
-        r[i] += val[i] * t;
-      }
-      r[n - 1] += t;
-    }
+    multiplyPackedTransposed(rows, z, r, partial);
     omega1 = 0.0;
     for (int i = n; i--;) {
       r[i] -= lambda * beta[i];
@@ -158,14 +376,19 @@ int CGLS(const AlgIn& data, const double lambda, const int cgitermax,
   }
   delete[] z;
   delete[] q;
+  delete[] c;
   delete[] r;
   delete[] p;
+  if (Iterations) {
+    *Iterations = cgiter;
+  }
   return optimality;
 }
 
 int L2_SVM_MFN(const AlgIn& data, struct options* Options,
                struct vector_double* Weights,
-               struct vector_double* Outputs) {
+               struct vector_double* Outputs,
+               struct solver_stats* Stats) {
   /* Disassemble the structures */
   timer tictoc;
   tictoc.restart();
@@ -179,6 +402,7 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
   int cgitermax = SMALL_CGITERMAX;
   double* w = Weights->vec;
   double* o = Outputs->vec;
+  int cgiter = 0, cgiterTotal = 0;
   double F_old = 0.0;
   double F = 0.0;
   double diff = 0.0;
@@ -217,7 +441,6 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
   Weights_bar->d = n;
   Outputs_bar->d = m;
   double delta = 0.0;
-  double t = 0.0;
   int ii = 0;
   while (iter < Options->mfnitermax) {
     iter++;
@@ -238,15 +461,16 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
                epsilon,
                ActiveSubset,
                Weights_bar,
-               Outputs_bar);
-    for (register int i = active; i < m; i++) {
-      ii = ActiveSubset->vec[i];
-      const double* val = set[ii];
-      t = w_bar[n - 1];
-      for (register int j = n - 1; j--;) {
+               Outputs_bar,
+               &cgiter);
+    cgiterTotal += cgiter;
+    for (int i = active; i < m; i++) {
+      const double* val = set[ActiveSubset->vec[i]];
+      double t = w_bar[n - 1];
+      for (int j = n - 1; j--;) {
         t += val[j] * w_bar[j];
       }
-      o_bar[ii] = t;
+      o_bar[ActiveSubset->vec[i]] = t;
     }
     if (ini == 0) {
       cgitermax = CGITERMAX;
@@ -292,6 +516,10 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
               << " iteration(s) and " << tictoc.time() << " seconds. \n"
               << endl;
         }
+        if (Stats) {
+          Stats->mfn_iterations = iter;
+          Stats->cgls_iterations = cgiterTotal;
+        }
         return 1;
       }
     }
@@ -320,6 +548,16 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
     ActiveSubset->d = active;
     if (fabs(F - F_old) < RELATIVE_STOP_EPS * fabs(F_old)) {
       //    cout << "L2_SVM_MFN converged (rel. criterion) in " << iter << " iterations and "<< tictoc.time() << " seconds. \n" << endl;
+      delete[] ActiveSubset->vec;
+      delete[] ActiveSubset;
+      delete[] o_bar;
+      delete[] w_bar;
+      delete[] Weights_bar;
+      delete[] Outputs_bar;
+      if (Stats) {
+        Stats->mfn_iterations = iter;
+        Stats->cgls_iterations = cgiterTotal;
+      }
       return 2;
     }
   }
@@ -331,6 +569,10 @@ int L2_SVM_MFN(const AlgIn& data, struct options* Options,
   delete[] Outputs_bar;
   tictoc.stop();
   //  cout << "L2_SVM_MFN converged (max iter exceeded) in " << iter << " iterations and "<< tictoc.time() << " seconds. \n" << endl;
+  if (Stats) {
+    Stats->mfn_iterations = iter;
+    Stats->cgls_iterations = cgiterTotal;
+  }
   return 0;
 }
 
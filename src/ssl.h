@@ -24,6 +24,7 @@ using namespace std;
 class AlgIn {
   public:
     AlgIn(const int size, const int numFeat);
+    AlgIn(const AlgIn& other); /* copies the m examples of other */
     virtual ~AlgIn();
     int m; /* number of examples */
     int n; /* number of features */
@@ -41,6 +42,8 @@ class AlgIn {
         C[ix] = pos;
       }
     }
+  private:
+    AlgIn& operator=(const AlgIn&);
 };
 
 /* Data: Input examples are stored in sparse (Compressed Row Storage) format */
@@ -67,6 +70,11 @@ struct vector_int { /* defines a vector of ints for index subsets */
     int* vec; /* ptr to vector elements */
 };
 
+struct solver_stats { /* convergence statistics of L2_SVM_MFN */
+    int mfn_iterations; /* number of MFN iterations */
+    int cgls_iterations; /* total number of CGLS iterations */
+};
+
 struct options {
     /* user options */
     double lambda; /* regularization parameter */
@@ -127,13 +135,16 @@ double norm_square(const vector_double* A); /* returns squared length of A */
 /* over a subset of examples x_i specified by vector_int Subset */
 int CGLS(const AlgIn& set, const double lambda, const int cgitermax,
          const double epsilon, const struct vector_int* Subset,
-         struct vector_double* Weights, struct vector_double* Outputs);
+         struct vector_double* Weights, struct vector_double* Outputs,
+         int* Iterations = NULL);
 
 /* Linear Modified Finite Newton L2-SVM*/
 /* Solves: min_w 0.5*Options->lamda*w'*w + 0.5*sum_i Data->C[i] max(0,1 - Y[i] w' x_i)^2 */
+/* Starts from the given Weights, Outputs have to hold w' x_i for these weights */
 int L2_SVM_MFN(const AlgIn& set, struct options* Options,
                struct vector_double* Weights,
-               struct vector_double* Outputs);
+               struct vector_double* Outputs,
+               struct solver_stats* Stats = NULL);
 double line_search(double* w, double* w_bar, double lambda, double* o,
                    double* o_bar, const double* Y, const double* C, int d,
                    int l);